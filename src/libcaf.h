@@ -88,6 +88,15 @@ typedef enum caf_deregister_t {
 }
 caf_deregister_t;
 
+/* The operations of caf_atomic_op, as numbered by gfortran. */
+typedef enum caf_atomic_op_t {
+  GFC_CAF_ATOMIC_ADD = 1,
+  GFC_CAF_ATOMIC_AND,
+  GFC_CAF_ATOMIC_OR,
+  GFC_CAF_ATOMIC_XOR
+}
+caf_atomic_op_t;
+
 typedef void* caf_token_t;
 /** Add a dummy type representing teams in coarrays. */
 
@@ -288,6 +297,19 @@ void PREFIX(sendget_by_ref) (caf_token_t dst_token, int dst_image_index,
 int PREFIX(is_present) (caf_token_t, int, caf_reference_t *refs);
 #endif
 
+void PREFIX(datatype_cache_stats) (long long *, long long *, int *);
+void PREFIX(staging_stats) (long long *, long long *, long long *);
+void PREFIX(put_combining_stats) (long long *, long long *, long long *);
+void PREFIX(sync_plan_stats) (long long *, long long *, int *);
+
+void PREFIX(get_async) (void *, void *, size_t, int, int *);
+void PREFIX(put_async) (void *, void *, size_t, int, int *);
+void PREFIX(wait) (int *);
+void PREFIX(test) (int *, bool *);
+void PREFIX(wait_all) (void);
+void PREFIX(event_post_many) (void *, int, int *, int *);
+int PREFIX(event_wait_any) (int, void **, int *, int *);
+
 void PREFIX (co_broadcast) (gfc_descriptor_t *, int, int *, char *, charlen_t);
 void PREFIX (co_max) (gfc_descriptor_t *, int, int *, char *, int, charlen_t);
 void PREFIX (co_min) (gfc_descriptor_t *, int, int *, char *, int, charlen_t);
@@ -43,9 +43,16 @@
 #endif
 #include <unistd.h>
 #include <stdint.h>     /* For int32_t. */
+#include <limits.h>     /* For INT_MAX. */
 #include <mpi.h>
 #include <pthread.h>
 #include <signal.h>     /* For raise */
+#include <sched.h>      /* For sched_yield. */
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
 
 #ifdef HAVE_MPI_EXT_H
 #include <mpi-ext.h>
@@ -78,7 +85,8 @@ static char* caf_ref_type_str[] = {
 
 #ifndef EXTRA_DEBUG_OUTPUT
 #define dprint(...)
-#define chk_err(...)
+/* Still use the error code, so that it is not reported as set but unused. */
+#define chk_err(ierr) (void) (ierr)
 #else
 #define dprint(format, ...)                     \
 fprintf(stderr, "%d/%d: %s(%d) " format,        \
@@ -123,6 +131,15 @@ typedef struct mpi_caf_token_t
   /* The pointer to the primary array, i.e., to coarrays that are arrays and
    * not a derived type. */
   gfc_descriptor_t *desc;
+  /* The addresses of the memory of this object on the images of this node,
+   * indexed by the rank in node_comm, or NULL when the memory is not shared
+   * with the other images of the node.  An entry is NULL for an image
+   * without memory for the object. */
+  void **node_base;
+  /* The shared memory window over node_comm providing the memory, or
+   * MPI_WIN_NULL when memptr_win is the shared memory window, because all
+   * images are on this node. */
+  MPI_Win shared_win;
 } mpi_caf_token_t;
 
 /* For components of derived type coarrays a slave_token is needed when the
@@ -179,8 +196,29 @@ static void terminate_internal (int stat_code, int exit_code)
 static void sync_images_internal (int count, int images[], int *stat,
                                   char *errmsg, size_t errmsg_len,
                                   bool internal);
+static void free_sync_plans (void);
 static void error_stop_str (const char *string, size_t len, bool quiet)
             __attribute__((noreturn));
+#ifdef GCC_GE_7
+static void free_ref_plan (void);
+#endif
+#if MPI_VERSION >= 3
+static int complete_async (int rank, MPI_Win win);
+static int flush_combined (int rank, MPI_Win win);
+#endif
+
+/* Images on the same node access each other's coarrays through shared
+ * memory.  Failed images are not supported, because the shared memory
+ * windows would have to be rebuilt when an image fails. */
+#if defined(GCC_GE_7) && MPI_VERSION >= 3 && !defined(WITH_FAILED_IMAGES)
+#define CAF_NODE_SHARED_MEMORY
+#endif
+
+/* Images waiting for an event whose counter is in node shared memory sleep
+ * on the futex of their wake word. */
+#if defined(CAF_NODE_SHARED_MEMORY) && defined(__linux__)
+#define CAF_EVENT_FUTEX
+#endif
 
 /* Global variables. */
 static int caf_this_image;
@@ -198,27 +236,58 @@ static const size_t stdptr_size = sizeof(void *);
 /* Variables needed for syncing images. */
 
 static int *images_full;
-MPI_Request *sync_handles;
-static int *arrived;
+MPI_Request *sync_handles, *sync_send_handles;
+static int *arrived, *sync_done;
+/* sync_images_seen[i] is sync_images_epoch, when image i + 1 is in the list of
+ * the current SYNC IMAGES, which detects duplicates in O(count). */
+static int *sync_images_seen;
+static int sync_images_epoch = 0;
+/* The cached plans of SYNC IMAGES, see find_sync_plan(). */
+typedef struct sync_plan_t
+{
+  uint64_t hash;
+  int count;
+  int *images;
+  /* The receive from images[i] is requests[i], the send to it is
+   * requests[count + i]. */
+  MPI_Request *requests;
+  struct sync_plan_t *next;
+} sync_plan_t;
+
+static sync_plan_t *sync_plans = NULL;
+static int sync_plan_entries = 0, sync_plan_capacity = 0;
+static long long sync_plan_hits = 0, sync_plan_misses = 0;
+/* The message of the persistent sends. */
+static int sync_plan_zero = 0;
+
 static const int MPI_TAG_CAF_SYNC_IMAGES = 424242;
 
-/* Pending puts */
-#if defined(NONBLOCKING_PUT) && !defined(CAF_MPI_LOCK_UNLOCK)
-typedef struct win_sync {
-  MPI_Win *win;
-  int img;
-  struct win_sync *next;
-} win_sync;
+/* Variables needed for waking images waiting for events, see
+ * event_notify(). */
 
-static win_sync *last_elem = NULL;
-static win_sync *pending_puts = NULL;
+static MPI_Comm event_comm = MPI_COMM_NULL;
+static const int MPI_TAG_CAF_EVENT = 424243;
+static int event_spin = 1000;
+/* event_team_ranks[i] is the rank in event_comm of rank i in event_team. */
+static MPI_Comm event_team = MPI_COMM_NULL;
+static int *event_team_ranks = NULL;
+#ifdef CAF_NODE_SHARED_MEMORY
+/* The wake words of the images indexed by the rank in event_comm, when the
+ * counters of events are in node shared memory, else NULL, see
+ * event_wake(). */
+static MPI_Win event_word_win = MPI_WIN_NULL;
+static int **event_words = NULL;
 #endif
 
 /* Linked list of static coarrays registered.  Do not expose to public in the
- * header, because it is implementation specific. */
+ * header, because it is implementation specific.  The local memory of the
+ * window of each token is noted, so that find_coarray_token() does not need
+ * to query the windows. */
 struct caf_allocated_tokens_t
 {
   caf_token_t token;
+  char *base;
+  MPI_Aint size;
   struct caf_allocated_tokens_t *prev;
 } *caf_allocated_tokens = NULL;
 
@@ -235,6 +304,13 @@ struct caf_allocated_slave_tokens_t
 static int img_status = 0;
 static MPI_Win *stat_tok;
 
+/* The bytes of a lock word and of a queue node of the queue locks, see
+ * mutex_lock().  They are padded to a cache line, so that images spinning on
+ * different ones do not share it.  CAF_LOCK_NODES is the number of queue
+ * nodes of each image, which limits the locks held at the same time. */
+#define CAF_LOCK_STRIDE 64
+#define CAF_LOCK_NODES 256
+
 /* Active messages variables */
 char **buff_am;
 MPI_Status *s_am;
@@ -293,6 +369,25 @@ bool no_stopped_images_check_in_errhandler = 0;
  * (and thus finalization) of MPI. */
 bool caf_owns_mpi = false;
 
+/* Set when all windows are kept in a lock_all epoch for their whole lifetime
+ * instead of locking the target for each access.  Selected by the environment
+ * variable OPENCOARRAYS_RMA_EPOCH=lock_all during initialization and must not
+ * change while windows exist. */
+static bool caf_lock_all_epoch = false;
+
+#ifdef CAF_NODE_SHARED_MEMORY
+/* The images of the initial team on this node.  node_comm is MPI_COMM_NULL,
+ * when the shared memory access was disabled by OPENCOARRAYS_SHARED_MEMORY=0.
+ * All images have to agree on it, because it selects the collective calls
+ * creating the windows of coarrays.  node_rank_of maps a rank in
+ * node_world, the communicator of the initial team, to the rank in node_comm
+ * or -1 for images on other nodes. */
+static MPI_Comm node_comm = MPI_COMM_NULL, node_world = MPI_COMM_NULL;
+static int node_size = 1, node_world_size = 1;
+static int *node_rank_of = NULL;
+static MPI_Info node_alloc_info;
+#endif
+
 /* Foo function pointers for coreduce.
  * The handles when arguments are passed by reference. */
 int (*int8_t_by_reference)(void *, void *);
@@ -311,47 +406,71 @@ int64_t (*int64_t_by_value)(int64_t, int64_t);
 float (*float_by_value)(float, float);
 double (*double_by_value)(double, double);
 
-/* Define shortcuts for Win_lock and _unlock depending on whether the primitives
- * are available in the MPI implementation.  When they are not available the
- * shortcut is expanded to nothing by the preprocessor else to the API call.
- * This prevents having #ifdef #else #endif constructs strewn all over the code
- * reducing its readability. */
-//#ifdef CAF_MPI_LOCK_UNLOCK
+/* Define shortcuts for Win_lock and _unlock depending on the passive target
+ * synchronization mode selected at run time.  By default every access is
+ * enclosed in an exclusive or shared lock/unlock pair on the target.  When
+ * the environment variable OPENCOARRAYS_RMA_EPOCH is set to "lock_all", one
+ * MPI_Win_lock_all epoch is opened on each window when it is created and kept
+ * open until the window is freed.  Then locking the target only completes
+ * pending puts to it and unlocking is replaced by a flush, which completes the
+ * operations without the round trips needed to acquire and release a lock.
+ * CAF_Win_unlock_local is used for epochs that only read from the target,
+ * where local completion of the operations is sufficient.
+ * CAF_Win_lock_put and CAF_Win_unlock_put enclose puts to the bytes
+ * [lo, lo + len) of the target, which in lock_all mode are completed remotely
+ * at the next image control statement only, see defer_put().
+ * CAF_Win_lock_get starts a read of the bytes [lo, lo + len) of the target,
+ * which in lock_all mode completes only the pending puts overlapping them.
+ * CAF_Win_lock completes all pending puts to the target and is left for the
+ * accesses whose range is not tracked: atomics, lock words and events.
+ * Without the
+ * lock_all epoch, a split-phase transfer keeps the lock on its target until it
+ * is completed, so that locking the target again has to complete it first,
+ * see complete_async().  Puts held in the write-combining buffer of the target
+ * are issued before any other access to it, see flush_combined(). */
+#if MPI_VERSION >= 3
+#define CAF_Win_lock(type, img, win)                                    \
+  (flush_combined (img, win),                                           \
+   caf_lock_all_epoch ? complete_puts (img, win, 0, PTRDIFF_MAX)        \
+                      : (complete_async (img, win),                     \
+                         MPI_Win_lock (type, img, 0, win)))
+#define CAF_Win_unlock(img, win)                                        \
+  (caf_lock_all_epoch ? MPI_Win_flush (img, win) : MPI_Win_unlock (img, win))
+#define CAF_Win_unlock_local(img, win)                                  \
+  (caf_lock_all_epoch ? MPI_Win_flush_local (img, win)                  \
+                      : MPI_Win_unlock (img, win))
+#define CAF_Win_lock_get(img, lo, len, win)                             \
+  (flush_combined (img, win),                                           \
+   caf_lock_all_epoch ? complete_puts (img, win, lo, len)               \
+                      : (complete_async (img, win),                     \
+                         MPI_Win_lock (MPI_LOCK_SHARED, img, 0, win)))
+#define CAF_Win_lock_put(img, lo, len, win)                             \
+  (flush_combined (img, win),                                           \
+   caf_lock_all_epoch ? complete_puts (img, win, lo, len)               \
+                      : (complete_async (img, win),                     \
+                         MPI_Win_lock (MPI_LOCK_EXCLUSIVE, img, 0, win)))
+#define CAF_Win_unlock_put(img, lo, len, win)                           \
+  (caf_lock_all_epoch ? defer_put (img, win, lo, len)                   \
+                      : MPI_Win_unlock (img, win))
+#define CAF_Win_lock_all(win)                                           \
+  (caf_lock_all_epoch ? MPI_Win_lock_all (MPI_MODE_NOCHECK, win) : MPI_SUCCESS)
+#define CAF_Win_unlock_all(win)                                         \
+  (caf_lock_all_epoch ? MPI_Win_unlock_all (win) : MPI_SUCCESS)
+#else // MPI_VERSION
 #define CAF_Win_lock(type, img, win) MPI_Win_lock (type, img, 0, win)
 #define CAF_Win_unlock(img, win) MPI_Win_unlock (img, win)
+#define CAF_Win_unlock_local(img, win) MPI_Win_unlock (img, win)
+#define CAF_Win_lock_get(img, lo, len, win)                             \
+  MPI_Win_lock (MPI_LOCK_SHARED, img, 0, win)
+#define CAF_Win_lock_put(img, lo, len, win)                             \
+  MPI_Win_lock (MPI_LOCK_EXCLUSIVE, img, 0, win)
+#define CAF_Win_unlock_put(img, lo, len, win) MPI_Win_unlock (img, win)
 #define CAF_Win_lock_all(win)
 #define CAF_Win_unlock_all(win)
-//#else // CAF_MPI_LOCK_UNLOCK
-//#define CAF_Win_lock(type, img, win)
-//#define CAF_Win_unlock(img, win) MPI_Win_flush (img, win)
-//#if MPI_VERSION >= 3
-//#define CAF_Win_lock_all(win) MPI_Win_lock_all (MPI_MODE_NOCHECK, win)
-//#else
-//#define CAF_Win_lock_all(win)
-//#endif
-//#define CAF_Win_unlock_all(win) MPI_Win_unlock_all (win)
-//#endif // CAF_MPI_LOCK_UNLOCK
+#endif // MPI_VERSION
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
-
-#if defined(NONBLOCKING_PUT) && !defined(CAF_MPI_LOCK_UNLOCK)
-void explicit_flush()
-{
-  win_sync *w = pending_puts, *t;
-  MPI_Win *p;
-  int ierr;
-  while (w != NULL)
-  {
-    p = w->win;
-    ierr = MPI_Win_flush(w->img,*p); chk_err(ierr);
-    t = w;
-    w = w->next;
-    free(t);
-  }
-  last_elem = NULL;
-  pending_puts = NULL;
-}
-#endif
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 
 #ifdef HELPER
 void helperFunction()
@@ -468,237 +587,2081 @@ unsupported_fail_images_message(const char * functionname);
 static void
 unimplemented_alloc_comps_message(const char * functionname);
 
-static void
-locking_atomic_op(MPI_Win win, int *value, int newval,
-                  int compare, int image_index, size_t index)
+/* Cache of the translation of ranks in the current team to ranks in the group
+ * of a window.  Building the groups of the communicator and of the window for
+ * every remote access is expensive, therefore the complete translation table is
+ * computed once per window and team and attached to the window as the
+ * attribute win_rank_keyval, which makes the lookup O(1) without searching.
+ * The table is freed with the window by the attribute's delete function.
+ * Changing the current team increments win_rank_generation, which makes the
+ * tables of the previous team stale; they are rebuilt on their next use.  The
+ * attribute also keeps the local base of the window for self_address(). */
+typedef struct win_rank_cache_t
 {
-  CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image_index - 1, win);
-  int ierr = MPI_Compare_and_swap(&newval, &compare,value, MPI_INT,
-                                  image_index - 1, index * sizeof(int), win);
-  chk_err(ierr);
-  CAF_Win_unlock(image_index - 1, win);
-}
-
+  unsigned long generation;
+  /* ranks[i] is the rank in the group of win of rank i in the current team. */
+  int *ranks;
+  /* The address of displacement zero on this image, valid when self_direct
+   * is set, i.e., the memory of the window can be accessed directly. */
+  char *self_base;
+  bool self_direct;
+} win_rank_cache_t;
+
+static int win_rank_keyval = MPI_KEYVAL_INVALID;
+static unsigned long win_rank_generation = 0;
+
+static int
+free_win_rank_table(MPI_Win win, int keyval, void *attr, void *extra)
+{
+  win_rank_cache_t *cur = (win_rank_cache_t *)attr;
 
-/* Define a helper to check whether the image at the given index is healthy,
- * i.e., it hasn't failed. */
-#ifdef WITH_FAILED_IMAGES
-#define check_image_health(image_index, stat)                   \
-if (image_stati[image_index - 1] == STAT_FAILED_IMAGE)          \
-{                                                               \
-  if (stat == NULL) terminate_internal (STAT_FAILED_IMAGE, 0);  \
-  *stat = STAT_FAILED_IMAGE;                                    \
-  return;                                                       \
+  free(cur->ranks);
+  free(cur);
+  return MPI_SUCCESS;
 }
-#else
-#define check_image_health(image_index, stat)
-#endif
 
-#ifdef WITH_FAILED_IMAGES
-/* Handle failed image's errors and try to recover the remaining process to
- * allow the user to detect an image fail and exit gracefully. */
-static void
-failed_stopped_errorhandler_function (MPI_Comm* pcomm, int* perr, ...)
+static win_rank_cache_t *
+win_rank_table(MPI_Win win)
 {
-  MPI_Comm comm, shrunk, newcomm;
-  int num_failed_in_group, i, err, ierr;
-  MPI_Group comm_world_group, failed_group;
-  int *ranks_of_failed_in_comm_world, *ranks_failed;
-  int ns, srank, crank, rc, flag, drank, newrank;
-  bool stopped = false;
+  win_rank_cache_t *cur;
+  MPI_Group current_team_group, win_group;
+  int i, ierr, flag, *team_ranks;
 
-  comm = *pcomm;
+  ierr = MPI_Win_get_attr(win, win_rank_keyval, &cur, &flag); chk_err(ierr);
+  if (flag && cur->generation == win_rank_generation)
+    return cur;
 
-  MPI_Error_class(*perr, &err);
-  if (err != MPIX_ERR_PROC_FAILED && err != MPIX_ERR_REVOKED)
+  dprint("Building rank translation table for win %d.\n", win);
+  if (!flag)
   {
-    /* We can handle PROC_FAILED and REVOKED ones only. */
-    char errstr[MPI_MAX_ERROR_STRING];
-    int errlen;
-    MPI_Error_string(err, errstr, &errlen);
-    /* We can't use caf_runtime_error here, because that would exit, which
-     * means only the one process will stop, but we need to stop MPI
-     * completely, which can be done by calling MPI_Abort(). */
-    fprintf(stderr,
-            "Fortran runtime error on image #%d:\nMPI error: '%s'.\n",
-            caf_this_image, errstr);
-    MPI_Abort(*pcomm, err);
+    cur = (win_rank_cache_t *)malloc(sizeof(win_rank_cache_t));
+    cur->ranks = NULL;
+    cur->self_base = NULL;
+    cur->self_direct = false;
+#if MPI_VERSION >= 3
+    {
+      /* Loads and stores are coherent with the RMA operations of other
+       * images only in the unified memory model. */
+      int *model;
+      ierr = MPI_Win_get_attr(win, MPI_WIN_MODEL, &model, &flag);
+      chk_err(ierr);
+      if (flag && *model == MPI_WIN_UNIFIED)
+      {
+        ierr = MPI_Win_get_attr(win, MPI_WIN_BASE, &cur->self_base, &flag);
+        chk_err(ierr);
+        cur->self_direct = flag;
+      }
+    }
+#endif
+    ierr = MPI_Win_set_attr(win, win_rank_keyval, cur); chk_err(ierr);
   }
+  cur->generation = win_rank_generation;
+  cur->ranks = (int *)realloc(cur->ranks, sizeof(int) * caf_num_images);
+  team_ranks = (int *)malloc(sizeof(int) * caf_num_images);
+  for (i = 0; i < caf_num_images; ++i)
+    team_ranks[i] = i;
 
-  dprint("(error = %d)\n", err);
+  ierr = MPI_Comm_group(CAF_COMM_WORLD, &current_team_group); chk_err(ierr);
+  ierr = MPI_Win_get_group(win, &win_group); chk_err(ierr);
+  ierr = MPI_Group_translate_ranks(current_team_group, caf_num_images,
+                                   team_ranks, win_group, cur->ranks);
+  chk_err(ierr);
+  ierr = MPI_Group_free(&current_team_group); chk_err(ierr);
+  ierr = MPI_Group_free(&win_group); chk_err(ierr);
+  free(team_ranks);
+  return cur;
+}
 
-  ierr = MPIX_Comm_failure_ack(comm); chk_err(ierr);
-  ierr = MPIX_Comm_failure_get_acked(comm, &failed_group); chk_err(ierr);
-  ierr = MPI_Group_size(failed_group, &num_failed_in_group); chk_err(ierr);
+/* Translate the zero based rank of an image in the current team to its rank
+ * in the group of win. */
+static inline int
+translate_rank(MPI_Win win, int team_rank)
+{
+  return win_rank_table(win)->ranks[team_rank];
+}
 
-  dprint("%d images failed.\n", num_failed_in_group);
-  if (num_failed_in_group <= 0)
-  {
-    *perr = MPI_SUCCESS;
-    return;
-  }
-  if (num_failed_in_group > caf_num_images)
-  {
-    *perr = MPI_SUCCESS;
-    return;
-  }
+/* Make the translation tables of all windows stale, when the current team
+ * changes. */
+static inline void
+invalidate_win_rank_cache(void)
+{
+  ++win_rank_generation;
+}
 
-  ierr = MPI_Comm_group(comm, &comm_world_group); chk_err(ierr);
-  ranks_of_failed_in_comm_world =
-    (int *) alloca(sizeof(int) * num_failed_in_group);
-  ranks_failed = (int *) alloca(sizeof(int) * num_failed_in_group);
-  for (i = 0; i < num_failed_in_group; ++i)
+/* Deferred completion of puts in lock_all mode.  A put only needs to be
+ * complete at the next image control statement, therefore it is completed
+ * locally (so that the source buffer can be reused) and the (window, target)
+ * pair is noted as dirty.  explicit_flush() issues one MPI_Win_flush per dirty
+ * pair.  Because MPI does not order a put with later accesses to the same
+ * target, the pair is flushed early when it is accessed again before the next
+ * image control statement, unless the access is a put to a disjoint range of
+ * the window.  For each window the hull of the pending puts per target is
+ * kept; an empty hull (lo >= hi) marks a clean target.  The state is attached
+ * to the window as the attribute dirty_win_keyval and freed with it, the
+ * windows with pending puts are linked in dirty_wins. */
+typedef struct dirty_win_t
+{
+  MPI_Win win;
+  /* hi[r] > lo[r] iff puts to rank r of the group of win are pending. */
+  MPI_Aint *lo, *hi;
+  /* The ranks with pending puts, ndirty entries. */
+  int *dirty, ndirty;
+  /* Set while the window is in dirty_wins. */
+  bool listed;
+  struct dirty_win_t *next;
+} dirty_win_t;
+
+static int dirty_win_keyval = MPI_KEYVAL_INVALID;
+static dirty_win_t *dirty_wins = NULL;
+
+/* The number of (window, target) pairs with pending puts. */
+static int num_dirty_pairs = 0;
+
+/* Forget the pending puts of the window being freed, which completes all
+ * operations on it. */
+static int
+free_dirty_win(MPI_Win win, int keyval, void *attr, void *extra)
+{
+  dirty_win_t *cur = (dirty_win_t *)attr, **pcur = &dirty_wins;
+
+  if (cur->listed)
   {
-    ranks_failed[i] = i;
+    while (*pcur != cur)
+      pcur = &(*pcur)->next;
+    *pcur = cur->next;
   }
-  /* Now translate the ranks of the failed images into communicator world. */
-  ierr = MPI_Group_translate_ranks(failed_group, num_failed_in_group,
-                                   ranks_failed, comm_world_group,
-                                   ranks_of_failed_in_comm_world);
-  chk_err(ierr);
+  num_dirty_pairs -= cur->ndirty;
+  free(cur->lo);
+  free(cur->hi);
+  free(cur->dirty);
+  free(cur);
+  return MPI_SUCCESS;
+}
 
-  num_images_failed += num_failed_in_group;
+static dirty_win_t *
+find_dirty_win(MPI_Win win, bool create)
+{
+  dirty_win_t *cur;
+  MPI_Group win_group;
+  int ierr, flag, win_size;
+
+  ierr = MPI_Win_get_attr(win, dirty_win_keyval, &cur, &flag); chk_err(ierr);
+  if (flag)
+    return cur;
+  if (!create)
+    return NULL;
+
+  ierr = MPI_Win_get_group(win, &win_group); chk_err(ierr);
+  ierr = MPI_Group_size(win_group, &win_size); chk_err(ierr);
+  ierr = MPI_Group_free(&win_group); chk_err(ierr);
 
-  if (!no_stopped_images_check_in_errhandler)
+  cur = (dirty_win_t *)malloc(sizeof(dirty_win_t));
+  cur->win = win;
+  cur->lo = (MPI_Aint *)calloc(win_size, sizeof(MPI_Aint));
+  cur->hi = (MPI_Aint *)calloc(win_size, sizeof(MPI_Aint));
+  cur->dirty = (int *)malloc(sizeof(int) * win_size);
+  cur->ndirty = 0;
+  cur->listed = false;
+  cur->next = NULL;
+  ierr = MPI_Win_set_attr(win, dirty_win_keyval, cur); chk_err(ierr);
+  return cur;
+}
+
+/* Complete all pending puts of dw and mark all its targets clean. */
+static void
+flush_dirty_win(dirty_win_t *dw)
+{
+  int i, ierr;
+
+  for (i = 0; i < dw->ndirty; ++i)
   {
-    int buffer, flag;
-    MPI_Request req;
-    MPI_Status request_status;
-    dprint("Checking for stopped images.\n");
-    ierr = MPI_Irecv(&buffer, 1, MPI_INT, MPI_ANY_SOURCE,
-                     MPI_TAG_CAF_SYNC_IMAGES, CAF_COMM_WORLD, &req);
-    chk_err(ierr);
-    if (ierr == MPI_SUCCESS)
-    {
-      ierr = MPI_Test(&req, &flag, &request_status); chk_err(ierr);
-      if (flag)
-      {
-        // Received a result
-        if (buffer == STAT_STOPPED_IMAGE)
-        {
-          dprint("Image #%d found stopped.\n", request_status.MPI_SOURCE);
-          stopped = true;
-          if (image_stati[request_status.MPI_SOURCE] == 0)
-            ++num_images_stopped;
-          image_stati[request_status.MPI_SOURCE] = STAT_STOPPED_IMAGE;
-        }
-      }
-      else
-      {
-        dprint("No stopped images found.\n");
-        ierr = MPI_Cancel(&req); chk_err(ierr);
-      }
-    }
-    else
-    {
-      int err;
-      MPI_Error_class(ierr, &err);
-      dprint("Error on checking for stopped images %d.\n", err);
-    }
+    const int rank = dw->dirty[i];
+    ierr = MPI_Win_flush(rank, dw->win); chk_err(ierr);
+    dw->lo[rank] = dw->hi[rank] = 0;
   }
+  num_dirty_pairs -= dw->ndirty;
+  dw->ndirty = 0;
+}
 
-  /* TODO: Consider whether removing the failed image from images_full will be
-   * necessary. This is more or less politics. */
-  for (i = 0; i < num_failed_in_group; ++i)
-  {
-    if (ranks_of_failed_in_comm_world[i] >= 0
-        && ranks_of_failed_in_comm_world[i] < caf_num_images)
-    {
-      if (image_stati[ranks_of_failed_in_comm_world[i]] == 0)
-        image_stati[ranks_of_failed_in_comm_world[i]] = STAT_FAILED_IMAGE;
-    }
-    else
+/* Complete the pending puts to rank in win and mark the pair clean. */
+static void
+flush_dirty_target(dirty_win_t *dw, int rank)
+{
+  int i, ierr;
+
+  ierr = MPI_Win_flush(rank, dw->win); chk_err(ierr);
+  dw->lo[rank] = dw->hi[rank] = 0;
+  for (i = 0; i < dw->ndirty; ++i)
+    if (dw->dirty[i] == rank)
     {
-      dprint("Rank of failed image %d out of range of images 0..%d.\n",
-             ranks_of_failed_in_comm_world[i], caf_num_images);
+      dw->dirty[i] = dw->dirty[--dw->ndirty];
+      break;
     }
-  }
-
-redo:
-  dprint("Before shrink. \n");
-  ierr = MPIX_Comm_shrink(*pcomm, &shrunk);
-  dprint("After shrink, rc = %d.\n", ierr);
-  ierr = MPI_Comm_set_errhandler(shrunk, failed_CAF_COMM_mpi_err_handler);
-  chk_err(ierr);
-  ierr = MPI_Comm_size(shrunk, &ns); chk_err(ierr);
-  ierr = MPI_Comm_rank(shrunk, &srank); chk_err(ierr);
-  ierr = MPI_Comm_rank(*pcomm, &crank); chk_err(ierr);
+  --num_dirty_pairs;
+}
 
-  dprint("After getting ranks, ns = %d, srank = %d, crank = %d.\n",
-         ns, srank, crank);
+/* Make sure the pending puts to rank in win are complete before the target is
+ * accessed in a way conflicting with the bytes [lo, lo + len). */
+static int
+complete_puts(int rank, MPI_Win win, MPI_Aint lo, MPI_Aint len)
+{
+  dirty_win_t *dw;
+
+  if (num_dirty_pairs == 0 || !(dw = find_dirty_win(win, false)))
+    return MPI_SUCCESS;
+  if (dw->lo[rank] < dw->hi[rank] && lo < dw->hi[rank]
+      && dw->lo[rank] < lo + len)
+    flush_dirty_target(dw, rank);
+  return MPI_SUCCESS;
+}
 
-  /* Split does the magic: removing spare processes and reordering ranks
-   * so that all surviving processes remain at their former place */
-  rc = MPI_Comm_split(shrunk, (crank < 0) ? MPI_UNDEFINED : 1, crank, &newcomm);
-  ierr = MPI_Comm_rank(newcomm, &newrank); chk_err(ierr);
-  dprint("After split, rc = %d, rank = %d.\n", rc, newrank);
-  flag = (rc == MPI_SUCCESS);
-  /* Split or some of the communications above may have failed if
-   * new failures have disrupted the process: we need to
-   * make sure we succeeded at all ranks, or retry until it works. */
-  flag = MPIX_Comm_agree(newcomm, &flag);
-  dprint("After agree, flag = %d.\n", flag);
+/* Note a put to the bytes [lo, lo + len) of rank in win as pending.  Only
+ * local completion is waited for, unless the target is this image, which may
+ * access the memory directly. */
+static int
+defer_put(int rank, MPI_Win win, MPI_Aint lo, MPI_Aint len)
+{
+  dirty_win_t *dw;
+  int ierr;
 
-  ierr = MPI_Comm_rank(newcomm, &drank); chk_err(ierr);
-  dprint("After rank, drank = %d.\n", drank);
+  if (rank == translate_rank(win, caf_this_image - 1))
+    return MPI_Win_flush(rank, win);
 
-  ierr = MPI_Comm_free(&shrunk); chk_err(ierr);
-  if (MPI_SUCCESS != flag)
+  ierr = MPI_Win_flush_local(rank, win); chk_err(ierr);
+  dw = find_dirty_win(win, true);
+  if (dw->lo[rank] < dw->hi[rank])
   {
-    if (MPI_SUCCESS == rc)
-    {
-      ierr = MPI_Comm_free(&newcomm); chk_err(ierr);
-    }
-    goto redo;
+    dw->lo[rank] = MIN(dw->lo[rank], lo);
+    dw->hi[rank] = MAX(dw->hi[rank], lo + len);
   }
-
+  else
   {
-    int cmpres;
-    ierr = MPI_Comm_compare(*pcomm, CAF_COMM_WORLD, &cmpres); chk_err(ierr);
-    dprint("Comm_compare(*comm, CAF_COMM_WORLD, res = %d) = %d.\n",
-           cmpres, ierr);
-    ierr = MPI_Comm_compare(*pcomm, alive_comm, &cmpres); chk_err(ierr);
-    dprint("Comm_compare(*comm, alive_comm, res = %d) = %d.\n",
-           cmpres, ierr);
-    if (cmpres == MPI_CONGRUENT)
+    dw->lo[rank] = lo;
+    dw->hi[rank] = lo + len;
+    dw->dirty[dw->ndirty++] = rank;
+    ++num_dirty_pairs;
+    if (!dw->listed)
     {
-      ierr = MPI_Win_detach(*stat_tok, &img_status); chk_err(ierr);
-      dprint("detached win img_status.\n");
-      ierr = MPI_Win_free(stat_tok); chk_err(ierr);
-      dprint("freed win img_status.\n");
-      ierr = MPI_Win_create(&img_status, sizeof(int), 1, mpi_info_same_size,
-                            newcomm, stat_tok); chk_err(ierr);
-      dprint("(re-)created win img_status.\n");
-      CAF_Win_lock_all(*stat_tok);
-      dprint("Win_lock_all on img_status.\n");
+      dw->listed = true;
+      dw->next = dirty_wins;
+      dirty_wins = dw;
     }
   }
-  /* Also free the old communicator before replacing it. */
-  ierr = MPI_Comm_free(pcomm); chk_err(ierr);
-  *pcomm = newcomm;
-
-  *perr = stopped ? STAT_STOPPED_IMAGE : STAT_FAILED_IMAGE;
+  return ierr;
 }
-#endif
 
-void mutex_lock(MPI_Win win, int image_index, size_t index, int *stat,
-                int *acquired_lock, char *errmsg, size_t errmsg_len)
-{
-  const char msg[] = "Already locked";
 #if MPI_VERSION >= 3
-  int value = 0, compare = 0, newval = caf_this_image, ierr = 0, i = 0;
-#ifdef WITH_FAILED_IMAGES
-  int flag, check_failure = 100, zero = 0;
-#endif
+/* The split-phase transfers started by caf_get_async() and caf_put_async().
+ * A request is identified by its index in the table plus one, zero is the
+ * handle of a completed request.  Without the lock_all epoch a transfer is
+ * enclosed in its own lock of the target.  MPI completes the transfer only
+ * when the lock is released, so the lock is held until the request is
+ * completed by caf_wait, caf_test, caf_wait_all, the next image control
+ * statement or another access of this image to the target.  Meanwhile the
+ * accesses of other images to the target in this window wait for a put, and
+ * the puts of other images wait for a get. */
+typedef struct async_request_t
+{
+  MPI_Request req;
+  MPI_Win win;
+  int rank;
+  bool active, put;
+  /* The bytes [lo, lo + len) of the target written by a put. */
+  MPI_Aint lo, len;
+} async_request_t;
+
+static async_request_t *async_requests = NULL;
+static int async_requests_cap = 0;
+
+/* The number of active requests. */
+static int num_async_pending = 0;
+
+/* Return the handle of an unused entry of the request table. */
+static int
+new_async_request(void)
+{
+  int i, first_new = async_requests_cap;
+
+  for (i = 0; i < async_requests_cap; ++i)
+    if (!async_requests[i].active)
+      return i + 1;
+  async_requests_cap = async_requests_cap ? 2 * async_requests_cap : 16;
+  async_requests = (async_request_t *)
+    realloc(async_requests, async_requests_cap * sizeof(async_request_t));
+  for (i = first_new; i < async_requests_cap; ++i)
+    async_requests[i].active = false;
+  return first_new + 1;
+}
 
-  if (stat != NULL)
-    *stat = 0;
+/* Complete the transfer of the active request r, which is finished locally
+ * already when done is true. */
+static int
+finish_async(async_request_t *r, bool done)
+{
+  int ierr = MPI_SUCCESS;
 
-#ifdef WITH_FAILED_IMAGES
-  ierr = MPI_Test(&alive_request, &flag, MPI_STATUS_IGNORE); chk_err(ierr);
-#endif
+  if (!done)
+  {
+    ierr = MPI_Wait(&r->req, MPI_STATUS_IGNORE); chk_err(ierr);
+  }
+  if (!caf_lock_all_epoch)
+  {
+    ierr = MPI_Win_unlock(r->rank, r->win); chk_err(ierr);
+  }
+  else if (r->put)
+  {
+    ierr = defer_put(r->rank, r->win, r->lo, r->len); chk_err(ierr);
+  }
+  r->active = false;
+  --num_async_pending;
+  return ierr;
+}
+
+/* Complete the pending split-phase transfers to rank in win.  A negative rank
+ * selects all targets in win and win MPI_WIN_NULL all windows. */
+static int
+complete_async(int rank, MPI_Win win)
+{
+  int i;
+
+  if (num_async_pending == 0)
+    return MPI_SUCCESS;
+  for (i = 0; i < async_requests_cap; ++i)
+  {
+    async_request_t *r = &async_requests[i];
+
+    if (r->active
+        && (win == MPI_WIN_NULL
+            || (r->win == win && (rank < 0 || r->rank == rank))))
+      finish_async(r, false);
+  }
+  return MPI_SUCCESS;
+}
+
+/* Write-combining of small puts.  When OPENCOARRAYS_PUT_COMBINING gives the
+ * size of a buffer in bytes, puts of at most a quarter of it are not issued
+ * at once, but copied to the buffer of their (window, target) pair.  Puts to
+ * adjacent bytes are merged into one run and a put to bytes buffered already
+ * overwrites them in the buffer.  The buffer is moved by one put with an
+ * indexed target datatype, when it is full, when the target is accessed
+ * otherwise and at the next image control statement.  The buffers are
+ * direct mapped on the pair; a collision flushes the older pair. */
+#define COMBINE_SLOTS 64
+#define COMBINE_MAX_RUNS 256
+
+typedef struct combine_buf_t
+{
+  MPI_Win win;
+  int rank;
+  /* The runs of the buffered puts, whose data is stored back to back in
+   * data, and the hull [lo, hi) of their bytes in the window. */
+  int nruns, run_len[COMBINE_MAX_RUNS];
+  MPI_Aint run_disp[COMBINE_MAX_RUNS], lo, hi;
+  size_t used;
+  char *data;
+} combine_buf_t;
+
+static combine_buf_t combine_bufs[COMBINE_SLOTS];
+
+/* The size of each buffer, zero when combining is disabled. */
+static size_t combine_size = 0;
+
+/* The number of buffers holding puts. */
+static int num_combined = 0;
+
+/* The puts and bytes taken by the buffers and the puts issued for them,
+ * reported by PREFIX(put_combining_stats). */
+static long long combine_puts = 0, combine_bytes = 0, combine_flushes = 0;
+
+static combine_buf_t *
+combine_slot(int rank, MPI_Win win)
+{
+  const size_t hash = (size_t)rank * 0x9e3779b1u ^ ((size_t)win << 3);
+  return &combine_bufs[hash % COMBINE_SLOTS];
+}
+
+/* Issue the puts buffered in b. */
+static void
+flush_combine_buf(combine_buf_t *b)
+{
+  MPI_Datatype target_type;
+  const int nruns = b->nruns;
+  int k, ierr;
+
+  if (nruns == 0)
+    return;
+  /* Mark the buffer empty first, because locking the target checks it. */
+  b->nruns = 0;
+  --num_combined;
+  ++combine_flushes;
+  for (k = 0; k < nruns; ++k)
+    b->run_disp[k] -= b->lo;
+  if (nruns == 1)
+    ierr = MPI_Type_contiguous(b->run_len[0], MPI_BYTE, &target_type);
+  else
+    ierr = MPI_Type_create_hindexed(nruns, b->run_len, b->run_disp, MPI_BYTE,
+                                    &target_type);
+  chk_err(ierr);
+  ierr = MPI_Type_commit(&target_type); chk_err(ierr);
+  CAF_Win_lock_put(b->rank, b->lo, b->hi - b->lo, b->win);
+  ierr = MPI_Put(b->data, b->used, MPI_BYTE, b->rank, b->lo, 1, target_type,
+                 b->win); chk_err(ierr);
+  CAF_Win_unlock_put(b->rank, b->lo, b->hi - b->lo, b->win);
+  ierr = MPI_Type_free(&target_type); chk_err(ierr);
+  b->used = 0;
+}
+
+/* Issue the puts to rank in win held in the write-combining buffers. */
+static int
+flush_combined(int rank, MPI_Win win)
+{
+  combine_buf_t *b;
+
+  if (num_combined == 0)
+    return MPI_SUCCESS;
+  b = combine_slot(rank, win);
+  if (b->nruns > 0 && b->win == win && b->rank == rank)
+    flush_combine_buf(b);
+  return MPI_SUCCESS;
+}
+
+/* Issue the puts held in the write-combining buffers for win, or for all
+ * windows when win is NULL. */
+static void
+flush_all_combined(MPI_Win *win)
+{
+  int i;
+
+  for (i = 0; num_combined > 0 && i < COMBINE_SLOTS; ++i)
+    if (combine_bufs[i].nruns > 0 && (win == NULL
+                                      || combine_bufs[i].win == *win))
+      flush_combine_buf(&combine_bufs[i]);
+}
+
+/* Take the put of bytes bytes from buf to disp at rank of win into the
+ * write-combining buffer of the target.  Returns false, when the put has to
+ * be issued by the caller. */
+static bool
+combine_put(void *buf, size_t bytes, int rank, MPI_Aint disp, MPI_Win win)
+{
+  combine_buf_t *b;
+  int k;
+
+  if (bytes > combine_size / 4 || bytes == 0)
+    return false;
+  b = combine_slot(rank, win);
+  if (b->nruns > 0 && (b->win != win || b->rank != rank))
+    flush_combine_buf(b);
+  if (b->nruns > 0 && disp < b->hi && b->lo < disp + (MPI_Aint)bytes)
+  {
+    /* Overwrite the buffered bytes, when one run holds all of them, else
+     * keep the order of the puts by issuing the buffered ones first. */
+    size_t off = 0;
+
+    for (k = 0; k < b->nruns; off += b->run_len[k++])
+      if (disp >= b->run_disp[k]
+          && disp + (MPI_Aint)bytes <= b->run_disp[k] + b->run_len[k])
+      {
+        memcpy(b->data + off + (disp - b->run_disp[k]), buf, bytes);
+        ++combine_puts;
+        combine_bytes += bytes;
+        return true;
+      }
+    flush_combine_buf(b);
+  }
+  if (b->used + bytes > combine_size || b->nruns == COMBINE_MAX_RUNS)
+    flush_combine_buf(b);
+  if (b->data == NULL)
+    b->data = (char *)malloc(combine_size);
+  if (b->nruns == 0)
+  {
+    b->win = win;
+    b->rank = rank;
+    b->lo = disp;
+    b->hi = disp + bytes;
+    ++num_combined;
+  }
+  memcpy(b->data + b->used, buf, bytes);
+  b->used += bytes;
+  if (b->nruns > 0 && b->run_disp[b->nruns - 1] + b->run_len[b->nruns - 1]
+                      == disp)
+    b->run_len[b->nruns - 1] += bytes;
+  else
+  {
+    b->run_disp[b->nruns] = disp;
+    b->run_len[b->nruns++] = bytes;
+  }
+  b->lo = MIN(b->lo, disp);
+  b->hi = MAX(b->hi, disp + (MPI_Aint)bytes);
+  ++combine_puts;
+  combine_bytes += bytes;
+  return true;
+}
+
+static void
+free_combine_bufs(void)
+{
+  int i;
+
+  flush_all_combined(NULL);
+  for (i = 0; i < COMBINE_SLOTS; ++i)
+  {
+    free(combine_bufs[i].data);
+    combine_bufs[i].data = NULL;
+  }
+}
+#endif // MPI_VERSION
+
+/* Return the address of the byte at disp of rank in win, when rank is this
+ * image and the memory of the window can be accessed directly, else NULL.
+ * Loads and stores of this image then replace the RMA operations on itself.
+ * They are coherent with the RMA operations of other images only in the
+ * unified memory model, in the separate model the public copy of the window
+ * is reachable through RMA only.  The base of a window created dynamically is
+ * MPI_BOTTOM, so that disp is the address there.  Both are looked up once per
+ * window, see win_rank_table(). */
+static void *
+self_address(MPI_Win win, int rank, MPI_Aint disp)
+{
+  win_rank_cache_t *cur = win_rank_table(win);
+
+  if (!cur->self_direct || rank != cur->ranks[caf_this_image - 1])
+    return NULL;
+  return cur->self_base + disp;
+}
+
+/* Cache of the remote component pointers and descriptors fetched while
+ * chasing references in the *_by_ref routines and is_present.  Another image
+ * can change the allocation status or pointer association of its components
+ * only in a segment that is ordered with ours by an image control statement,
+ * therefore an entry stays valid until the next image control statement or
+ * deregister on this image.  Both advance the epoch, which invalidates all
+ * entries at once.  The table is direct mapped on (window, rank, displacement,
+ * size); a collision just replaces the older entry.  Fetches from this image
+ * are not cached, because it may reallocate its components at any time. */
+#define REMOTE_META_SLOTS 256
+#define REMOTE_META_MAX_SIZE \
+  (sizeof(gfc_descriptor_t) + GFC_MAX_DIMENSIONS * sizeof(descriptor_dimension))
+
+typedef struct remote_meta_t
+{
+  MPI_Win win;
+  MPI_Aint disp;
+  int rank;
+  size_t size;
+  unsigned long epoch;
+  union
+  {
+    char bytes[REMOTE_META_MAX_SIZE];
+    void *align;
+  } data;
+} remote_meta_t;
+
+static remote_meta_t remote_meta_cache[REMOTE_META_SLOTS];
+
+/* Entries with epoch 0 are empty, so the first epoch is 1. */
+static unsigned long remote_meta_epoch = 1;
+
+static void
+invalidate_remote_meta(void)
+{
+  ++remote_meta_epoch;
+}
+
+/* Fetch size bytes of component pointer or descriptor data from displacement
+ * disp of rank in win, serving repeated fetches within a segment from the
+ * cache. */
+static int
+get_remote_meta(void *buf, size_t size, int rank, MPI_Aint disp, MPI_Win win)
+{
+  /* The pointer and the descriptor of an array component start at the same
+   * displacement, so the size is hashed too, that they do not collide. */
+  const size_t hash = ((size_t)disp >> 3) ^ ((size_t)rank * 0x9e3779b1u)
+    ^ ((size_t)win << 5) ^ (size * 0x85ebca6bu);
+  remote_meta_t *entry = &remote_meta_cache[hash % REMOTE_META_SLOTS];
+  bool cacheable;
+  void *self;
+  int ierr;
+
+  if (entry->epoch == remote_meta_epoch && entry->win == win
+      && entry->rank == rank && entry->disp == disp && entry->size == size)
+  {
+    memcpy(buf, entry->data.bytes, size);
+    return MPI_SUCCESS;
+  }
+  if ((self = self_address(win, rank, disp)))
+  {
+    memcpy(buf, self, size);
+    return MPI_SUCCESS;
+  }
+
+  CAF_Win_lock_get(rank, disp, size, win);
+  ierr = MPI_Get(buf, size, MPI_BYTE, rank, disp, size, MPI_BYTE, win);
+  CAF_Win_unlock_local(rank, win);
+
+  cacheable = ierr == MPI_SUCCESS && size <= REMOTE_META_MAX_SIZE
+    && rank != translate_rank(win, caf_this_image - 1);
+  if (cacheable)
+  {
+    entry->win = win;
+    entry->disp = disp;
+    entry->rank = rank;
+    entry->size = size;
+    entry->epoch = remote_meta_epoch;
+    memcpy(entry->data.bytes, buf, size);
+  }
+  return ierr;
+}
+
+/* Complete all pending puts and forget the cached remote component pointers
+ * and descriptors.  Called at image control statements. */
+static void
+explicit_flush(void)
+{
+  dirty_win_t *cur;
+
+  /* Order the direct accesses to the memory of the images on this node. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  invalidate_remote_meta();
+#if MPI_VERSION >= 3
+  /* Split-phase transfers belong to the segment they were started in. */
+  complete_async(-1, MPI_WIN_NULL);
+  flush_all_combined(NULL);
+#endif
+  while ((cur = dirty_wins))
+  {
+    dirty_wins = cur->next;
+    cur->listed = false;
+    flush_dirty_win(cur);
+  }
+}
+
+#define sizeof_desc_for_rank(rank) \
+(sizeof(gfc_descriptor_t) + (rank) * sizeof(descriptor_dimension))
+
+/* Define the descriptor of max rank.
+ * 
+ *  This typedef is made to allow storing a copy of a remote descriptor on the
+ *  stack without having to care about the rank. */
+typedef struct gfc_max_dim_descriptor_t
+{
+  gfc_descriptor_t base;
+  descriptor_dimension dim[GFC_MAX_DIMENSIONS];
+} gfc_max_dim_descriptor_t;
+
+#ifdef CAF_NODE_SHARED_MEMORY
+/* Shared memory access to the images on the same node.  The memory of each
+ * coarray is allocated in a shared memory window over node_comm, so that the
+ * images of a node can load and store each other's data directly.  The window
+ * used for RMA to images on other nodes is created over the same memory.  When
+ * all images are on one node, the shared memory window is the RMA window.
+ * Data written directly is made visible by the memory fence in
+ * explicit_flush() at image control statements. */
+
+/* Determine the images on this node.  Collective over CAF_COMM_WORLD. */
+
+static void
+init_node_map(void)
+{
+  MPI_Group world_group, node_group;
+  int *ranks, i, ierr;
+
+  node_world = CAF_COMM_WORLD;
+  node_world_size = caf_num_images;
+  ierr = MPI_Comm_split_type(CAF_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+                             MPI_INFO_NULL, &node_comm); chk_err(ierr);
+  ierr = MPI_Comm_size(node_comm, &node_size); chk_err(ierr);
+
+  ranks = (int *) malloc(sizeof(int) * caf_num_images);
+  node_rank_of = (int *) malloc(sizeof(int) * caf_num_images);
+  for (i = 0; i < caf_num_images; ++i)
+    ranks[i] = i;
+  ierr = MPI_Comm_group(CAF_COMM_WORLD, &world_group); chk_err(ierr);
+  ierr = MPI_Comm_group(node_comm, &node_group); chk_err(ierr);
+  ierr = MPI_Group_translate_ranks(world_group, caf_num_images, ranks,
+                                   node_group, node_rank_of); chk_err(ierr);
+  for (i = 0; i < caf_num_images; ++i)
+  {
+    if (node_rank_of[i] == MPI_UNDEFINED)
+      node_rank_of[i] = -1;
+  }
+  ierr = MPI_Group_free(&world_group); chk_err(ierr);
+  ierr = MPI_Group_free(&node_group); chk_err(ierr);
+  free(ranks);
+
+  /* Let each image's memory be allocated close to it. */
+  ierr = MPI_Info_create(&node_alloc_info); chk_err(ierr);
+  ierr = MPI_Info_set(node_alloc_info, "alloc_shared_noncontig", "true");
+  chk_err(ierr);
+  dprint("%d images on this node.\n", node_size);
+}
+
+static void
+free_node_map(void)
+{
+  int ierr;
+
+  if (node_comm == MPI_COMM_NULL)
+    return;
+  ierr = MPI_Info_free(&node_alloc_info); chk_err(ierr);
+  ierr = MPI_Comm_free(&node_comm); chk_err(ierr);
+  free(node_rank_of);
+  node_rank_of = NULL;
+  node_size = 1;
+}
+
+/* Allocate size bytes of node shared memory for mpi_token and create its RMA
+ * window.  Collective over CAF_COMM_WORLD.  Returns the local memory. */
+
+static void *
+allocate_node_shared(MPI_Aint size, mpi_caf_token_t *mpi_token)
+{
+  MPI_Win *p = TOKEN(mpi_token);
+  MPI_Aint peer_size;
+  void *mem;
+  int i, disp_unit, ierr;
+
+  if (node_size == node_world_size)
+  {
+    ierr = MPI_Win_allocate_shared(size, 1, node_alloc_info, CAF_COMM_WORLD,
+                                   &mem, p); chk_err(ierr);
+    mpi_token->shared_win = MPI_WIN_NULL;
+  }
+  else
+  {
+    ierr = MPI_Win_allocate_shared(size, 1, node_alloc_info, node_comm, &mem,
+                                   &mpi_token->shared_win); chk_err(ierr);
+    ierr = MPI_Win_create(mem, size, 1, MPI_INFO_NULL, CAF_COMM_WORLD, p);
+    chk_err(ierr);
+  }
+
+  mpi_token->node_base = (void **) malloc(sizeof(void *) * node_size);
+  for (i = 0; i < node_size; ++i)
+  {
+    ierr = MPI_Win_shared_query(mpi_token->shared_win == MPI_WIN_NULL
+                                  ? *p : mpi_token->shared_win,
+                                i, &peer_size, &disp_unit,
+                                &mpi_token->node_base[i]); chk_err(ierr);
+    if (peer_size == 0)
+      mpi_token->node_base[i] = NULL;
+  }
+  return mem;
+}
+
+/* Free the windows of mpi_token.  The shared memory window owning the memory
+ * is freed after the RMA window created over it. */
+
+static void
+free_token_windows(mpi_caf_token_t *mpi_token)
+{
+  int ierr;
+
+  ierr = MPI_Win_free(TOKEN(mpi_token)); chk_err(ierr);
+  if (mpi_token->node_base == NULL)
+    return;
+  if (mpi_token->shared_win != MPI_WIN_NULL)
+  {
+    ierr = MPI_Win_free(&mpi_token->shared_win); chk_err(ierr);
+  }
+  free(mpi_token->node_base);
+  mpi_token->node_base = NULL;
+}
+
+/* Return the address of the byte at offset in the memory of token on image
+ * image_index (zero for this image), or NULL when that memory is not
+ * accessible directly. */
+
+static void *
+node_address(caf_token_t token, int image_index, size_t offset)
+{
+  mpi_caf_token_t *mpi_token = (mpi_caf_token_t *) token;
+  int rank, node_rank;
+
+  if (mpi_token->node_base == NULL)
+    return NULL;
+  rank = translate_rank(mpi_token->memptr_win,
+                        (image_index == 0 ? caf_this_image : image_index) - 1);
+  node_rank = node_rank_of[rank];
+  if (node_rank < 0 || mpi_token->node_base[node_rank] == NULL)
+    return NULL;
+  /* Puts buffered or deferred in lock_all mode must not be overtaken. */
+  flush_combined(rank, mpi_token->memptr_win);
+  if (caf_lock_all_epoch)
+    complete_puts(rank, mpi_token->memptr_win, 0, PTRDIFF_MAX);
+  return (char *) mpi_token->node_base[node_rank] + offset;
+}
+
+/* Return the address of the atomic variable at offset on image image_index
+ * (zero for this image), when atomics are done with the atomic instructions of
+ * the processor, else NULL.  That is only possible when all images are on
+ * this node, because the atomics of the processor and those of MPI are not
+ * atomic with respect to each other. */
+
+static void *
+node_atomic_address(caf_token_t token, int image_index, size_t offset)
+{
+  return node_size == node_world_size
+    ? node_address(token, image_index, offset) : NULL;
+}
+
+/* Copy the descriptor desc to copy and let the copy point to base. */
+
+static gfc_descriptor_t *
+rebase_descriptor(gfc_max_dim_descriptor_t *copy, gfc_descriptor_t *desc,
+                  void *base)
+{
+  memcpy(copy, desc, sizeof_desc_for_rank(GFC_DESCRIPTOR_RANK(desc)));
+  copy->base.base_addr = base;
+  return (gfc_descriptor_t *) copy;
+}
+#endif // CAF_NODE_SHARED_MEMORY
+
+/* The counts of MPI are int.  Byte counts beyond large_count_limit, INT_MAX,
+ * are described by a datatype of blocks of large_count_block bytes followed by
+ * the remainder, so that a transfer of any size is still issued as one
+ * operation.  The limit can be lowered by OPENCOARRAYS_LARGE_COUNT_LIMIT for
+ * testing, the blocks are half its size. */
+
+static size_t
+  large_count_limit = INT_MAX,
+  large_count_block = (size_t)1 << 30;
+
+/* Create the uncommitted datatype of bytes contiguous bytes. */
+
+static void
+bytes_type(size_t bytes, MPI_Datatype *dt)
+{
+  MPI_Datatype block_type, blocks_type;
+  size_t nblocks, rest;
+  int ierr;
+
+  if (bytes <= large_count_limit)
+  {
+    ierr = MPI_Type_contiguous(bytes, MPI_BYTE, dt); chk_err(ierr);
+    return;
+  }
+  nblocks = bytes / large_count_block;
+  rest = bytes % large_count_block;
+  ierr = MPI_Type_contiguous(large_count_block, MPI_BYTE, &block_type);
+  chk_err(ierr);
+  ierr = MPI_Type_contiguous(nblocks, block_type, &blocks_type);
+  chk_err(ierr);
+  ierr = MPI_Type_free(&block_type); chk_err(ierr);
+  if (rest == 0)
+  {
+    *dt = blocks_type;
+    return;
+  }
+  {
+    int lens[2] = {1, rest};
+    MPI_Aint dsps[2] = {0, nblocks * large_count_block};
+    MPI_Datatype types[2] = {blocks_type, MPI_BYTE};
+
+    ierr = MPI_Type_create_struct(2, lens, dsps, types, dt); chk_err(ierr);
+    ierr = MPI_Type_free(&blocks_type); chk_err(ierr);
+  }
+}
+
+/* Put bytes contiguous bytes from buf to disp at rank of win. */
+
+static int
+put_bytes(void *buf, size_t bytes, int rank, MPI_Aint disp, MPI_Win win)
+{
+  MPI_Datatype dt;
+  int ierr;
+
+  if (bytes <= large_count_limit)
+    return MPI_Put(buf, bytes, MPI_BYTE, rank, disp, bytes, MPI_BYTE, win);
+  bytes_type(bytes, &dt);
+  ierr = MPI_Type_commit(&dt); chk_err(ierr);
+  ierr = MPI_Put(buf, 1, dt, rank, disp, 1, dt, win);
+  /* Pending operations are not affected by freeing their datatype. */
+  MPI_Type_free(&dt);
+  return ierr;
+}
+
+/* Get bytes contiguous bytes from disp at rank of win into buf. */
+
+static int
+get_bytes(void *buf, size_t bytes, int rank, MPI_Aint disp, MPI_Win win)
+{
+  MPI_Datatype dt;
+  int ierr;
+
+  if (bytes <= large_count_limit)
+    return MPI_Get(buf, bytes, MPI_BYTE, rank, disp, bytes, MPI_BYTE, win);
+  bytes_type(bytes, &dt);
+  ierr = MPI_Type_commit(&dt); chk_err(ierr);
+  ierr = MPI_Get(buf, 1, dt, rank, disp, 1, dt, win);
+  MPI_Type_free(&dt);
+  return ierr;
+}
+
+/* Get bytes contiguous bytes from disp at rank of win into buf in their own
+ * access epoch, or copy them directly when rank is this image. */
+
+static int
+get_window_bytes(void *buf, size_t bytes, int rank, MPI_Aint disp,
+                 MPI_Win win)
+{
+  void *self = self_address(win, rank, disp);
+  int ierr;
+
+  if (self)
+  {
+    memmove(buf, self, bytes);
+    return MPI_SUCCESS;
+  }
+  CAF_Win_lock_get(rank, disp, bytes, win);
+  ierr = get_bytes(buf, bytes, rank, disp, win);
+  CAF_Win_unlock_local(rank, win);
+  return ierr;
+}
+
+/* Put bytes contiguous bytes from buf to disp at rank of win in their own
+ * access epoch, or copy them directly when rank is this image.  Small puts
+ * may be held in the write-combining buffer of the target instead. */
+
+static int
+put_window_bytes(void *buf, size_t bytes, int rank, MPI_Aint disp,
+                 MPI_Win win)
+{
+  void *self = self_address(win, rank, disp);
+  int ierr;
+
+  if (self)
+  {
+    memmove(self, buf, bytes);
+    return MPI_SUCCESS;
+  }
+#if MPI_VERSION >= 3
+  if (combine_size > 0 && combine_put(buf, bytes, rank, disp, win))
+    return MPI_SUCCESS;
+#endif
+  CAF_Win_lock_put(rank, disp, bytes, win);
+  ierr = put_bytes(buf, bytes, rank, disp, win);
+  CAF_Win_unlock_put(rank, disp, bytes, win);
+  return ierr;
+}
+
+/* Build the committed datatype describing the size elements of elem_size
+ * bytes each of the array desc in array element order.  The displacements are
+ * relative to the address of the first element.  When desc is NULL, the
+ * elements are contiguous.  A rank 0 desc describes its element repeated size
+ * times.  vector, when not NULL, gives the indices of a vector subscript of the
+ * first dimension of a rank 1 array.
+ *
+ * Dimensions of extent one are skipped, dimensions contiguous to the
+ * dimensions inside them are merged into one block, and dimensions continuing
+ * the stride of the dimension inside them are merged into one vector.  So
+ * a(:, 2:n-1) is described by a single contiguous block and a(1:n:2, :) of
+ * a(n, m) by a single vector.
+ *
+ * For a vector subscript the datatype describes the *nunique distinct
+ * elements selected in ascending address order, so that adjacent ones form
+ * one block however the indices are ordered, and an index given twice is
+ * transferred once.  (*perm)[i] is the position of the i-th element of the
+ * user order among them; *perm is NULL when the indices are strictly
+ * ascending and the user order is the datatype's order. */
+
+typedef struct vector_elem_t
+{
+  MPI_Aint dsp;
+  size_t i;
+} vector_elem_t;
+
+static int
+compare_vector_elems(const void *a, const void *b)
+{
+  const vector_elem_t *ea = a, *eb = b;
+
+  if (ea->dsp != eb->dsp)
+    return ea->dsp < eb->dsp ? -1 : 1;
+  return ea->i < eb->i ? -1 : ea->i > eb->i;
+}
+
+static void
+build_array_type(gfc_descriptor_t *desc, caf_vector_t *vector,
+                 size_t elem_size, size_t size, MPI_Datatype *dt,
+                 size_t *nunique, size_t **perm)
+{
+  MPI_Datatype block_type, tmp_type;
+  size_t i, run = 1;
+  int j, ierr, nlev = 0;
+  struct { ptrdiff_t count; MPI_Aint stride; } levels[GFC_MAX_DIMENSIONS];
+
+  *nunique = size;
+  *perm = NULL;
+  if (desc == NULL)
+    run = size;
+  else if (vector != NULL)
+  {
+    /* The block lengths count elements, the displacements are in bytes. */
+    vector_elem_t *elems = malloc(sizeof(vector_elem_t) * size);
+    int *block_len = malloc(sizeof(int) * size), nblocks = 0;
+    MPI_Aint *block_dsp = malloc(sizeof(MPI_Aint) * size);
+    const MPI_Aint stride = desc->dim[0]._stride * elem_size;
+    bool ascending = true;
+    size_t n = 0;
+    MPI_Datatype elem_type;
+
+    for (i = 0; i < size; ++i)
+    {
+#define KINDCASE(kind, type)                                                \
+case kind:                                                                  \
+  elems[i].dsp = (((type *)vector->u.v.vector)[i] - desc->dim[0].lower_bound) \
+    * stride;                                                               \
+  break
+      switch (vector->u.v.kind)
+      {
+        KINDCASE(1, int8_t);
+        KINDCASE(2, int16_t);
+        KINDCASE(4, int32_t);
+        KINDCASE(8, int64_t);
+#ifdef HAVE_GFC_INTEGER_16
+        KINDCASE(16, __int128);
+#endif
+        default:
+          caf_runtime_error(unreachable);
+          return;
+      }
+#undef KINDCASE
+      elems[i].i = i;
+      if (i > 0 && elems[i].dsp <= elems[i - 1].dsp)
+        ascending = false;
+    }
+    if (!ascending)
+    {
+      qsort(elems, size, sizeof(vector_elem_t), compare_vector_elems);
+      *perm = malloc(sizeof(size_t) * size);
+    }
+    for (i = 0; i < size; ++i)
+    {
+      const MPI_Aint dsp = elems[i].dsp;
+
+      if (i == 0 || dsp != elems[i - 1].dsp)
+      {
+        if (nblocks > 0 && block_len[nblocks - 1] < INT_MAX
+            && dsp == block_dsp[nblocks - 1]
+                      + (MPI_Aint)elem_size * block_len[nblocks - 1])
+          ++block_len[nblocks - 1];
+        else
+        {
+          block_dsp[nblocks] = dsp;
+          block_len[nblocks++] = 1;
+        }
+        ++n;
+      }
+      if (*perm)
+        (*perm)[elems[i].i] = n - 1;
+    }
+    *nunique = n;
+    dprint("Coalesced %zd vector subscripts of %zd distinct elements into %d "
+           "blocks.\n", size, n, nblocks);
+    bytes_type(elem_size, &elem_type);
+    ierr = MPI_Type_create_hindexed(nblocks, block_len, block_dsp, elem_type,
+                                    dt); chk_err(ierr);
+    ierr = MPI_Type_free(&elem_type); chk_err(ierr);
+    ierr = MPI_Type_commit(dt); chk_err(ierr);
+    free(elems);
+    free(block_len);
+    free(block_dsp);
+    return;
+  }
+  else if (GFC_DESCRIPTOR_RANK(desc) == 0)
+  {
+    if (size > 1)
+    {
+      levels[0].count = size;
+      levels[0].stride = 0;
+      nlev = 1;
+    }
+  }
+  else
+  {
+    for (j = 0; j < GFC_DESCRIPTOR_RANK(desc); ++j)
+    {
+      const ptrdiff_t extent =
+        desc->dim[j]._ubound - desc->dim[j].lower_bound + 1;
+      const MPI_Aint stride = desc->dim[j]._stride * elem_size;
+
+      if (extent == 1)
+        continue;
+      if (nlev == 0 && stride == (MPI_Aint)(run * elem_size))
+        run *= extent;
+      else if (nlev > 0
+               && stride == levels[nlev - 1].count * levels[nlev - 1].stride
+               && levels[nlev - 1].count * extent <= INT_MAX)
+        levels[nlev - 1].count *= extent;
+      else
+      {
+        levels[nlev].count = extent;
+        levels[nlev].stride = stride;
+        ++nlev;
+      }
+    }
+  }
+
+  bytes_type(run * elem_size, &block_type);
+  for (j = 0; j < nlev; ++j)
+  {
+    ierr = MPI_Type_create_hvector(levels[j].count, 1, levels[j].stride,
+                                   block_type, &tmp_type); chk_err(ierr);
+    ierr = MPI_Type_free(&block_type); chk_err(ierr);
+    block_type = tmp_type;
+  }
+  dprint("Built datatype of %d levels over blocks of %zd bytes.\n",
+         nlev, run * elem_size);
+  *dt = block_type;
+  ierr = MPI_Type_commit(dt); chk_err(ierr);
+}
+
+/* Least recently used cache of the datatypes built by build_array_type.  The
+ * key consists of the rank, element size, number of elements, extents and
+ * strides, and for vector subscripts of the kind, lower bound and a copy of
+ * the indices.  A hash of the key is compared first.  The cached datatypes are
+ * owned by the cache and must not be freed by the caller.  For a vector
+ * subscript the entry also keeps the permutation to the user order, so that a
+ * repeated index list is sorted only once.  The capacity is
+ * read from OPENCOARRAYS_DATATYPE_CACHE_SIZE.  It is at least two, so that the
+ * source and destination types of one transfer are never evicted by each
+ * other.
+ * Hits and misses are reported by PREFIX(datatype_cache_stats). */
+
+#define DT_CACHE_KEY_MAX (3 + 2 * GFC_MAX_DIMENSIONS + 2)
+
+typedef struct dt_cache_entry_t
+{
+  uint64_t hash;
+  int key_len;
+  ptrdiff_t key[DT_CACHE_KEY_MAX];
+  /* Copy of the vector subscript indices, or NULL. */
+  void *vector;
+  size_t vector_bytes;
+  MPI_Datatype dt;
+  /* See build_array_type(). */
+  size_t nunique, *perm;
+  struct dt_cache_entry_t *prev, *next;
+} dt_cache_entry_t;
+
+static dt_cache_entry_t *dt_cache_head = NULL, *dt_cache_tail = NULL;
+static int dt_cache_entries = 0, dt_cache_capacity = 64;
+static long long dt_cache_hits = 0, dt_cache_misses = 0;
+
+static uint64_t
+fnv1a(uint64_t hash, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    hash = (hash ^ p[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+static void
+dt_cache_unlink(dt_cache_entry_t *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    dt_cache_head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    dt_cache_tail = e->prev;
+}
+
+static void
+dt_cache_free_entry(dt_cache_entry_t *e)
+{
+  int ierr = MPI_Type_free(&e->dt); chk_err(ierr);
+  free(e->vector);
+  free(e->perm);
+  free(e);
+  --dt_cache_entries;
+}
+
+/* Return the cache entry of the datatype build_array_type() builds for the
+ * arguments, building it only when it is not in the cache already. */
+
+static dt_cache_entry_t *
+find_array_type(gfc_descriptor_t *desc, caf_vector_t *vector,
+                size_t elem_size, size_t size)
+{
+  ptrdiff_t key[DT_CACHE_KEY_MAX];
+  int j, key_len = 0;
+  size_t vector_bytes = 0;
+  uint64_t hash;
+  dt_cache_entry_t *e;
+
+  key[key_len++] = desc == NULL ? -1 : GFC_DESCRIPTOR_RANK(desc);
+  key[key_len++] = elem_size;
+  key[key_len++] = size;
+  if (desc != NULL)
+  {
+    for (j = 0; j < GFC_DESCRIPTOR_RANK(desc); ++j)
+    {
+      key[key_len++] = desc->dim[j]._ubound - desc->dim[j].lower_bound + 1;
+      key[key_len++] = desc->dim[j]._stride;
+    }
+    if (vector != NULL)
+    {
+      key[key_len++] = vector->u.v.kind;
+      key[key_len++] = desc->dim[0].lower_bound;
+      vector_bytes = size * vector->u.v.kind;
+    }
+  }
+  hash = fnv1a(0xcbf29ce484222325ULL, key, key_len * sizeof(ptrdiff_t));
+  if (vector_bytes)
+    hash = fnv1a(hash, vector->u.v.vector, vector_bytes);
+
+  for (e = dt_cache_head; e; e = e->next)
+  {
+    if (e->hash == hash && e->key_len == key_len
+        && e->vector_bytes == vector_bytes
+        && memcmp(e->key, key, key_len * sizeof(ptrdiff_t)) == 0
+        && (!vector_bytes
+            || memcmp(e->vector, vector->u.v.vector, vector_bytes) == 0))
+    {
+      ++dt_cache_hits;
+      if (e != dt_cache_head)
+      {
+        dt_cache_unlink(e);
+        e->prev = NULL;
+        e->next = dt_cache_head;
+        dt_cache_head->prev = e;
+        dt_cache_head = e;
+      }
+      return e;
+    }
+  }
+
+  ++dt_cache_misses;
+  if (dt_cache_entries >= dt_cache_capacity)
+  {
+    e = dt_cache_tail;
+    dt_cache_unlink(e);
+    dt_cache_free_entry(e);
+  }
+  e = (dt_cache_entry_t *)malloc(sizeof(dt_cache_entry_t));
+  e->hash = hash;
+  e->key_len = key_len;
+  memcpy(e->key, key, key_len * sizeof(ptrdiff_t));
+  e->vector_bytes = vector_bytes;
+  e->vector = NULL;
+  if (vector_bytes)
+  {
+    e->vector = malloc(vector_bytes);
+    memcpy(e->vector, vector->u.v.vector, vector_bytes);
+  }
+  build_array_type(desc, vector, elem_size, size, &e->dt, &e->nunique,
+                   &e->perm);
+  e->prev = NULL;
+  e->next = dt_cache_head;
+  if (dt_cache_head)
+    dt_cache_head->prev = e;
+  else
+    dt_cache_tail = e;
+  dt_cache_head = e;
+  ++dt_cache_entries;
+  return e;
+}
+
+/* Return the datatype build_array_type() builds for desc without a vector
+ * subscript; vector subscripts are moved by get_vector() and put_vector(). */
+
+static void
+get_array_type(gfc_descriptor_t *desc, size_t elem_size, size_t size,
+               MPI_Datatype *dt)
+{
+  *dt = find_array_type(desc, NULL, elem_size, size)->dt;
+}
+
+static void
+free_datatype_cache(void)
+{
+  dt_cache_entry_t *e;
+
+  dprint("Datatype cache: %lld hits, %lld misses.\n", dt_cache_hits,
+         dt_cache_misses);
+  while ((e = dt_cache_head))
+  {
+    dt_cache_head = e->next;
+    dt_cache_free_entry(e);
+  }
+  dt_cache_tail = NULL;
+}
+
+void
+PREFIX(datatype_cache_stats) (long long *hits, long long *misses,
+                              int *entries)
+{
+  if (hits)
+    *hits = dt_cache_hits;
+  if (misses)
+    *misses = dt_cache_misses;
+  if (entries)
+    *entries = dt_cache_entries;
+}
+
+#if MPI_VERSION >= 3
+/* Bytes of the source moved per step by pipelined_sendget(), read from
+ * OPENCOARRAYS_SENDGET_CHUNK_SIZE. */
+static size_t sendget_chunk_size = 256 * 1024;
+#endif
+
+/* Arena of the staging buffers of the transfers.  The buffers are allocated
+ * with MPI_Alloc_mem(), so that the MPI library need not copy them again for
+ * the RMA operations, and are kept on free lists of power of two size classes
+ * for reuse by later transfers.  The bytes kept on the free lists are capped
+ * by OPENCOARRAYS_STAGING_LIMIT, a buffer freed beyond the cap is returned to
+ * MPI.  The bytes in use, their high-water mark and the bytes kept are
+ * reported by PREFIX(staging_stats). */
+
+#define STAGING_MIN_CLASS 6
+#define STAGING_CLASSES 64
+
+typedef union staging_chunk_t
+{
+  struct
+  {
+    union staging_chunk_t *next;
+    int size_class;
+  } h;
+  /* Align the buffer following the header for any type. */
+  long double align;
+} staging_chunk_t;
+
+static staging_chunk_t *staging_free_list[STAGING_CLASSES];
+static size_t
+  staging_in_use = 0,
+  staging_high_water = 0,
+  staging_cached = 0,
+  staging_limit = (size_t)64 << 20;
+
+static void *
+staging_alloc(size_t bytes)
+{
+  int size_class = STAGING_MIN_CLASS;
+  size_t chunk_size;
+  staging_chunk_t *chunk;
+
+  while (((size_t)1 << size_class) < bytes)
+    ++size_class;
+  chunk_size = (size_t)1 << size_class;
+
+  if ((chunk = staging_free_list[size_class]) != NULL)
+  {
+    staging_free_list[size_class] = chunk->h.next;
+    staging_cached -= chunk_size;
+  }
+  else
+  {
+    int ierr = MPI_Alloc_mem(sizeof(staging_chunk_t) + chunk_size,
+                             MPI_INFO_NULL, &chunk);
+    if (ierr != MPI_SUCCESS)
+      caf_runtime_error("Unable to allocate %zd bytes of staging memory.",
+                        chunk_size);
+    chunk->h.size_class = size_class;
+  }
+  staging_in_use += chunk_size;
+  if (staging_in_use > staging_high_water)
+    staging_high_water = staging_in_use;
+  return chunk + 1;
+}
+
+static void
+staging_free(void *buf)
+{
+  staging_chunk_t *chunk;
+  size_t chunk_size;
+
+  if (buf == NULL)
+    return;
+  chunk = (staging_chunk_t *)buf - 1;
+  chunk_size = (size_t)1 << chunk->h.size_class;
+  staging_in_use -= chunk_size;
+  if (staging_cached + chunk_size > staging_limit)
+  {
+    int ierr = MPI_Free_mem(chunk); chk_err(ierr);
+  }
+  else
+  {
+    chunk->h.next = staging_free_list[chunk->h.size_class];
+    staging_free_list[chunk->h.size_class] = chunk;
+    staging_cached += chunk_size;
+  }
+}
+
+static void
+free_staging_arena(void)
+{
+  int i, ierr;
+  staging_chunk_t *chunk;
+
+  dprint("Staging arena: high-water mark of %zd bytes.\n",
+         staging_high_water);
+  for (i = 0; i < STAGING_CLASSES; ++i)
+  {
+    while ((chunk = staging_free_list[i]))
+    {
+      staging_free_list[i] = chunk->h.next;
+      ierr = MPI_Free_mem(chunk); chk_err(ierr);
+    }
+  }
+  staging_cached = 0;
+}
+
+void
+PREFIX(staging_stats) (long long *in_use, long long *high_water,
+                       long long *cached)
+{
+  if (in_use)
+    *in_use = staging_in_use;
+  if (high_water)
+    *high_water = staging_high_water;
+  if (cached)
+    *cached = staging_cached;
+}
+
+/* Get the size elements of elem_size bytes of the rank 1 array desc selected
+ * by vector from disp at rank of win into the contiguous buf, in the order of
+ * the indices.  The distinct elements are fetched in address order by one
+ * get, and permuted into buf locally. */
+
+static int
+get_vector(void *buf, gfc_descriptor_t *desc, caf_vector_t *vector,
+           size_t elem_size, size_t size, int rank, MPI_Aint disp,
+           MPI_Win win)
+{
+  dt_cache_entry_t *e = find_array_type(desc, vector, elem_size, size);
+  MPI_Datatype dt_o;
+  MPI_Aint dt_lb, dt_extent;
+  char *sorted = buf;
+  size_t i;
+  int ierr;
+
+  if (e->perm)
+    sorted = staging_alloc(e->nunique * elem_size);
+  get_array_type(NULL, elem_size, e->nunique, &dt_o);
+  ierr = MPI_Type_get_true_extent(e->dt, &dt_lb, &dt_extent); chk_err(ierr);
+  CAF_Win_lock_get(rank, disp + dt_lb, dt_extent, win);
+  ierr = MPI_Get(sorted, 1, dt_o, rank, disp, 1, e->dt, win);
+  CAF_Win_unlock_local(rank, win);
+  if (e->perm)
+  {
+    for (i = 0; i < size; ++i)
+      memcpy((char *)buf + i * elem_size, sorted + e->perm[i] * elem_size,
+             elem_size);
+    staging_free(sorted);
+  }
+  return ierr;
+}
+
+/* Put the size elements of elem_size bytes in the contiguous buf to the
+ * elements of the rank 1 array desc selected by vector at disp of rank in win.
+ * The elements are permuted into address order locally and stored by one
+ * put.  Of an index given more than once the last element is stored. */
+
+static int
+put_vector(void *buf, gfc_descriptor_t *desc, caf_vector_t *vector,
+           size_t elem_size, size_t size, int rank, MPI_Aint disp,
+           MPI_Win win)
+{
+  dt_cache_entry_t *e = find_array_type(desc, vector, elem_size, size);
+  MPI_Datatype dt_o;
+  MPI_Aint dt_lb, dt_extent;
+  char *sorted = buf;
+  size_t i;
+  int ierr;
+
+  if (e->perm)
+  {
+    sorted = staging_alloc(e->nunique * elem_size);
+    for (i = 0; i < size; ++i)
+      memcpy(sorted + e->perm[i] * elem_size, (char *)buf + i * elem_size,
+             elem_size);
+  }
+  get_array_type(NULL, elem_size, e->nunique, &dt_o);
+  ierr = MPI_Type_get_true_extent(e->dt, &dt_lb, &dt_extent); chk_err(ierr);
+  CAF_Win_lock_put(rank, disp + dt_lb, dt_extent, win);
+  ierr = MPI_Put(sorted, 1, dt_o, rank, disp, 1, e->dt, win);
+  CAF_Win_unlock_put(rank, disp + dt_lb, dt_extent, win);
+  if (e->perm)
+    staging_free(sorted);
+  return ierr;
+}
+
+/* Define a helper to check whether the image at the given index is healthy,
+ * i.e., it hasn't failed. */
+#ifdef WITH_FAILED_IMAGES
+#define check_image_health(image_index, stat)                   \
+if (image_stati[image_index - 1] == STAT_FAILED_IMAGE)          \
+{                                                               \
+  if (stat == NULL) terminate_internal (STAT_FAILED_IMAGE, 0);  \
+  *stat = STAT_FAILED_IMAGE;                                    \
+  return;                                                       \
+}
+#else
+#define check_image_health(image_index, stat)
+#endif
+
+#ifdef WITH_FAILED_IMAGES
+/* Handle failed image's errors and try to recover the remaining process to
+ * allow the user to detect an image fail and exit gracefully. */
+static void
+failed_stopped_errorhandler_function (MPI_Comm* pcomm, int* perr, ...)
+{
+  MPI_Comm comm, shrunk, newcomm;
+  int num_failed_in_group, i, err, ierr;
+  MPI_Group comm_world_group, failed_group;
+  int *ranks_of_failed_in_comm_world, *ranks_failed;
+  int ns, srank, crank, rc, flag, drank, newrank;
+  bool stopped = false;
+
+  comm = *pcomm;
+
+  MPI_Error_class(*perr, &err);
+  if (err != MPIX_ERR_PROC_FAILED && err != MPIX_ERR_REVOKED)
+  {
+    /* We can handle PROC_FAILED and REVOKED ones only. */
+    char errstr[MPI_MAX_ERROR_STRING];
+    int errlen;
+    MPI_Error_string(err, errstr, &errlen);
+    /* We can't use caf_runtime_error here, because that would exit, which
+     * means only the one process will stop, but we need to stop MPI
+     * completely, which can be done by calling MPI_Abort(). */
+    fprintf(stderr,
+            "Fortran runtime error on image #%d:\nMPI error: '%s'.\n",
+            caf_this_image, errstr);
+    MPI_Abort(*pcomm, err);
+  }
+
+  dprint("(error = %d)\n", err);
+
+  ierr = MPIX_Comm_failure_ack(comm); chk_err(ierr);
+  ierr = MPIX_Comm_failure_get_acked(comm, &failed_group); chk_err(ierr);
+  ierr = MPI_Group_size(failed_group, &num_failed_in_group); chk_err(ierr);
+
+  dprint("%d images failed.\n", num_failed_in_group);
+  if (num_failed_in_group <= 0)
+  {
+    *perr = MPI_SUCCESS;
+    return;
+  }
+  if (num_failed_in_group > caf_num_images)
+  {
+    *perr = MPI_SUCCESS;
+    return;
+  }
+
+  ierr = MPI_Comm_group(comm, &comm_world_group); chk_err(ierr);
+  ranks_of_failed_in_comm_world =
+    (int *) alloca(sizeof(int) * num_failed_in_group);
+  ranks_failed = (int *) alloca(sizeof(int) * num_failed_in_group);
+  for (i = 0; i < num_failed_in_group; ++i)
+  {
+    ranks_failed[i] = i;
+  }
+  /* Now translate the ranks of the failed images into communicator world. */
+  ierr = MPI_Group_translate_ranks(failed_group, num_failed_in_group,
+                                   ranks_failed, comm_world_group,
+                                   ranks_of_failed_in_comm_world);
+  chk_err(ierr);
+
+  num_images_failed += num_failed_in_group;
+
+  if (!no_stopped_images_check_in_errhandler)
+  {
+    int buffer, flag;
+    MPI_Request req;
+    MPI_Status request_status;
+    dprint("Checking for stopped images.\n");
+    ierr = MPI_Irecv(&buffer, 1, MPI_INT, MPI_ANY_SOURCE,
+                     MPI_TAG_CAF_SYNC_IMAGES, CAF_COMM_WORLD, &req);
+    chk_err(ierr);
+    if (ierr == MPI_SUCCESS)
+    {
+      ierr = MPI_Test(&req, &flag, &request_status); chk_err(ierr);
+      if (flag)
+      {
+        // Received a result
+        if (buffer == STAT_STOPPED_IMAGE)
+        {
+          dprint("Image #%d found stopped.\n", request_status.MPI_SOURCE);
+          stopped = true;
+          if (image_stati[request_status.MPI_SOURCE] == 0)
+            ++num_images_stopped;
+          image_stati[request_status.MPI_SOURCE] = STAT_STOPPED_IMAGE;
+        }
+      }
+      else
+      {
+        dprint("No stopped images found.\n");
+        ierr = MPI_Cancel(&req); chk_err(ierr);
+      }
+    }
+    else
+    {
+      int err;
+      MPI_Error_class(ierr, &err);
+      dprint("Error on checking for stopped images %d.\n", err);
+    }
+  }
+
+  /* TODO: Consider whether removing the failed image from images_full will be
+   * necessary. This is more or less politics. */
+  for (i = 0; i < num_failed_in_group; ++i)
+  {
+    if (ranks_of_failed_in_comm_world[i] >= 0
+        && ranks_of_failed_in_comm_world[i] < caf_num_images)
+    {
+      if (image_stati[ranks_of_failed_in_comm_world[i]] == 0)
+        image_stati[ranks_of_failed_in_comm_world[i]] = STAT_FAILED_IMAGE;
+    }
+    else
+    {
+      dprint("Rank of failed image %d out of range of images 0..%d.\n",
+             ranks_of_failed_in_comm_world[i], caf_num_images);
+    }
+  }
+
+redo:
+  dprint("Before shrink. \n");
+  ierr = MPIX_Comm_shrink(*pcomm, &shrunk);
+  dprint("After shrink, rc = %d.\n", ierr);
+  ierr = MPI_Comm_set_errhandler(shrunk, failed_CAF_COMM_mpi_err_handler);
+  chk_err(ierr);
+  ierr = MPI_Comm_size(shrunk, &ns); chk_err(ierr);
+  ierr = MPI_Comm_rank(shrunk, &srank); chk_err(ierr);
+  ierr = MPI_Comm_rank(*pcomm, &crank); chk_err(ierr);
+
+  dprint("After getting ranks, ns = %d, srank = %d, crank = %d.\n",
+         ns, srank, crank);
+
+  /* Split does the magic: removing spare processes and reordering ranks
+   * so that all surviving processes remain at their former place */
+  rc = MPI_Comm_split(shrunk, (crank < 0) ? MPI_UNDEFINED : 1, crank, &newcomm);
+  ierr = MPI_Comm_rank(newcomm, &newrank); chk_err(ierr);
+  dprint("After split, rc = %d, rank = %d.\n", rc, newrank);
+  flag = (rc == MPI_SUCCESS);
+  /* Split or some of the communications above may have failed if
+   * new failures have disrupted the process: we need to
+   * make sure we succeeded at all ranks, or retry until it works. */
+  flag = MPIX_Comm_agree(newcomm, &flag);
+  dprint("After agree, flag = %d.\n", flag);
+
+  ierr = MPI_Comm_rank(newcomm, &drank); chk_err(ierr);
+  dprint("After rank, drank = %d.\n", drank);
+
+  ierr = MPI_Comm_free(&shrunk); chk_err(ierr);
+  if (MPI_SUCCESS != flag)
+  {
+    if (MPI_SUCCESS == rc)
+    {
+      ierr = MPI_Comm_free(&newcomm); chk_err(ierr);
+    }
+    goto redo;
+  }
+
+  {
+    int cmpres;
+    ierr = MPI_Comm_compare(*pcomm, CAF_COMM_WORLD, &cmpres); chk_err(ierr);
+    dprint("Comm_compare(*comm, CAF_COMM_WORLD, res = %d) = %d.\n",
+           cmpres, ierr);
+    ierr = MPI_Comm_compare(*pcomm, alive_comm, &cmpres); chk_err(ierr);
+    dprint("Comm_compare(*comm, alive_comm, res = %d) = %d.\n",
+           cmpres, ierr);
+    if (cmpres == MPI_CONGRUENT)
+    {
+      CAF_Win_unlock_all(*stat_tok);
+      ierr = MPI_Win_detach(*stat_tok, &img_status); chk_err(ierr);
+      dprint("detached win img_status.\n");
+      ierr = MPI_Win_free(stat_tok); chk_err(ierr);
+      dprint("freed win img_status.\n");
+      ierr = MPI_Win_create(&img_status, sizeof(int), 1, mpi_info_same_size,
+                            newcomm, stat_tok); chk_err(ierr);
+      dprint("(re-)created win img_status.\n");
+      CAF_Win_lock_all(*stat_tok);
+      dprint("Win_lock_all on img_status.\n");
+    }
+  }
+  /* Also free the old communicator before replacing it. */
+  ierr = MPI_Comm_free(pcomm); chk_err(ierr);
+  *pcomm = newcomm;
+  invalidate_win_rank_cache();
+
+  *perr = stopped ? STAT_STOPPED_IMAGE : STAT_FAILED_IMAGE;
+}
+#endif
+
+#if MPI_VERSION >= 3 && !defined(WITH_FAILED_IMAGES)
+/* LOCK, UNLOCK and CRITICAL use the queue lock of Mellor-Crummey and Scott.
+ * The lock word on the image hosting the lock variable names the queue node of
+ * the last image holding or waiting for the lock and is zero when the lock is
+ * free.  An image acquiring the lock swaps its node into the lock word and,
+ * when there was a predecessor, links its node to the predecessor's and spins
+ * on the flag of its own node.  Releasing the lock clears the flag of the
+ * successor.  Acquiring and releasing take a constant number of remote
+ * operations, the images are served in the order of their arrival and waiting
+ * images only poll their own memory.  The queue nodes are kept in
+ * lock_node_win, CAF_LOCK_NODES per image; node n of the image of rank r in
+ * the initial team is named r * CAF_LOCK_NODES + n + 1.  When all images are
+ * on this node, the lock words and the queue nodes are accessed with the
+ * atomic instructions of the processor, see node_atomic_address(). */
+
+/* The offsets of the fields of a queue node: the name of the successor's node
+ * and the flag cleared when the lock is handed over. */
+#define LOCK_NODE_NEXT 0
+#define LOCK_NODE_LOCKED sizeof(int)
+
+/* The lock held or waited for with a queue node of this image. */
+typedef struct
+{
+  /* The window of the lock word or MPI_WIN_NULL, when the node is free. */
+  MPI_Win win;
+  int rank;
+  size_t index;
+  /* The address of the lock word, when it is accessed directly. */
+  int *lock_var;
+} caf_held_lock_t;
+
+static MPI_Win lock_node_win = MPI_WIN_NULL;
+static int lock_node_rank;
+static char *lock_nodes;
+/* The queue nodes of each image indexed by the rank in the initial team, when
+ * they are accessed directly, else NULL. */
+static char **lock_node_base = NULL;
+static caf_held_lock_t held_locks[CAF_LOCK_NODES];
+
+/* Create the queue nodes of this image.  lock_node_win is kept in a lock_all
+ * epoch in either synchronization mode.  Collective over CAF_COMM_WORLD. */
+
+static void
+init_lock_nodes(void)
+{
+  const MPI_Aint size = CAF_LOCK_NODES * CAF_LOCK_STRIDE;
+  void *mem;
+  int i, ierr;
+
+  lock_node_rank = caf_this_image - 1;
+#ifdef CAF_NODE_SHARED_MEMORY
+  if (node_comm != MPI_COMM_NULL && node_size == node_world_size)
+  {
+    MPI_Aint peer_size;
+    int disp_unit;
+
+    ierr = MPI_Win_allocate_shared(size, 1, node_alloc_info, CAF_COMM_WORLD,
+                                   &mem, &lock_node_win); chk_err(ierr);
+    lock_node_base = (char **) malloc(sizeof(char *) * caf_num_images);
+    for (i = 0; i < caf_num_images; ++i)
+    {
+      ierr = MPI_Win_shared_query(lock_node_win, i, &peer_size, &disp_unit,
+                                  &lock_node_base[i]); chk_err(ierr);
+    }
+  }
+  else
+#endif // CAF_NODE_SHARED_MEMORY
+  {
+    ierr = MPI_Win_allocate(size, 1, mpi_info_same_size, CAF_COMM_WORLD, &mem,
+                            &lock_node_win); chk_err(ierr);
+  }
+  lock_nodes = (char *) mem;
+  memset(lock_nodes, 0, size);
+  for (i = 0; i < CAF_LOCK_NODES; ++i)
+    held_locks[i].win = MPI_WIN_NULL;
+  ierr = MPI_Win_lock_all(MPI_MODE_NOCHECK, lock_node_win); chk_err(ierr);
+}
+
+static void
+free_lock_nodes(void)
+{
+  int ierr;
+
+  ierr = MPI_Win_unlock_all(lock_node_win); chk_err(ierr);
+  ierr = MPI_Win_free(&lock_node_win); chk_err(ierr);
+  free(lock_node_base);
+  lock_node_base = NULL;
+}
+
+/* Apply op, MPI_REPLACE or MPI_NO_OP, with value atomically to the int at
+ * disp on rank of win or at addr, when it is not NULL.  Returns the previous
+ * value. */
+
+static int
+lock_fetch_and_op(int *addr, MPI_Win win, int rank, MPI_Aint disp, int value,
+                  MPI_Op op)
+{
+  int old, ierr;
+
+  if (addr)
+    return op == MPI_NO_OP
+      ? __atomic_load_n(addr, __ATOMIC_SEQ_CST)
+      : __atomic_exchange_n(addr, value, __ATOMIC_SEQ_CST);
+  if (win == lock_node_win)
+  {
+    ierr = MPI_Fetch_and_op(&value, &old, MPI_INT, rank, disp, op, win);
+    chk_err(ierr);
+    ierr = MPI_Win_flush(rank, win); chk_err(ierr);
+    return old;
+  }
+  CAF_Win_lock(MPI_LOCK_SHARED, rank, win);
+  ierr = MPI_Fetch_and_op(&value, &old, MPI_INT, rank, disp, op, win);
+  chk_err(ierr);
+  ierr = CAF_Win_unlock(rank, win); chk_err(ierr);
+  return old;
+}
+
+/* Replace the int at disp on rank of win or at addr, when it is not NULL, by
+ * value when it equals compare.  Returns the previous value. */
+
+static int
+lock_compare_and_swap(int *addr, MPI_Win win, int rank, MPI_Aint disp,
+                      int compare, int value)
+{
+  int old = compare, ierr;
+
+  if (addr)
+  {
+    __atomic_compare_exchange_n(addr, &old, value, false, __ATOMIC_SEQ_CST,
+                                __ATOMIC_SEQ_CST);
+    return old;
+  }
+  CAF_Win_lock(MPI_LOCK_SHARED, rank, win);
+  ierr = MPI_Compare_and_swap(&value, &compare, &old, MPI_INT, rank, disp,
+                              win); chk_err(ierr);
+  ierr = CAF_Win_unlock(rank, win); chk_err(ierr);
+  return old;
+}
+
+/* Apply op with value to field of the queue node named id, see
+ * lock_fetch_and_op(). */
+
+static int
+lock_node_op(int id, size_t field, bool direct, int value, MPI_Op op)
+{
+  const int rank = (id - 1) / CAF_LOCK_NODES;
+  const MPI_Aint disp = ((id - 1) % CAF_LOCK_NODES) * CAF_LOCK_STRIDE + field;
+
+  return lock_fetch_and_op(direct ? (int *) (lock_node_base[rank] + disp)
+                                  : NULL,
+                           lock_node_win, rank, disp, value, op);
+}
+
+/* Pause in a loop waiting for a queue node to change.  The processor is
+ * yielded after the first spins, because the images may oversubscribe it. */
+
+static inline void
+lock_spin_pause(int *spins)
+{
+  if (++*spins > 100)
+    sched_yield();
+}
+
+/* Lock the lock variable index of token on image image_index.  When
+ * acquired_lock is not NULL, the lock is only tried and acquired_lock tells
+ * whether it was acquired. */
+
+void mutex_lock(caf_token_t token, int image_index, size_t index, int *stat,
+                int *acquired_lock, char *errmsg, size_t errmsg_len)
+{
+  const char msg[] = "Already locked";
+  MPI_Win win = *TOKEN(token);
+  const int rank = translate_rank(win, image_index - 1);
+  const MPI_Aint disp = index * CAF_LOCK_STRIDE;
+#ifdef CAF_NODE_SHARED_MEMORY
+  int *lock_var = node_atomic_address(token, image_index, disp);
+#else
+  int *lock_var = NULL;
+#endif
+  const bool direct = lock_var != NULL;
+  int node = -1, id, pred, spins = 0, i;
+
+  if (stat != NULL)
+    *stat = 0;
+
+  for (i = 0; i < CAF_LOCK_NODES; ++i)
+  {
+    caf_held_lock_t *held = &held_locks[i];
+    if (held->win == MPI_WIN_NULL)
+    {
+      if (node < 0)
+        node = i;
+    }
+    else if (held->win == win && held->rank == rank && held->index == index)
+      goto stat_error;
+  }
+  if (node < 0)
+    caf_runtime_error("More than %d locks held at the same time",
+                      CAF_LOCK_NODES);
+
+  /* No other image accesses the node before it is swapped in. */
+  id = lock_node_rank * CAF_LOCK_NODES + node + 1;
+  *(int *) (lock_nodes + node * CAF_LOCK_STRIDE + LOCK_NODE_NEXT) = 0;
+  *(int *) (lock_nodes + node * CAF_LOCK_STRIDE + LOCK_NODE_LOCKED) = 1;
+  if (direct)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  else
+  {
+    int ierr = MPI_Win_sync(lock_node_win); chk_err(ierr);
+  }
+
+  if (acquired_lock != NULL)
+  {
+    *acquired_lock =
+      lock_compare_and_swap(lock_var, win, rank, disp, 0, id) == 0;
+    if (!*acquired_lock)
+      return;
+  }
+  else
+  {
+    pred = lock_fetch_and_op(lock_var, win, rank, disp, id, MPI_REPLACE);
+    if (pred != 0)
+    {
+      lock_node_op(pred, LOCK_NODE_NEXT, direct, id, MPI_REPLACE);
+      while (lock_node_op(id, LOCK_NODE_LOCKED, direct, 0, MPI_NO_OP) != 0)
+        lock_spin_pause(&spins);
+    }
+  }
+
+  held_locks[node].win = win;
+  held_locks[node].rank = rank;
+  held_locks[node].index = index;
+  held_locks[node].lock_var = lock_var;
+  return;
+
+stat_error:
+  if (errmsg != NULL)
+  {
+    memset(errmsg,' ',errmsg_len);
+    memcpy(errmsg, msg, MIN(errmsg_len,strlen(msg)));
+  }
+
+  if (stat != NULL)
+    *stat = 99;
+  else
+    terminate_internal(99, 1);
+}
+
+/* Unlock the lock variable index of token on image image_index, handing it
+ * over to the next image waiting for it. */
+
+void mutex_unlock(caf_token_t token, int image_index, size_t index, int *stat,
+                  char* errmsg, size_t errmsg_len)
+{
+  const char msg[] = "Variable is not locked";
+  MPI_Win win = *TOKEN(token);
+  const int rank = translate_rank(win, image_index - 1);
+  caf_held_lock_t *held = NULL;
+  int node, id, next, spins = 0;
+  bool direct;
+
+  if (stat != NULL)
+    *stat = 0;
+
+  for (node = 0; node < CAF_LOCK_NODES; ++node)
+  {
+    if (held_locks[node].win == win && held_locks[node].rank == rank
+        && held_locks[node].index == index)
+    {
+      held = &held_locks[node];
+      break;
+    }
+  }
+  if (held == NULL)
+    goto stat_error;
+
+  id = lock_node_rank * CAF_LOCK_NODES + node + 1;
+  direct = held->lock_var != NULL;
+  next = lock_node_op(id, LOCK_NODE_NEXT, direct, 0, MPI_NO_OP);
+  if (next == 0)
+  {
+    /* Free the lock, unless an image swapped its node in meanwhile, which
+     * then links itself to this one shortly. */
+    if (lock_compare_and_swap(held->lock_var, win, rank,
+                              index * CAF_LOCK_STRIDE, id, 0) == id)
+      goto unlocked;
+    while ((next = lock_node_op(id, LOCK_NODE_NEXT, direct, 0, MPI_NO_OP))
+           == 0)
+      lock_spin_pause(&spins);
+  }
+  lock_node_op(next, LOCK_NODE_LOCKED, direct, 0, MPI_REPLACE);
+
+unlocked:
+  held->win = MPI_WIN_NULL;
+  return;
+
+stat_error:
+  if (errmsg != NULL)
+  {
+    memset(errmsg,' ',errmsg_len);
+    memcpy(errmsg, msg, MIN(errmsg_len,strlen(msg)));
+  }
+  if (stat != NULL)
+    *stat = 99;
+  else
+    terminate_internal(99, 1);
+}
+
+#else // MPI_VERSION && !WITH_FAILED_IMAGES
+
+/* Compare the lock variable index at rank of win with compare and replace it
+ * by newval when equal, returning its previous value in value.  When lock_var
+ * is not NULL, it is the address of the lock variable and the atomic
+ * instructions of the processor are used. */
+static void
+locking_atomic_op(MPI_Win win, int *lock_var, int *value, int newval,
+                  int compare, int rank, size_t index)
+{
+  if (lock_var)
+  {
+    *value = compare;
+    __atomic_compare_exchange_n(lock_var, value, newval, false,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return;
+  }
+  CAF_Win_lock(MPI_LOCK_EXCLUSIVE, rank, win);
+  int ierr = MPI_Compare_and_swap(&newval, &compare,value, MPI_INT,
+                                  rank, index * CAF_LOCK_STRIDE, win);
+  chk_err(ierr);
+  CAF_Win_unlock(rank, win);
+}
+
+
+/* Lock the lock variable index of token on image image_index by spinning on
+ * it.  Unlike with the queue lock, a lock held by a failed image can be
+ * recovered.  The lock variables are accessed with the atomic instructions of
+ * the processor, when all images are on this node, see
+ * node_atomic_address(). */
+
+void mutex_lock(caf_token_t token, int image_index, size_t index, int *stat,
+                int *acquired_lock, char *errmsg, size_t errmsg_len)
+{
+  const char msg[] = "Already locked";
+#if MPI_VERSION >= 3
+  MPI_Win win = *TOKEN(token);
+  int value = 0, compare = 0, newval = caf_this_image, ierr = 0, i = 0;
+  const int rank = translate_rank(win, image_index - 1);
+#ifdef CAF_NODE_SHARED_MEMORY
+  int *lock_var = node_atomic_address(token, image_index,
+                                      index * CAF_LOCK_STRIDE);
+#else
+  int *lock_var = NULL;
+#endif
+#ifdef WITH_FAILED_IMAGES
+  int flag, check_failure = 100, zero = 0;
+#endif
 
-  locking_atomic_op(win, &value, newval, compare, image_index, index);
+  if (stat != NULL)
+    *stat = 0;
+
+#ifdef WITH_FAILED_IMAGES
+  ierr = MPI_Test(&alive_request, &flag, MPI_STATUS_IGNORE); chk_err(ierr);
+#endif
+
+  locking_atomic_op(win, lock_var, &value, newval, compare, rank,
+                      index);
 
   if (value == caf_this_image && image_index == caf_this_image)
     goto stat_error;
@@ -723,17 +2686,18 @@ void mutex_lock(MPI_Win win, int image_index, size_t index, int *stat,
     }
 #endif
 
-    locking_atomic_op(win, &value, newval, compare, image_index, index);
+    locking_atomic_op(win, lock_var, &value, newval, compare, rank,
+                      index);
 #ifdef WITH_FAILED_IMAGES
     if (image_stati[value] == STAT_FAILED_IMAGE)
     {
-      CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image_index - 1, win);
-      /* MPI_Fetch_and_op(&zero, &newval, MPI_INT, image_index - 1,
-       * index * sizeof(int), MPI_REPLACE, win); */
+      CAF_Win_lock(MPI_LOCK_EXCLUSIVE, rank, win);
+      /* MPI_Fetch_and_op(&zero, &newval, MPI_INT, rank,
+       * index * CAF_LOCK_STRIDE, MPI_REPLACE, win); */
       ierr = MPI_Compare_and_swap(&zero, &value, &newval, MPI_INT,
-                                  image_index - 1, index * sizeof(int), win);
+                                  rank, index * CAF_LOCK_STRIDE, win);
       chk_err(ierr);
-      CAF_Win_unlock(image_index - 1, win);
+      CAF_Win_unlock(rank, win);
       break;
     }
 #else
@@ -766,22 +2730,36 @@ stat_error:
 #endif // MPI_VERSION
 }
 
-void mutex_unlock(MPI_Win win, int image_index, size_t index, int *stat,
+void mutex_unlock(caf_token_t token, int image_index, size_t index, int *stat,
                   char* errmsg, size_t errmsg_len)
 {
   const char msg[] = "Variable is not locked";
   if (stat != NULL)
     *stat = 0;
 #if MPI_VERSION >= 3
+  MPI_Win win = *TOKEN(token);
   int value = 1, ierr = 0, newval = 0, flag;
+  const int rank = translate_rank(win, image_index - 1);
+#ifdef CAF_NODE_SHARED_MEMORY
+  int *lock_var = node_atomic_address(token, image_index,
+                                      index * CAF_LOCK_STRIDE);
+#else
+  int *lock_var = NULL;
+#endif
 #ifdef WITH_FAILED_IMAGES
   ierr = MPI_Test(&alive_request, &flag, MPI_STATUS_IGNORE); chk_err(ierr);
 #endif
 
-  CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image_index - 1, win);
-  ierr = MPI_Fetch_and_op(&newval, &value, MPI_INT, image_index - 1,
-                          index * sizeof(int), MPI_REPLACE, win); chk_err(ierr);
-  ierr = CAF_Win_unlock(image_index - 1, win); chk_err(ierr);
+  if (lock_var)
+    value = __atomic_exchange_n(lock_var, newval, __ATOMIC_SEQ_CST);
+  else
+  {
+    CAF_Win_lock(MPI_LOCK_EXCLUSIVE, rank, win);
+    ierr = MPI_Fetch_and_op(&newval, &value, MPI_INT, rank,
+                            index * CAF_LOCK_STRIDE, MPI_REPLACE, win);
+    chk_err(ierr);
+    ierr = CAF_Win_unlock(rank, win); chk_err(ierr);
+  }
 
   /* Temporarily commented */
   /* if (value == 0)
@@ -810,6 +2788,226 @@ stat_error:
          "please update your MPI implementation\n");
 #endif // MPI_VERSION
 }
+#endif // MPI_VERSION && !WITH_FAILED_IMAGES
+
+/* An image waiting for an event polls the counter event_spin times, see
+ * OPENCOARRAYS_EVENT_SPIN, and then blocks until the counter may have
+ * changed.  Posting to a counter in node shared memory increments the wake
+ * word of the image of the counter and wakes the image sleeping on the futex
+ * of its wake word, therefore an image can sleep on several counters at once.
+ * Else the waiting image sets its sleeping word, reads the counter again and
+ * blocks in the progress engine of MPI for a zero byte message on event_comm.
+ * A post sends that message after the counter is updated, only when it finds
+ * the sleeping word of the image of the counter set, see event_notify().  The
+ * messages carry no information, after each one the counter is read again.
+ * Either the post finds the word set or the waiting image reads the updated
+ * counter, therefore no post is missed. */
+
+/* Return the rank in event_comm of rank team_rank in the current team. */
+
+static int
+event_rank(int team_rank)
+{
+  MPI_Group team_group, event_group;
+  int *team_ranks, i, ierr;
+
+  if (event_team != CAF_COMM_WORLD)
+  {
+    team_ranks = (int *) malloc(caf_num_images * sizeof(int));
+    for (i = 0; i < caf_num_images; ++i)
+      team_ranks[i] = i;
+    ierr = MPI_Comm_group(CAF_COMM_WORLD, &team_group); chk_err(ierr);
+    ierr = MPI_Comm_group(event_comm, &event_group); chk_err(ierr);
+    ierr = MPI_Group_translate_ranks(team_group, caf_num_images, team_ranks,
+                                     event_group, event_team_ranks);
+    chk_err(ierr);
+    ierr = MPI_Group_free(&team_group); chk_err(ierr);
+    ierr = MPI_Group_free(&event_group); chk_err(ierr);
+    free(team_ranks);
+    event_team = CAF_COMM_WORLD;
+  }
+  return event_team_ranks[team_rank];
+}
+
+/* Block until a notification arrives. */
+
+static void
+wait_event_notification(void)
+{
+  int ierr = MPI_Recv(NULL, 0, MPI_BYTE, MPI_ANY_SOURCE, MPI_TAG_CAF_EVENT,
+                      event_comm, MPI_STATUS_IGNORE); chk_err(ierr);
+}
+
+#if MPI_VERSION >= 3
+/* The sleeping word of this image in event_sleep_win, one int per rank of
+ * event_comm, which is kept in a lock_all epoch.  An image sets its word before
+ * it blocks in wait_event_notification() and a post to it swaps the word to
+ * zero and sends the notification only when the word was set.  So a message
+ * is only sent to an image about to block, at most one per blocking, and
+ * images that only query their events receive none.  Collective over
+ * event_comm. */
+
+static MPI_Win event_sleep_win = MPI_WIN_NULL;
+
+static void
+init_event_sleep_words(void)
+{
+  int *mem, ierr;
+
+  ierr = MPI_Win_allocate(sizeof(int), 1, mpi_info_same_size, event_comm,
+                          &mem, &event_sleep_win); chk_err(ierr);
+  *mem = 0;
+  ierr = MPI_Win_lock_all(MPI_MODE_NOCHECK, event_sleep_win); chk_err(ierr);
+  ierr = MPI_Barrier(event_comm); chk_err(ierr);
+}
+
+static void
+free_event_sleep_words(void)
+{
+  int ierr;
+
+  ierr = MPI_Win_unlock_all(event_sleep_win); chk_err(ierr);
+  ierr = MPI_Win_free(&event_sleep_win); chk_err(ierr);
+}
+
+/* Replace the sleeping word of rank in event_comm by value and return the
+ * previous one. */
+
+static int
+swap_event_sleep_word(int rank, int value)
+{
+  int old, ierr;
+
+  ierr = MPI_Fetch_and_op(&value, &old, MPI_INT, rank, 0, MPI_REPLACE,
+                          event_sleep_win); chk_err(ierr);
+  ierr = MPI_Win_flush(rank, event_sleep_win); chk_err(ierr);
+  return old;
+}
+
+/* Wake image_index (zero for this image) waiting for an event, after its
+ * counter was changed by RMA.  This image does not wait while it posts, so a
+ * local post needs no notification; the counter is read again before this
+ * image blocks. */
+
+static void
+event_notify(int image_index)
+{
+  int rank, ierr;
+
+  if (image_index == 0 || image_index == caf_this_image)
+    return;
+  rank = event_rank(image_index - 1);
+  if (swap_event_sleep_word(rank, 0))
+  {
+    ierr = MPI_Send(NULL, 0, MPI_BYTE, rank, MPI_TAG_CAF_EVENT, event_comm);
+    chk_err(ierr);
+  }
+}
+
+/* Announce that this image is going to block for a notification.  The
+ * counters waited for have to be read again afterwards, because a post
+ * before the announcement does not notify. */
+
+static void
+announce_event_sleep(void)
+{
+  swap_event_sleep_word(event_rank(caf_this_image - 1), 1);
+}
+
+/* Withdraw the announcement, when this image does not block after all.  When
+ * a post took it already, its notification is on the way and received. */
+
+static void
+cancel_event_sleep(void)
+{
+  if (swap_event_sleep_word(event_rank(caf_this_image - 1), 0) == 0)
+    wait_event_notification();
+}
+#endif // MPI_VERSION
+
+#ifdef CAF_NODE_SHARED_MEMORY
+/* Create the wake words of the images, when the counters of events are in
+ * node shared memory.  Collective over CAF_COMM_WORLD. */
+
+static void
+init_event_words(void)
+{
+  MPI_Aint size;
+  int *mem, disp_unit, i, ierr;
+
+  if (node_comm == MPI_COMM_NULL || node_size != node_world_size)
+    return;
+  ierr = MPI_Win_allocate_shared(sizeof(int), 1, node_alloc_info,
+                                 CAF_COMM_WORLD, &mem, &event_word_win);
+  chk_err(ierr);
+  *mem = 0;
+  event_words = (int **) malloc(sizeof(int *) * caf_num_images);
+  for (i = 0; i < caf_num_images; ++i)
+  {
+    ierr = MPI_Win_shared_query(event_word_win, i, &size, &disp_unit,
+                                &event_words[i]); chk_err(ierr);
+  }
+}
+
+static void
+free_event_words(void)
+{
+  int ierr;
+
+  if (event_words == NULL)
+    return;
+  ierr = MPI_Win_free(&event_word_win); chk_err(ierr);
+  free(event_words);
+  event_words = NULL;
+}
+
+/* Return the value of the wake word of this image to be passed to
+ * event_sleep(), read before the counters waited for. */
+
+static int
+event_word(void)
+{
+  return __atomic_load_n(event_words[event_rank(caf_this_image - 1)],
+                         __ATOMIC_SEQ_CST);
+}
+
+/* Sleep while the wake word of this image still holds value, see
+ * event_wake(). */
+
+static void
+event_sleep(int value)
+{
+#ifdef CAF_EVENT_FUTEX
+  /* Return now and then to let MPI progress the accesses of other images
+   * through windows that are not shared. */
+  const struct timespec timeout = { 0, 1000000 };
+  int flag, ierr;
+
+  syscall(SYS_futex, event_words[event_rank(caf_this_image - 1)], FUTEX_WAIT,
+          value, &timeout, NULL, 0);
+  ierr = MPI_Iprobe(MPI_ANY_SOURCE, MPI_TAG_CAF_EVENT, event_comm, &flag,
+                    MPI_STATUS_IGNORE); chk_err(ierr);
+#else
+  (void) value;
+  sched_yield();
+#endif
+}
+
+/* Wake image_index (zero for this image) sleeping for a counter in node
+ * shared memory, after the counter was changed. */
+
+static void
+event_wake(int image_index)
+{
+  int *word = event_words[event_rank((image_index == 0 ? caf_this_image
+                                                        : image_index) - 1)];
+
+  __atomic_fetch_add(word, 1, __ATOMIC_SEQ_CST);
+#ifdef CAF_EVENT_FUTEX
+  syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+}
+#endif // CAF_NODE_SHARED_MEMORY
 
 /* Initialize coarray program.  This routine assumes that no other
  * MPI initialization happened before. */
@@ -878,6 +3076,68 @@ PREFIX(init) (int *argc, char ***argv)
 
     ++caf_this_image;
     caf_is_finalized = 0;
+    ierr = MPI_Win_create_keyval(MPI_WIN_NULL_COPY_FN, free_win_rank_table,
+                                 &win_rank_keyval, NULL); chk_err(ierr);
+    ierr = MPI_Win_create_keyval(MPI_WIN_NULL_COPY_FN, free_dirty_win,
+                                 &dirty_win_keyval, NULL); chk_err(ierr);
+
+#if MPI_VERSION >= 3
+    /* Select the passive target synchronization mode.  All images have to
+     * agree on it, therefore the setting of the first image is used. */
+    if (caf_this_image == 1)
+    {
+      const char *epoch = getenv("OPENCOARRAYS_RMA_EPOCH");
+      caf_lock_all_epoch = epoch != NULL && strcmp(epoch, "lock_all") == 0;
+    }
+    int lock_all_epoch = caf_lock_all_epoch;
+    ierr = MPI_Bcast(&lock_all_epoch, 1, MPI_INT, 0, CAF_COMM_WORLD);
+    chk_err(ierr);
+    caf_lock_all_epoch = lock_all_epoch;
+    dprint("Passive target synchronization mode: %s.\n",
+           caf_lock_all_epoch ? "lock_all" : "lock");
+#endif // MPI_VERSION
+#ifdef CAF_NODE_SHARED_MEMORY
+    /* Access the images on the same node through shared memory, unless
+     * OPENCOARRAYS_SHARED_MEMORY=0.  The setting of the first image is
+     * used. */
+    int shared_memory = 1;
+    if (caf_this_image == 1)
+    {
+      const char *shm = getenv("OPENCOARRAYS_SHARED_MEMORY");
+      shared_memory = shm == NULL || atoi(shm) != 0;
+    }
+    ierr = MPI_Bcast(&shared_memory, 1, MPI_INT, 0, CAF_COMM_WORLD);
+    chk_err(ierr);
+    if (shared_memory)
+      init_node_map();
+#endif // CAF_NODE_SHARED_MEMORY
+
+    const char *dt_cache_size = getenv("OPENCOARRAYS_DATATYPE_CACHE_SIZE");
+    if (dt_cache_size != NULL)
+      dt_cache_capacity = MAX(2, atoi(dt_cache_size));
+    const char *sync_plans_env = getenv("OPENCOARRAYS_SYNC_IMAGES_PLANS");
+    if (sync_plans_env != NULL)
+      sync_plan_capacity = MAX(0, atoi(sync_plans_env));
+    const char *staging_limit_env = getenv("OPENCOARRAYS_STAGING_LIMIT");
+    if (staging_limit_env != NULL)
+      staging_limit = MAX(0, atoll(staging_limit_env));
+    const char *large_count_env = getenv("OPENCOARRAYS_LARGE_COUNT_LIMIT");
+    if (large_count_env != NULL)
+    {
+      large_count_limit = MIN(INT_MAX, MAX(2, atoll(large_count_env)));
+      large_count_block = (large_count_limit + 1) / 2;
+    }
+#if MPI_VERSION >= 3
+    const char *chunk_size = getenv("OPENCOARRAYS_SENDGET_CHUNK_SIZE");
+    if (chunk_size != NULL)
+      sendget_chunk_size = MIN(INT_MAX, MAX(1, atoll(chunk_size)));
+    const char *put_combining = getenv("OPENCOARRAYS_PUT_COMBINING");
+    if (put_combining != NULL)
+      combine_size = MIN(INT_MAX, MAX(0, atoll(put_combining)));
+#endif
+    const char *event_spin_env = getenv("OPENCOARRAYS_EVENT_SPIN");
+    if (event_spin_env != NULL)
+      event_spin = MAX(0, atoi(event_spin_env));
 
     /* BEGIN SYNC IMAGE preparation
      * Prepare memory for syncing images. */
@@ -890,8 +3150,22 @@ PREFIX(init) (int *argc, char ***argv)
 
     arrived = calloc(caf_num_images, sizeof(int));
     sync_handles = malloc(caf_num_images * sizeof(MPI_Request));
+    sync_send_handles = malloc(caf_num_images * sizeof(MPI_Request));
+    sync_done = malloc(caf_num_images * sizeof(int));
+    sync_images_seen = calloc(caf_num_images, sizeof(int));
     /* END SYNC IMAGE preparation. */
 
+    /* Event posts notify the waiting image on a communicator of their own,
+     * so that they are not mistaken for other messages. */
+    ierr = MPI_Comm_dup(CAF_COMM_WORLD, &event_comm); chk_err(ierr);
+    event_team = CAF_COMM_WORLD;
+    event_team_ranks = (int *) malloc(caf_num_images * sizeof(int));
+    for (i = 0; i < caf_num_images; ++i)
+      event_team_ranks[i] = i;
+#ifdef CAF_NODE_SHARED_MEMORY
+    init_event_words();
+#endif
+
     stat_tok = malloc(sizeof(MPI_Win));
 
     teams_list = (caf_teams_list *)calloc(1, sizeof(caf_teams_list));
@@ -936,6 +3210,10 @@ PREFIX(init) (int *argc, char ***argv)
     ierr = MPI_Win_create(&img_status, sizeof(int), 1, mpi_info_same_size,
                           CAF_COMM_WORLD, stat_tok); chk_err(ierr);
     CAF_Win_lock_all(*stat_tok);
+#ifndef WITH_FAILED_IMAGES
+    init_lock_nodes();
+#endif
+    init_event_sleep_words();
 #else
     ierr = MPI_Win_create(&img_status, sizeof(int), 1, MPI_INFO_NULL,
                           CAF_COMM_WORLD, stat_tok); chk_err(ierr);
@@ -971,6 +3249,13 @@ finalize_internal(int status_code)
   int ierr;
   dprint("(status_code = %d)\n", status_code);
 
+#if MPI_VERSION >= 3
+  complete_async(-1, MPI_WIN_NULL);
+  free_combine_bufs();
+  free(async_requests);
+  async_requests = NULL;
+  async_requests_cap = 0;
+#endif
 #ifdef WITH_FAILED_IMAGES
   no_stopped_images_check_in_errhandler = true;
   ierr = MPI_Win_flush_all(*stat_tok); chk_err(ierr);
@@ -1041,7 +3326,7 @@ finalize_internal(int status_code)
   while (cur_stok)
   {
     prev_stok = cur_stok->prev;
-    ierr = MPI_Win_detach(global_dynamic_win, cur_stok); chk_err(ierr);
+    ierr = MPI_Win_detach(global_dynamic_win, cur_stok->token); chk_err(ierr);
     if (cur_stok->token->memptr)
     {
       ierr = MPI_Win_detach(global_dynamic_win, cur_stok->token->memptr);
@@ -1057,6 +3342,12 @@ finalize_internal(int status_code)
 #endif
 
   dprint("Freed all slave tokens.\n");
+  free_datatype_cache();
+  free_sync_plans();
+#ifdef GCC_GE_7
+  free_ref_plan();
+#endif
+  free_staging_arena();
   struct caf_allocated_tokens_t
     *cur_tok = caf_allocated_tokens,
     *prev = caf_allocated_tokens;
@@ -1071,7 +3362,11 @@ finalize_internal(int status_code)
 #ifdef GCC_GE_7
     /* Unregister the window to the descriptors when freeing the token. */
     dprint("MPI_Win_free(%p)\n", p);
+#ifdef CAF_NODE_SHARED_MEMORY
+    free_token_windows((mpi_caf_token_t *) cur_tok->token);
+#else
     ierr = MPI_Win_free(p); chk_err(ierr);
+#endif
     free(cur_tok->token);
 #else // GCC_GE_7
     ierr = MPI_Win_free(p); chk_err(ierr);
@@ -1080,11 +3375,27 @@ finalize_internal(int status_code)
     cur_tok = prev;
   }
 #if MPI_VERSION >= 3
+  free_event_sleep_words();
+#endif
+  ierr = MPI_Comm_free(&event_comm); chk_err(ierr);
+  free(event_team_ranks);
+  event_team_ranks = NULL;
+#if MPI_VERSION >= 3
+#ifndef WITH_FAILED_IMAGES
+  free_lock_nodes();
+#endif
   ierr = MPI_Info_free(&mpi_info_same_size); chk_err(ierr);
 #endif // MPI_VERSION
+#ifdef CAF_NODE_SHARED_MEMORY
+  free_event_words();
+  free_node_map();
+#endif
 
   /* Free the global dynamic window. */
   ierr = MPI_Win_free(&global_dynamic_win); chk_err(ierr);
+  /* The remaining windows only need their tables freed with them. */
+  ierr = MPI_Win_free_keyval(&win_rank_keyval); chk_err(ierr);
+  ierr = MPI_Win_free_keyval(&dirty_win_keyval); chk_err(ierr);
 #ifdef WITH_FAILED_IMAGES
   if (status_code == 0)
   {
@@ -1122,6 +3433,9 @@ finalize_internal(int status_code)
   caf_is_finalized = 1;
   pthread_mutex_unlock(&lock_am);
   free(sync_handles);
+  free(sync_send_handles);
+  free(sync_done);
+  free(sync_images_seen);
   dprint("Finalisation done!!!\n");
 }
 
@@ -1150,6 +3464,26 @@ PREFIX(num_images) (int distance __attribute__((unused)),
   return caf_num_images;
 }
 
+/* Add token to the list of registered coarrays. */
+static void
+add_allocated_token(caf_token_t token)
+{
+  struct caf_allocated_tokens_t *tmp =
+         malloc(sizeof(struct caf_allocated_tokens_t));
+  MPI_Win win = *TOKEN(token);
+  MPI_Aint *size;
+  char *base;
+  int flag, ierr;
+
+  ierr = MPI_Win_get_attr(win, MPI_WIN_BASE, &base, &flag); chk_err(ierr);
+  tmp->base = flag ? base : NULL;
+  ierr = MPI_Win_get_attr(win, MPI_WIN_SIZE, &size, &flag); chk_err(ierr);
+  tmp->size = flag ? *size : 0;
+  tmp->prev  = caf_allocated_tokens;
+  tmp->token = token;
+  caf_allocated_tokens = tmp;
+}
+
 #ifdef GCC_GE_7
 /* Register an object with the coarray library creating a token where
  * necessary/requested.
@@ -1177,8 +3511,12 @@ PREFIX(register) (size_t size, caf_register_t type, caf_token_t *token,
     PREFIX(init) (NULL, NULL);
 
   if (type == CAF_REGTYPE_LOCK_STATIC || type == CAF_REGTYPE_LOCK_ALLOC ||
-      type == CAF_REGTYPE_CRITICAL || type == CAF_REGTYPE_EVENT_STATIC ||
-      type == CAF_REGTYPE_EVENT_ALLOC)
+      type == CAF_REGTYPE_CRITICAL)
+  {
+    actual_size = size * CAF_LOCK_STRIDE;
+    l_var = 1;
+  }
+  else if (type == CAF_REGTYPE_EVENT_STATIC || type == CAF_REGTYPE_EVENT_ALLOC)
   {
     actual_size = size * sizeof(int);
     l_var = 1;
@@ -1265,7 +3603,16 @@ PREFIX(register) (size_t size, caf_register_t type, caf_token_t *token,
         mpi_token = (mpi_caf_token_t *) (*token);
         p = TOKEN(mpi_token);
 
-#if MPI_VERSION >= 3
+#ifdef CAF_NODE_SHARED_MEMORY
+        if (node_comm != MPI_COMM_NULL && CAF_COMM_WORLD == node_world)
+          mem = allocate_node_shared(actual_size, mpi_token);
+        else
+        {
+          ierr = MPI_Win_allocate(actual_size, 1, MPI_INFO_NULL,
+                                  CAF_COMM_WORLD, &mem, p); chk_err(ierr);
+        }
+        CAF_Win_lock_all(*p);
+#elif MPI_VERSION >= 3
         ierr = MPI_Win_allocate(actual_size, 1, MPI_INFO_NULL, CAF_COMM_WORLD,
                                 &mem, p); chk_err(ierr);
         CAF_Win_lock_all(*p);
@@ -1282,19 +3629,18 @@ PREFIX(register) (size_t size, caf_register_t type, caf_token_t *token,
 
         if (l_var)
         {
-          init_array = (int *)calloc(size, sizeof(int));
+          init_array = (int *)calloc(actual_size, 1);
           CAF_Win_lock(MPI_LOCK_EXCLUSIVE, caf_this_image - 1, *p);
-          ierr = MPI_Put(init_array, size, MPI_INT, caf_this_image - 1, 0, size,
-                         MPI_INT, *p); chk_err(ierr);
+          ierr = MPI_Put(init_array, actual_size, MPI_BYTE, caf_this_image - 1,
+                         0, actual_size, MPI_BYTE, *p); chk_err(ierr);
           CAF_Win_unlock(caf_this_image - 1, *p);
           free(init_array);
+          /* No image may post or lock before the variables are zeroed on
+           * every image. */
+          PREFIX(sync_all) (NULL, NULL, 0);
         }
 
-        struct caf_allocated_tokens_t *tmp =
-            malloc(sizeof(struct caf_allocated_tokens_t));
-        tmp->prev  = caf_allocated_tokens;
-        tmp->token = *token;
-        caf_allocated_tokens = tmp;
+        add_allocated_token(*token);
 
         if (stat)
           *stat = 0;
@@ -1360,8 +3706,12 @@ PREFIX(register) (size_t size, caf_register_t type, caf_token_t *token,
   MPI_Win *p = *token;
 
   if (type == CAF_REGTYPE_LOCK_STATIC || type == CAF_REGTYPE_LOCK_ALLOC ||
-      type == CAF_REGTYPE_CRITICAL || type == CAF_REGTYPE_EVENT_STATIC ||
-      type == CAF_REGTYPE_EVENT_ALLOC)
+      type == CAF_REGTYPE_CRITICAL)
+  {
+    actual_size = size * CAF_LOCK_STRIDE;
+    l_var = 1;
+  }
+  else if (type == CAF_REGTYPE_EVENT_STATIC || type == CAF_REGTYPE_EVENT_ALLOC)
   {
     actual_size = size * sizeof(int);
     l_var = 1;
@@ -1381,21 +3731,17 @@ PREFIX(register) (size_t size, caf_register_t type, caf_token_t *token,
 
   if (l_var)
   {
-    init_array = (int *)calloc(size, sizeof(int));
+    init_array = (int *)calloc(actual_size, 1);
     CAF_Win_lock(MPI_LOCK_EXCLUSIVE, caf_this_image - 1, *p);
-    ierr = MPI_Put(init_array, size, MPI_INT, caf_this_image - 1, 0, size,
-                   MPI_INT, *p); chk_err(ierr);
+    ierr = MPI_Put(init_array, actual_size, MPI_BYTE, caf_this_image - 1, 0,
+                   actual_size, MPI_BYTE, *p); chk_err(ierr);
     CAF_Win_unlock(caf_this_image - 1, *p);
     free(init_array);
   }
 
   PREFIX(sync_all) (NULL, NULL, 0);
 
-  struct caf_allocated_tokens_t *tmp =
-         malloc(sizeof(struct caf_allocated_tokens_t));
-  tmp->prev  = caf_allocated_tokens;
-  tmp->token = *token;
-  caf_allocated_tokens = tmp;
+  add_allocated_token(*token);
 
   if (stat)
     *stat = 0;
@@ -1465,6 +3811,9 @@ PREFIX(deregister) (caf_token_t *token, int *stat, char *errmsg,
   if (stat)
     *stat = 0;
 
+  /* Cached remote pointers may refer to the memory freed now. */
+  invalidate_remote_meta();
+
 #ifdef GCC_GE_7
   if (type != CAF_DEREGTYPE_COARRAY_DEALLOCATE_ONLY)
   {
@@ -1494,9 +3843,17 @@ PREFIX(deregister) (caf_token_t *token, int *stat, char *errmsg,
 #ifdef GCC_GE_7
         dprint("Found regular token %p for memptr_win: %d.\n",
                *token, ((mpi_caf_token_t *)*token)->memptr_win);
+#endif
+#if MPI_VERSION >= 3
+        complete_async(-1, *p);
+        flush_all_combined(p);
 #endif
         CAF_Win_unlock_all(*p);
+#ifdef CAF_NODE_SHARED_MEMORY
+        free_token_windows((mpi_caf_token_t *) *token);
+#else
         ierr = MPI_Win_free(p); chk_err(ierr);
+#endif
 
         next->prev = prev ? prev->prev:  NULL;
 
@@ -1573,9 +3930,7 @@ PREFIX(sync_memory) (int *stat __attribute__((unused)),
                      char *errmsg __attribute__((unused)),
                      charlen_t errmsg_len __attribute__((unused)))
 {
-#if defined(NONBLOCKING_PUT) && !defined(CAF_MPI_LOCK_UNLOCK)
   explicit_flush();
-#endif
 }
 
 
@@ -1591,9 +3946,7 @@ PREFIX(sync_all) (int *stat, char *errmsg, charlen_t errmsg_len)
   }
   else
   {
-#if defined(NONBLOCKING_PUT) && !defined(CAF_MPI_LOCK_UNLOCK)
     explicit_flush();
-#endif
 
 #ifdef WITH_FAILED_IMAGES
     ierr = MPI_Barrier(alive_comm); chk_err(ierr);
@@ -1935,12 +4288,120 @@ error:
     abort();
 }
 
+/* Bulk converters between the integer and real kinds, that have a C type.
+ * They convert num contiguous elements in one loop simple enough for the
+ * compiler to vectorize, instead of dispatching on the types and kinds for
+ * every element like convert_type() does.  The result is the same as the one
+ * of convert_type(), whose intermediates hold every value of these kinds. */
+
+typedef void (*convert_kernel_t)(void *restrict, const void *restrict, size_t);
+
+#define CONVERT_KERNEL(dname, dtype, sname, stype)                      \
+static void                                                             \
+convert_##sname##_to_##dname(void *restrict dst,                        \
+                             const void *restrict src, size_t num)      \
+{                                                                       \
+  dtype *restrict d = dst;                                              \
+  const stype *restrict s = src;                                        \
+  for (size_t i = 0; i < num; ++i)                                      \
+    d[i] = (dtype) s[i];                                                \
+}
+
+#define CONVERT_KERNELS_FROM(sname, stype)                              \
+  CONVERT_KERNEL(i1, int8_t, sname, stype)                              \
+  CONVERT_KERNEL(i2, int16_t, sname, stype)                             \
+  CONVERT_KERNEL(i4, int32_t, sname, stype)                             \
+  CONVERT_KERNEL(i8, int64_t, sname, stype)                             \
+  CONVERT_KERNEL(r4, float, sname, stype)                               \
+  CONVERT_KERNEL(r8, double, sname, stype)
+
+CONVERT_KERNELS_FROM(i1, int8_t)
+CONVERT_KERNELS_FROM(i2, int16_t)
+CONVERT_KERNELS_FROM(i4, int32_t)
+CONVERT_KERNELS_FROM(i8, int64_t)
+CONVERT_KERNELS_FROM(r4, float)
+CONVERT_KERNELS_FROM(r8, double)
+
+#define CONVERT_KERNEL_ROW(dname)                                       \
+  { convert_i1_to_##dname, convert_i2_to_##dname, convert_i4_to_##dname, \
+    convert_i8_to_##dname, convert_r4_to_##dname, convert_r8_to_##dname }
+
+/* Indexed by the destination and then by the source type and kind, see
+ * convert_kernel_index(). */
+static const convert_kernel_t convert_kernels[6][6] = {
+  CONVERT_KERNEL_ROW(i1), CONVERT_KERNEL_ROW(i2), CONVERT_KERNEL_ROW(i4),
+  CONVERT_KERNEL_ROW(i8), CONVERT_KERNEL_ROW(r4), CONVERT_KERNEL_ROW(r8)
+};
+
+#undef CONVERT_KERNEL_ROW
+#undef CONVERT_KERNELS_FROM
+#undef CONVERT_KERNEL
+
+static int
+convert_kernel_index(int type, int kind)
+{
+  if (type == BT_INTEGER)
+  {
+    switch (kind)
+    {
+      case 1: return 0;
+      case 2: return 1;
+      case 4: return 2;
+      case 8: return 3;
+    }
+  }
+  else if (type == BT_REAL)
+  {
+    switch (kind)
+    {
+      case 4: return 4;
+      case 8: return 5;
+    }
+  }
+  return -1;
+}
+
+/* Return the bulk converter for the types and kinds, or NULL when the
+ * conversion has to be done by convert_type(). */
+
+static convert_kernel_t
+select_convert_kernel(int dst_type, int dst_kind, int src_type, int src_kind)
+{
+  const int
+    dst_index = convert_kernel_index(dst_type, dst_kind),
+    src_index = convert_kernel_index(src_type, src_kind);
+
+  if (dst_index < 0 || src_index < 0)
+    return NULL;
+  return convert_kernels[dst_index][src_index];
+}
+
 static void
 convert_with_strides(void *dst, int dst_type, int dst_kind,
                      ptrdiff_t byte_dst_stride,
                      void *src, int src_type, int src_kind,
                      ptrdiff_t byte_src_stride, size_t num, int *stat)
 {
+  const convert_kernel_t kernel =
+    select_convert_kernel(dst_type, dst_kind, src_type, src_kind);
+
+  if (kernel != NULL && num > 0 && byte_dst_stride == dst_kind)
+  {
+    if (byte_src_stride == src_kind)
+    {
+      kernel(dst, src, num);
+      return;
+    }
+    else if (byte_src_stride == 0)
+    {
+      /* Convert the scalar once and replicate it. */
+      kernel(dst, src, 1);
+      for (size_t i = 1; i < num; ++i)
+        memcpy((char *)dst + i * dst_kind, dst, dst_kind);
+      return;
+    }
+  }
+
   /* Compute the step from one item to convert to the next in bytes. The stride
    * is expected to be the one or similar to the array.stride, i.e. *_stride is
    * expected to be >= 1 to progress from one item to the next. */
@@ -2020,27 +4481,155 @@ copy_char_to_self(void *src, int src_type, int src_size, int src_kind,
   }
 }
 
+/* Convert num elements stored contiguously at src into the contiguous dst,
+ * padding or truncating characters.  A src_is_scalar src is replicated. */
+
 static void
-copy_to_self(gfc_descriptor_t *src, int src_kind,
-              gfc_descriptor_t *dest, int dst_kind, size_t size, int *stat)
+convert_elements(void *dst, int dst_type, int dst_kind, size_t dst_size,
+                 void *src, int src_type, int src_kind, size_t src_size,
+                 size_t num, bool src_is_scalar, int *stat)
 {
-#ifdef GFC_CAF_CHECK
-  if (GFC_DESCRIPTOR_TYPE(dest) == BT_CHARACTER
-      || GFC_DESCRIPTOR_TYPE(src) == BT_CHARACTER)
-    caf_runtime_error("internal error: copy_to_self() for char types called.");
+  size_t i;
+
+  if (dst_type == BT_CHARACTER)
+    copy_char_to_self(src, src_type, src_size, src_kind,
+                      dst, dst_type, dst_size, dst_kind, num, src_is_scalar);
+  else if (dst_type == src_type && dst_kind == src_kind && !src_is_scalar)
+    memcpy(dst, src, dst_size * num);
+  else if (dst_type == src_type && dst_kind == src_kind)
+    for (i = 0; i < num; ++i)
+      memcpy((char *)dst + i * dst_size, src, dst_size);
+  else
+    convert_with_strides(dst, dst_type, dst_kind, dst_size,
+                         src, src_type, src_kind,
+                         src_is_scalar ? 0 : src_size, num, stat);
+}
+
+/* Return the offset in elements of the i-th element of desc in array element
+ * order. */
+
+static ptrdiff_t
+element_offset(gfc_descriptor_t *desc, size_t i)
+{
+  const int rank = GFC_DESCRIPTOR_RANK(desc);
+  ptrdiff_t offset = 0, extent, tot_ext = 1;
+  int j;
+
+  if (rank == 0)
+    return 0;
+  for (j = 0; j < rank - 1; ++j)
+  {
+    extent = desc->dim[j]._ubound - desc->dim[j].lower_bound + 1;
+    offset += ((i / tot_ext) % extent) * desc->dim[j]._stride;
+    tot_ext *= extent;
+  }
+  return offset + (i / tot_ext) * desc->dim[rank - 1]._stride;
+}
+
+/* Return the offset in elements of the i-th element of desc addressed by
+ * vector, or in array element order when vector is NULL. */
+
+static ptrdiff_t
+vector_element_offset(gfc_descriptor_t *desc, caf_vector_t *vector, size_t i)
+{
+  ptrdiff_t index;
+
+  if (vector == NULL)
+    return element_offset(desc, i);
+  switch (vector->u.v.kind)
+  {
+#define KINDCASE(kind, type)                      \
+case kind:                                        \
+  index = ((type *)vector->u.v.vector)[i];        \
+  break
+    KINDCASE(1, int8_t);
+    KINDCASE(2, int16_t);
+    KINDCASE(4, int32_t);
+    KINDCASE(8, int64_t);
+#ifdef HAVE_GFC_INTEGER_16
+    KINDCASE(16, __int128);
 #endif
-  /* The address of dest passed by the compiler points on the right
-   * memory location. No offset summation is needed. */
-  if (dst_kind == src_kind)
-    memmove(dest->base_addr, src->base_addr, size * GFC_DESCRIPTOR_SIZE(dest));
+#undef KINDCASE
+    default:
+      caf_runtime_error(unreachable);
+      return 0;
+  }
+  return (index - desc->dim[0].lower_bound) * desc->dim[0]._stride;
+}
+
+/* Convert the size elements of src addressed by src_vector into the
+ * contiguous dst.  A scalar src is replicated.  src is accessed directly, it
+ * is on this image or shared with it. */
+
+static void
+pack_local(void *dst, int dst_type, int dst_kind, size_t dst_size,
+           gfc_descriptor_t *src, caf_vector_t *src_vector, int src_kind,
+           size_t size, int *stat)
+{
+  const size_t src_size = GFC_DESCRIPTOR_SIZE(src);
+  const int src_rank = GFC_DESCRIPTOR_RANK(src);
+  void *packed = src->base_addr, *buff = NULL;
+  size_t i;
+
+  if (src_rank != 0 && (src_vector != NULL || !PREFIX(is_contiguous) (src)))
+  {
+    packed = buff = staging_alloc(src_size * size);
+    for (i = 0; i < size; ++i)
+      memcpy((char *)buff + i * src_size,
+             (char *)src->base_addr
+               + vector_element_offset(src, src_vector, i) * src_size,
+             src_size);
+  }
+  convert_elements(dst, dst_type, dst_kind, dst_size,
+                   packed, GFC_DESCRIPTOR_TYPE(src), src_kind, src_size,
+                   size, src_rank == 0, stat);
+  if (buff != NULL)
+    staging_free(buff);
+}
+
+/* Store the size contiguous elements at src to the elements of dest addressed
+ * by dst_vector.  dest is accessed directly. */
+
+static void
+unpack_local(gfc_descriptor_t *dest, caf_vector_t *dst_vector, void *src,
+             size_t size)
+{
+  const size_t dst_size = GFC_DESCRIPTOR_SIZE(dest);
+  size_t i;
+
+  if (dst_vector == NULL && PREFIX(is_contiguous) (dest))
+    memmove(dest->base_addr, src, dst_size * size);
   else
-    /* When the rank is 0 then a scalar is copied to a vector and the stride
-     * is zero. */
-    convert_with_strides(dest->base_addr, GFC_DESCRIPTOR_TYPE(dest), dst_kind,
-                         GFC_DESCRIPTOR_SIZE(dest), src->base_addr,
-                         GFC_DESCRIPTOR_TYPE(src), src_kind,
-                         (GFC_DESCRIPTOR_RANK(src) > 0)
-                         ? GFC_DESCRIPTOR_SIZE(src) : 0, size, stat);
+    for (i = 0; i < size; ++i)
+      memcpy((char *)dest->base_addr
+               + vector_element_offset(dest, dst_vector, i) * dst_size,
+             (char *)src + i * dst_size, dst_size);
+}
+
+/* Copy the size elements of src to dest, converting them.  Both are accessed
+ * directly.  When they may overlap (mrt), the elements are converted into a
+ * temporary first. */
+
+static void
+copy_local(gfc_descriptor_t *dest, caf_vector_t *dst_vector, int dst_kind,
+           gfc_descriptor_t *src, caf_vector_t *src_vector, int src_kind,
+           size_t size, bool mrt, int *stat)
+{
+  const size_t dst_size = GFC_DESCRIPTOR_SIZE(dest);
+  const int dst_type = GFC_DESCRIPTOR_TYPE(dest);
+  void *buff;
+
+  if (!mrt && dst_vector == NULL && PREFIX(is_contiguous) (dest))
+  {
+    pack_local(dest->base_addr, dst_type, dst_kind, dst_size,
+               src, src_vector, src_kind, size, stat);
+    return;
+  }
+  buff = staging_alloc(dst_size * size);
+  pack_local(buff, dst_type, dst_kind, dst_size, src, src_vector, src_kind,
+             size, stat);
+  unpack_local(dest, dst_vector, buff, size);
+  staging_free(buff);
 }
 
 /* token: The token of the array to be written to. 
@@ -2052,6 +4641,9 @@ copy_to_self(gfc_descriptor_t *src, int src_kind,
  * size: The number of bytes to be transferred. 
  * asynchronous: Return before the data transfer has been complete */
 
+/* Select the integer datatype of size bytes for the atomic variables, which
+ * are of integer or logical type. */
+
 void selectType(int size, MPI_Datatype *dt)
 {
   int t_s;
@@ -2063,16 +4655,93 @@ if (t_s == size)                                  \
   return;                                         \
 }
 
-  SELTYPE(MPI_BYTE)
-  SELTYPE(MPI_SHORT)
-  SELTYPE(MPI_INT)
-  SELTYPE(MPI_DOUBLE)
-  SELTYPE(MPI_COMPLEX)
-  SELTYPE(MPI_DOUBLE_COMPLEX)
+  SELTYPE(MPI_INT8_T)
+  SELTYPE(MPI_INT16_T)
+  SELTYPE(MPI_INT32_T)
+  SELTYPE(MPI_INT64_T)
 
 #undef SELTYPE
 }
 
+#if MPI_VERSION >= 3
+/* Copy size contiguous elements from rank src_rank of win_g to rank dst_rank
+ * of win_s in chunks of sendget_chunk_size bytes, converting them when the
+ * types or kinds differ.  Two staging slots are used in turns, so that the
+ * MPI_Rget of chunk k + 1 is in flight while chunk k is converted and put
+ * with MPI_Rput, and no more than two chunks are buffered at any time.
+ * Only used in a lock_all epoch: with per-target locks the source would stay
+ * locked while the lock on the destination is acquired, and two images
+ * copying in opposite directions between the same pair would deadlock. */
+
+static int
+pipelined_sendget(MPI_Win win_s, int dst_rank, size_t offset_s,
+                  int dst_type, int dst_kind, size_t dst_size,
+                  MPI_Win win_g, int src_rank, size_t offset_g,
+                  int src_type, int src_kind, size_t src_size,
+                  size_t size, int *stat)
+{
+  const bool convert = dst_type != src_type || dst_kind != src_kind;
+  const size_t
+    chunk = MAX(1, sendget_chunk_size / MAX(src_size, dst_size)),
+    nchunks = (size + chunk - 1) / chunk,
+    slot_size = chunk * (src_size + (convert ? dst_size : 0));
+  char *buff = staging_alloc(2 * slot_size);
+  MPI_Request
+    get_req[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL},
+    put_req[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+  size_t k;
+  int ierr, wait_ierr;
+
+  dprint("Pipelining sendget of %zd elements in %zd chunks.\n",
+         size, nchunks);
+  CAF_Win_lock_get(src_rank, offset_g, src_size * size, win_g);
+  CAF_Win_lock_put(dst_rank, offset_s, dst_size * size, win_s);
+  ierr = MPI_Rget(buff, MIN(chunk, size) * src_size, MPI_BYTE, src_rank,
+                  offset_g, MIN(chunk, size) * src_size, MPI_BYTE, win_g,
+                  &get_req[0]); chk_err(ierr);
+  for (k = 0; k < nchunks && ierr == MPI_SUCCESS; ++k)
+  {
+    const int slot = k % 2;
+    const size_t num = MIN(chunk, size - k * chunk);
+    char
+      *src_buff = buff + slot * slot_size,
+      *dst_buff = convert ? src_buff + chunk * src_size : src_buff;
+
+    ierr = MPI_Wait(&get_req[slot], MPI_STATUS_IGNORE); chk_err(ierr);
+    if (k + 1 < nchunks)
+    {
+      /* The other slot is free again, once the put of chunk k - 1 from it
+       * has completed locally. */
+      const size_t next_num = MIN(chunk, size - (k + 1) * chunk);
+      ierr = MPI_Wait(&put_req[1 - slot], MPI_STATUS_IGNORE); chk_err(ierr);
+      ierr = MPI_Rget(buff + (1 - slot) * slot_size, next_num * src_size,
+                      MPI_BYTE, src_rank,
+                      offset_g + (k + 1) * chunk * src_size,
+                      next_num * src_size, MPI_BYTE, win_g,
+                      &get_req[1 - slot]); chk_err(ierr);
+    }
+    if (convert)
+      convert_with_strides(dst_buff, dst_type, dst_kind, dst_size,
+                           src_buff, src_type, src_kind, src_size, num, stat);
+    ierr = MPI_Rput(dst_buff, num * dst_size, MPI_BYTE, dst_rank,
+                    offset_s + k * chunk * dst_size, num * dst_size,
+                    MPI_BYTE, win_s, &put_req[slot]); chk_err(ierr);
+  }
+  /* Complete the requests still in flight also after an error, but report
+   * the first error. */
+  wait_ierr = MPI_Waitall(2, get_req, MPI_STATUSES_IGNORE); chk_err(wait_ierr);
+  if (ierr == MPI_SUCCESS)
+    ierr = wait_ierr;
+  wait_ierr = MPI_Waitall(2, put_req, MPI_STATUSES_IGNORE); chk_err(wait_ierr);
+  if (ierr == MPI_SUCCESS)
+    ierr = wait_ierr;
+  CAF_Win_unlock_put(dst_rank, offset_s, dst_size * size, win_s);
+  CAF_Win_unlock_local(src_rank, win_g);
+  staging_free(buff);
+  return ierr;
+}
+#endif // MPI_VERSION
+
 void
 PREFIX(sendget) (caf_token_t token_s, size_t offset_s, int image_index_s,
                  gfc_descriptor_t *dest, caf_vector_t *dst_vector,
@@ -2081,7 +4750,7 @@ PREFIX(sendget) (caf_token_t token_s, size_t offset_s, int image_index_s,
                  int dst_kind, int src_kind, bool mrt, int *pstat)
 {
   int j, ierr = 0;
-  size_t i, size;
+  size_t size;
   ptrdiff_t dimextent;
   const int
     src_rank = GFC_DESCRIPTOR_RANK(src),
@@ -2101,7 +4770,6 @@ PREFIX(sendget) (caf_token_t token_s, size_t offset_s, int image_index_s,
     same_type_and_kind = dst_type == src_type && dst_kind == src_kind;
 
   MPI_Win *p = TOKEN(token_g);
-  ptrdiff_t src_offset = 0, dst_offset = 0;
   void *pad_str = NULL;
   bool free_pad_str = false;
   void *src_t_buff = NULL, *dst_t_buff = NULL;
@@ -2113,27 +4781,9 @@ PREFIX(sendget) (caf_token_t token_s, size_t offset_s, int image_index_s,
     dst_remote_image = image_index_s - 1;
 
   if (!src_same_image)
-  {
-    MPI_Group current_team_group, win_group;
-    ierr = MPI_Comm_group(CAF_COMM_WORLD, &current_team_group); chk_err(ierr);
-    ierr = MPI_Win_get_group(*p, &win_group); chk_err(ierr);
-    ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                     (int[]){src_remote_image}, win_group,
-                                     &src_remote_image); chk_err(ierr);
-    ierr = MPI_Group_free(&current_team_group); chk_err(ierr);
-    ierr = MPI_Group_free(&win_group); chk_err(ierr);
-  }
+    src_remote_image = translate_rank(*p, src_remote_image);
   if (!dst_same_image)
-  {
-    MPI_Group current_team_group, win_group;
-    ierr = MPI_Comm_group(CAF_COMM_WORLD, &current_team_group); chk_err(ierr);
-    ierr = MPI_Win_get_group(*p, &win_group); chk_err(ierr);
-    ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                     (int[]){dst_remote_image}, win_group,
-                                     &dst_remote_image); chk_err(ierr);
-    ierr = MPI_Group_free(&current_team_group); chk_err(ierr);
-    ierr = MPI_Group_free(&win_group); chk_err(ierr);
-  }
+    dst_remote_image = translate_rank(*TOKEN(token_s), dst_remote_image);
 
   /* Ensure stat is always set. */
 #ifdef GCC_GE_7
@@ -2145,6 +4795,31 @@ PREFIX(sendget) (caf_token_t token_s, size_t offset_s, int image_index_s,
   int * stat = NULL;
 #endif
 
+#ifdef CAF_NODE_SHARED_MEMORY
+  /* The memory of images on this node is accessed like that of this image. */
+  {
+    gfc_max_dim_descriptor_t node_src, node_dest;
+    void *src_mem = src_same_image
+      ? NULL : node_address(token_g, image_index_g, offset_g);
+    void *dst_mem = dst_same_image
+      ? NULL : node_address(token_s, image_index_s, offset_s);
+
+    if (src_mem != NULL || dst_mem != NULL)
+    {
+      PREFIX(sendget) (token_s, offset_s,
+                       dst_mem ? caf_this_image : image_index_s,
+                       dst_mem ? rebase_descriptor(&node_dest, dest, dst_mem)
+                               : dest, dst_vector,
+                       token_g, offset_g,
+                       src_mem ? caf_this_image : image_index_g,
+                       src_mem ? rebase_descriptor(&node_src, src, src_mem)
+                               : src, src_vector,
+                       dst_kind, src_kind, mrt, pstat);
+      return;
+    }
+  }
+#endif // CAF_NODE_SHARED_MEMORY
+
   size = 1;
   for (j = 0; j < dst_rank; ++j)
   {
@@ -2164,6 +4839,28 @@ PREFIX(sendget) (caf_token_t token_s, size_t offset_s, int image_index_s,
   check_image_health(image_index_g, stat);
   check_image_health(image_index_s, stat);
 
+#if MPI_VERSION >= 3
+  /* Stream large contiguous copies between two other images through a
+   * bounded pipeline instead of a temporary of the whole array, when the
+   * lock_all epoch spares locking both images at once.  Source and
+   * destination in the same window at the same image may overlap, so they
+   * take the path below. */
+  if (caf_lock_all_epoch && !src_same_image && !dst_same_image
+      && src_contiguous && src_vector == NULL && src_rank > 0
+      && dst_contiguous && dst_vector == NULL
+      && (dst_type != BT_CHARACTER
+          || (same_type_and_kind && dst_size == src_size))
+      && size * MAX(src_size, dst_size) > sendget_chunk_size
+      && (*p != *TOKEN(token_s) || src_remote_image != dst_remote_image))
+  {
+    ierr = pipelined_sendget(*TOKEN(token_s), dst_remote_image, offset_s,
+                             dst_type, dst_kind, dst_size,
+                             *p, src_remote_image, offset_g,
+                             src_type, src_kind, src_size, size, stat);
+    goto done;
+  }
+#endif // MPI_VERSION
+
   /* For char arrays: create the padding array, when dst is longer than src. */
   if (dest_char_array_is_longer)
   {
@@ -2192,234 +4889,99 @@ PREFIX(sendget) (caf_token_t token_s, size_t offset_s, int image_index_s,
     }
   }
 
-  if (src_contiguous && src_vector == NULL)
+  if (src_same_image)
   {
-    if (src_same_image)
-    {
-      dprint("in caf_this == image_index, size = %zd, "
-             "dst_kind = %d, src_kind = %d, dst_size = %zd, src_size = %zd\n",
-             size, dst_kind, src_kind, dst_size, src_size);
-      src_t_buff = src->base_addr;
-      if (same_type_and_kind && !dest_char_array_is_longer)
-      {
-        dst_t_buff = src_t_buff;
-      }
-      else
-      {
-        dprint("allocating %zd bytes for dst_t_buff.\n", dst_size * size);
-        if ((free_dst_t_buff = ((dst_t_buff = alloca(dst_size * size)) == NULL)))
-        {
-          dst_t_buff = malloc(dst_size * size);
-          if (dst_t_buff == NULL)
-            caf_runtime_error("Unable to allocate memory "
-                              "for internal buffer in sendget().");
-        }
-        if (dst_type == BT_CHARACTER)
-        {
-          /* The size is encoded in the descriptor's type for char arrays. */
-          copy_char_to_self(src->base_addr, src_type, src_size, src_kind,
-                            dst_t_buff, dst_type, dst_size, dst_kind,
-                            size, src_rank == 0);
-        }
-        else
-        {
-          convert_with_strides(dst_t_buff, dst_type, dst_kind, dst_size,
-                               src->base_addr, src_type, src_kind,
-                               (src_rank > 0) ? src_size : 0, size, stat);
-        }
-      }
-    }
+    if (src_contiguous && src_vector == NULL && src_rank > 0
+        && same_type_and_kind && !dest_char_array_is_longer)
+      dst_t_buff = src->base_addr;
     else
     {
-      /* When replication is needed, only access the scalar on the remote. */
-      const size_t src_real_size = src_rank > 0 ?
-        (src_size * size) : src_size;
-      if ((free_dst_t_buff = ((dst_t_buff = alloca(dst_size * size)) == NULL)))
-      {
-        dst_t_buff = malloc(dst_size * size);
-        if (dst_t_buff == NULL)
-          caf_runtime_error("Unable to allocate memory "
-                            "for internal buffer in sendget().");
-      }
+      dst_t_buff = staging_alloc(dst_size * size);
+      free_dst_t_buff = true;
+      pack_local(dst_t_buff, dst_type, dst_kind, dst_size, src, src_vector,
+                 src_kind, size, stat);
+    }
+  }
+  else if (src_contiguous && src_vector == NULL)
+  {
+    /* When replication is needed, only access the scalar on the remote. */
+    const size_t src_real_size = src_rank > 0 ?
+      (src_size * size) : src_size;
+    dst_t_buff = staging_alloc(dst_size * size);
+    free_dst_t_buff = true;
 
-      if (dst_kind != src_kind || src_rank == 0 || dest_char_array_is_longer)
-      {
-        if ((free_src_t_buff = ((src_t_buff = alloca(src_size * size)) == NULL)))
-        {
-          src_t_buff = malloc(src_size * size);
-          if (src_t_buff == NULL)
-            caf_runtime_error("Unable to allocate memory "
-                              "for internal buffer in sendget().");
-        }
-      }
-      else
-        src_t_buff = dst_t_buff;
+    if (dst_kind != src_kind || src_rank == 0 || dest_char_array_is_longer)
+    {
+      src_t_buff = staging_alloc(src_size * size);
+      free_src_t_buff = true;
+    }
+    else
+      src_t_buff = dst_t_buff;
 
-      CAF_Win_lock(MPI_LOCK_SHARED, src_remote_image, *p);
-      if ((same_type_and_kind && dst_rank == src_rank)
-          || dst_type == BT_CHARACTER)
+    CAF_Win_lock_get(src_remote_image, offset_g, src_size * size, *p);
+    if ((same_type_and_kind && dst_rank == src_rank)
+        || dst_type == BT_CHARACTER)
+    {
+      if (!dest_char_array_is_longer
+          && (dst_kind == src_kind || dst_type != BT_CHARACTER))
       {
-        if (!dest_char_array_is_longer
-            && (dst_kind == src_kind || dst_type != BT_CHARACTER))
-        {
-          const size_t trans_size =
-            ((dst_size > src_size) ? src_size : dst_size) * size;
-          ierr = MPI_Get(dst_t_buff, trans_size, MPI_BYTE, src_remote_image,
-                         offset_g, trans_size, MPI_BYTE, *p); chk_err(ierr);
-        }
-        else
-        {
-          ierr = MPI_Get(src_t_buff, src_real_size, MPI_BYTE, src_remote_image,
-                         offset_g, src_real_size, MPI_BYTE, *p); chk_err(ierr);
-          dprint("copy_char_to_self(src_size = %zd, src_kind = %d, "
-                 "dst_size = %zd, dst_kind = %d, size = %zd)\n",
-                 src_size, src_kind, dst_size, dst_kind, size);
-          copy_char_to_self(src_t_buff, src_type, src_size, src_kind,
-                            dst_t_buff, dst_type, dst_size, dst_kind,
-                            size, src_rank == 0);
-          dprint("|%s|\n", (char *)dst_t_buff);
-        }
+        const size_t trans_size =
+          ((dst_size > src_size) ? src_size : dst_size) * size;
+        ierr = get_bytes(dst_t_buff, trans_size, src_remote_image, offset_g,
+                         *p); chk_err(ierr);
       }
       else
       {
-        ierr = MPI_Get(src_t_buff, src_real_size, MPI_BYTE, src_remote_image,
-                       offset_g, src_real_size, MPI_BYTE, *p); chk_err(ierr);
-        convert_with_strides(dst_t_buff, dst_type, dst_kind, dst_size,
-                             src_t_buff, src_type, src_kind,
-                             (src_rank > 0) ? src_size: 0, size, stat);
+        ierr = get_bytes(src_t_buff, src_real_size, src_remote_image,
+                         offset_g, *p); chk_err(ierr);
+        dprint("copy_char_to_self(src_size = %zd, src_kind = %d, "
+               "dst_size = %zd, dst_kind = %d, size = %zd)\n",
+               src_size, src_kind, dst_size, dst_kind, size);
+        copy_char_to_self(src_t_buff, src_type, src_size, src_kind,
+                          dst_t_buff, dst_type, dst_size, dst_kind,
+                          size, src_rank == 0);
+        dprint("|%s|\n", (char *)dst_t_buff);
       }
-      CAF_Win_unlock(src_remote_image, *p);
     }
+    else
+    {
+      ierr = get_bytes(src_t_buff, src_real_size, src_remote_image, offset_g,
+                       *p); chk_err(ierr);
+      convert_with_strides(dst_t_buff, dst_type, dst_kind, dst_size,
+                           src_t_buff, src_type, src_kind,
+                           (src_rank > 0) ? src_size: 0, size, stat);
+    }
+    CAF_Win_unlock_local(src_remote_image, *p);
   }
 #ifdef STRIDED
-  else if (!src_same_image && same_type_and_kind && dst_type != BT_CHARACTER)
+  else if (same_type_and_kind && dst_type != BT_CHARACTER)
   {
     /* For strided copy, no type and kind conversion, copy to self or
      * character arrays are supported. */
-    MPI_Datatype dt_s, dt_d, base_type_src, base_type_dst;
-    int *arr_bl;
-    int *arr_dsp_s;
-
-    if ((free_dst_t_buff = ((dst_t_buff = alloca(dst_size * size)) == NULL)))
-    {
-      dst_t_buff = malloc(dst_size * size);
-      if (dst_t_buff == NULL)
-        caf_runtime_error("Unable to allocate memory "
-                          "for internal buffer in sendget().");
-    }
+    MPI_Datatype dt_s, dt_d;
+    MPI_Aint dt_lb, dt_extent;
 
-    selectType(src_size, &base_type_src);
-    selectType(dst_size, &base_type_dst);
+    dst_t_buff = staging_alloc(dst_size * size);
+    free_dst_t_buff = true;
 
-    if (src_rank == 1)
+    if (src_vector != NULL)
     {
-      if (src_vector == NULL)
-      {
-        ierr = MPI_Type_vector(size, 1, src->dim[0]._stride, base_type_src,
-                               &dt_s); chk_err(ierr);
-      }
-      else
-      {
-        arr_bl = calloc(size, sizeof(int));
-        arr_dsp_s = calloc(size, sizeof(int));
-
-        dprint("Setting up strided vector index.\n");
-#define KINDCASE(kind, type)                                            \
-case kind:                                                              \
-  for (i = 0; i < size; ++i)                                            \
-  {                                                                     \
-    arr_dsp_s[i] = ((ptrdiff_t)                                         \
-      ((type *) src_vector->u.v.vector)[i] - src->dim[0].lower_bound);  \
-    arr_bl[i] = 1;                                                      \
-  }                                                                     \
-  break
-
-        switch (src_vector->u.v.kind)
-        {
-          KINDCASE(1, int8_t);
-          KINDCASE(2, int16_t);
-          KINDCASE(4, int32_t);
-          KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-          KINDCASE(16, __int128);
-#endif
-        default:
-          caf_runtime_error(unreachable);
-          return;
-        }
-#undef KINDCASE
-        ierr = MPI_Type_indexed(size, arr_bl, arr_dsp_s, base_type_src, &dt_s);
-        chk_err(ierr);
-        free(arr_bl);
-        free(arr_dsp_s);
-      }
-      ierr = MPI_Type_vector(size, 1, 1, base_type_dst, &dt_d); chk_err(ierr);
+      ierr = get_vector(dst_t_buff, src, src_vector, src_size, size,
+                        src_remote_image, offset_g, *p); chk_err(ierr);
     }
     else
     {
-      arr_bl = calloc(size, sizeof(int));
-      arr_dsp_s = calloc(size, sizeof(int));
-
-      for (i = 0; i < size; ++i)
-      {
-        arr_bl[i] = 1;
-      }
-
-      for (i = 0; i < size; ++i)
-      {
-        ptrdiff_t array_offset_sr = 0, extent = 1, tot_ext = 1;
-        if (src_vector == NULL)
-        {
-          for (j = 0; j < src_rank - 1; ++j)
-          {
-            extent = src->dim[j]._ubound - src->dim[j].lower_bound + 1;
-            array_offset_sr += ((i / tot_ext) % extent) * src->dim[j]._stride;
-            tot_ext *= extent;
-          }
-
-          array_offset_sr += (i / tot_ext) * src->dim[src_rank - 1]._stride;
-        }
-        else
-        {
-#define KINDCASE(kind, type)                                          \
-case kind:                                                            \
-  array_offset_sr = ((ptrdiff_t)                                      \
-    ((type *) src_vector->u.v.vector)[i] - src->dim[0].lower_bound);  \
-  break
-          switch (src_vector->u.v.kind)
-          {
-            KINDCASE(1, int8_t);
-            KINDCASE(2, int16_t);
-            KINDCASE(4, int32_t);
-            KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-            KINDCASE(16, __int128);
-#endif
-            default:
-              caf_runtime_error(unreachable);
-              return;
-          }
-#undef KINDCASE
-        }
-        arr_dsp_s[i] = array_offset_sr;
-      }
-
-      ierr = MPI_Type_indexed(size, arr_bl, arr_dsp_s, base_type_src, &dt_s);
+      get_array_type(src, src_size, size, &dt_s);
+      get_array_type(NULL, dst_size, size, &dt_d);
+      ierr = MPI_Type_get_true_extent(dt_s, &dt_lb, &dt_extent);
       chk_err(ierr);
-      ierr = MPI_Type_vector(size, 1, 1, base_type_dst, &dt_d); chk_err(ierr);
 
-      free(arr_bl);
-      free(arr_dsp_s);
+      CAF_Win_lock_get(src_remote_image, offset_g + dt_lb, dt_extent, *p);
+      ierr = MPI_Get(dst_t_buff, 1, dt_d, src_remote_image, offset_g, 1,
+                     dt_s, *p); chk_err(ierr);
+      CAF_Win_unlock_local(src_remote_image, *p);
     }
 
-    ierr = MPI_Type_commit(&dt_s); chk_err(ierr);
-    ierr = MPI_Type_commit(&dt_d); chk_err(ierr);
-
-    CAF_Win_lock(MPI_LOCK_SHARED, src_remote_image, *p);
-    ierr = MPI_Get(dst_t_buff, 1, dt_d, src_remote_image, offset_g, 1,
-                   dt_s, *p); chk_err(ierr);
-    CAF_Win_unlock(src_remote_image, *p);
-
 #ifdef WITH_FAILED_IMAGES
     check_image_health(image_index_g, stat);
 
@@ -2435,297 +4997,83 @@ case kind:                                                            \
       return;
     }
 #endif
-    ierr = MPI_Type_free(&dt_s); chk_err(ierr);
-    ierr = MPI_Type_free(&dt_d); chk_err(ierr);
   }
 #endif // STRIDED
   else
   {
-    if ((free_dst_t_buff = ((dst_t_buff = alloca(dst_size * size)) == NULL)))
-    {
-      dst_t_buff = malloc(dst_size * size);
-      if (dst_t_buff == NULL)
-        caf_runtime_error("Unable to allocate memory "
-                          "for internal buffer in sendget().");
-    }
+    /* Fetch all elements with a single get into one staging buffer, from
+     * which they are converted and padded into dst_t_buff in one go. */
+    MPI_Datatype dt_s, dt_d;
+    MPI_Aint dt_lb, dt_extent;
 
-    if (src_same_image)
-      src_t_buff = src->base_addr;
-    else if (!same_type_and_kind)
-    {
-      if ((free_src_t_buff = (((src_t_buff = alloca(src_size))) == NULL)))
-      {
-        src_t_buff = malloc(src_size);
-        if (src_t_buff == NULL)
-          caf_runtime_error("Unable to allocate memory "
-                            "for internal buffer in sendget().");
-      }
-    }
+    dst_t_buff = staging_alloc(dst_size * size);
+    free_dst_t_buff = true;
+    src_t_buff = staging_alloc(src_size * size);
+    free_src_t_buff = true;
 
-    if (!src_same_image)
-      CAF_Win_lock(MPI_LOCK_SHARED, src_remote_image, *p);
-    for (i = 0; i < size; ++i)
+    if (src_vector != NULL)
     {
-      ptrdiff_t array_offset_sr = 0, extent = 1, tot_ext = 1;
-      if (src_vector == NULL)
-      {
-        for (j = 0; j < src_rank - 1; ++j)
-        {
-          extent = src->dim[j]._ubound - src->dim[j].lower_bound + 1;
-          array_offset_sr += ((i / tot_ext) % extent) * src->dim[j]._stride;
-          tot_ext *= extent;
-        }
-
-        array_offset_sr += (i / tot_ext) * src->dim[src_rank - 1]._stride;
-      }
-      else
-      {
-#define KINDCASE(kind, type)                                        \
-case kind:                                                          \
-  array_offset_sr = ((ptrdiff_t)                                    \
-    ((type *)src_vector->u.v.vector)[i] - src->dim[0].lower_bound); \
-  break
-        switch (src_vector->u.v.kind)
-        {
-          KINDCASE(1, int8_t);
-          KINDCASE(2, int16_t);
-          KINDCASE(4, int32_t);
-          KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-          KINDCASE(16, __int128);
-#endif
-          default:
-            caf_runtime_error(unreachable);
-            return;
-        }
-      }
-#undef KINDCASE
-
-      src_offset = array_offset_sr * src_size;
-      void *dst = (void *)((char *) dst_t_buff + i * dst_size);
-
-      if (!src_same_image)
-      {
-        // Do the more likely first.
-        dprint("kind(dst) = %d, el_sz(dst) = %zd, "
-               "kind(src) = %d, el_sz(src) = %zd, lb(dst) = %zd.\n",
-               dst_kind, dst_size, src_kind, src_size, src->dim[0].lower_bound);
-        if (same_type_and_kind)
-        {
-          const size_t trans_size = (src_size < dst_size) ? src_size : dst_size;
-          ierr = MPI_Get(dst, trans_size, MPI_BYTE, src_remote_image,
-                         offset_g + src_offset, trans_size, MPI_BYTE, *p);
-          chk_err(ierr);
-          if (pad_str)
-            memcpy((void *)((char *)dst + src_size), pad_str,
-                   dst_size - src_size);
-        }
-        else if (dst_type == BT_CHARACTER)
-        {
-          ierr = MPI_Get(src_t_buff, src_size, MPI_BYTE, src_remote_image,
-                         offset_g + src_offset, src_size, MPI_BYTE, *p);
-          chk_err(ierr);
-          copy_char_to_self(src_t_buff, src_type, src_size, src_kind,
-                            dst, dst_type, dst_size, dst_kind, 1, true);
-        }
-        else
-        {
-          ierr = MPI_Get(src_t_buff, src_size, MPI_BYTE, src_remote_image,
-                         offset_g + src_offset, src_size, MPI_BYTE, *p);
-          chk_err(ierr);
-          convert_type(dst, dst_type, dst_kind, src_t_buff, src_type,
-                       src_kind, stat);
-        }
-      }
-      else
-      {
-        if (!mrt)
-        {
-          dprint("strided same_image, no temp,  for i = %zd, "
-                 "src_offset = %zd, offset = %zd.\n",
-                 i, src_offset, offset_g);
-          if (same_type_and_kind)
-            memmove(dst, src->base_addr + src_offset, src_size);
-          else
-            convert_type(dst, dst_type, dst_kind,
-                         src->base_addr + src_offset, src_type, src_kind, stat);
-        }
-        else
-        {
-          dprint("strided same_image, *WITH* temp, for i = %zd.\n", i);
-          if (same_type_and_kind)
-            memmove(dst, src->base_addr + src_offset, src_size);
-          else
-            convert_type(dst, dst_type, dst_kind,
-                         src->base_addr + src_offset, src_type, src_kind, stat);
-        }
-      }
-
-#ifndef WITH_FAILED_IMAGES
-      if (ierr != 0)
-      {
-        caf_runtime_error("MPI Error: %d", ierr);
-        return;
-      }
-#endif
+      ierr = get_vector(src_t_buff, src, src_vector, src_size, size,
+                        src_remote_image, offset_g, *p); chk_err(ierr);
     }
-    if (!src_same_image)
-      CAF_Win_unlock(src_remote_image, *p);
-  }
-
-  p = TOKEN(token_s);
-  /* Now transfer data to the remote dest. */
-  if (dst_contiguous && dst_vector == NULL)
-  {
-    if (dst_same_image)
-      memmove(dest->base_addr, dst_t_buff, dst_size * size);
     else
     {
-      CAF_Win_lock(MPI_LOCK_EXCLUSIVE, dst_remote_image, *p);
-      const size_t trans_size = size * dst_size;
-      ierr = MPI_Put(dst_t_buff, trans_size, MPI_BYTE, dst_remote_image,
-                     offset_s, trans_size, MPI_BYTE, *p); chk_err(ierr);
-      ierr = CAF_Win_unlock(dst_remote_image, *p); chk_err(ierr);
-#if NONBLOCKING_PUT
-      /* Pending puts init */
-      if (pending_puts == NULL)
-      {
-        pending_puts = calloc(1,sizeof(win_sync));
-        pending_puts->next = NULL;
-        pending_puts->win = token_s;
-        pending_puts->img = dst_remote_image;
-        last_elem = pending_puts;
-        last_elem->next = NULL;
-      }
-      else
-      {
-        last_elem->next = calloc(1,sizeof(win_sync));
-        last_elem = last_elem->next;
-        last_elem->win = token_s;
-        last_elem->img = dst_remote_image;
-        last_elem->next = NULL;
-      }
-#endif // CAF_MPI_LOCK_UNLOCK
-    }
-  }
-#ifdef STRIDED
-  else if (!dst_same_image && same_type_and_kind && dst_type != BT_CHARACTER)
-  {
-    /* For strided copy, no type and kind conversion, copy to self or
-     * character arrays are supported. */
-    MPI_Datatype dt_s, dt_d, base_type_dst;
-    int *arr_bl, *arr_dsp_d;
-
-    selectType(dst_size, &base_type_dst);
-
-    if (dst_rank == 1)
-    {
-      if (dst_vector == NULL)
-      {
-        ierr = MPI_Type_vector(size, 1, dest->dim[0]._stride, base_type_dst,
-                               &dt_d); chk_err(ierr);
-      }
-      else
-      {
-        arr_bl = calloc(size, sizeof(int));
-        arr_dsp_d = calloc(size, sizeof(int));
-
-        dprint("Setting up strided vector index.\n");
-#define KINDCASE(kind, type)                                            \
-case kind:                                                              \
-  for (i = 0; i < size; ++i)                                            \
-  {                                                                     \
-    arr_dsp_d[i] = ((ptrdiff_t)                                         \
-      ((type *) dst_vector->u.v.vector)[i] - dest->dim[0].lower_bound); \
-    arr_bl[i] = 1;                                                      \
-  }                                                                     \
-  break
-        switch (dst_vector->u.v.kind)
-        {
-          KINDCASE(1, int8_t);
-          KINDCASE(2, int16_t);
-          KINDCASE(4, int32_t);
-          KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-          KINDCASE(16, __int128);
-#endif
-        default:
-          caf_runtime_error(unreachable);
-          return;
-        }
-#undef KINDCASE
-        ierr = MPI_Type_indexed(size, arr_bl, arr_dsp_d, base_type_dst, &dt_d);
-        chk_err(ierr);
-        free(arr_bl);
-        free(arr_dsp_d);
-      }
-      ierr = MPI_Type_vector(size, 1, 1, base_type_dst, &dt_s); chk_err(ierr);
+      get_array_type(src, src_size, size, &dt_s);
+      get_array_type(NULL, src_size, size, &dt_d);
+      ierr = MPI_Type_get_true_extent(dt_s, &dt_lb, &dt_extent);
+      chk_err(ierr);
+      CAF_Win_lock_get(src_remote_image, offset_g + dt_lb, dt_extent, *p);
+      ierr = MPI_Get(src_t_buff, 1, dt_d, src_remote_image, offset_g, 1,
+                     dt_s, *p); chk_err(ierr);
+      CAF_Win_unlock_local(src_remote_image, *p);
     }
-    else
-    {
-      arr_bl = calloc(size, sizeof(int));
-      arr_dsp_d = calloc(size, sizeof(int));
-
-      for (i = 0; i < size; ++i)
-      {
-        arr_bl[i] = 1;
-      }
 
-      for (i = 0; i < size; ++i)
-      {
-        ptrdiff_t array_offset_dst = 0, extent = 1, tot_ext = 1;
-        if (dst_vector == NULL)
-        {
-          for (j = 0; j < dst_rank - 1; ++j)
-          {
-            extent = dest->dim[j]._ubound - dest->dim[j].lower_bound + 1;
-            array_offset_dst += ((i / tot_ext) % extent) * dest->dim[j]._stride;
-            tot_ext *= extent;
-          }
+    dprint("kind(dst) = %d, el_sz(dst) = %zd, "
+           "kind(src) = %d, el_sz(src) = %zd, lb(dst) = %zd.\n",
+           dst_kind, dst_size, src_kind, src_size, src->dim[0].lower_bound);
+    convert_elements(dst_t_buff, dst_type, dst_kind, dst_size,
+                     src_t_buff, src_type, src_kind, src_size,
+                     size, false, stat);
+  }
 
-          array_offset_dst += (i / tot_ext) * dest->dim[dst_rank - 1]._stride;
-        }
-        else
-        {
-#define KINDCASE(kind, type)                                            \
-case kind:                                                              \
-  array_offset_dst = ((ptrdiff_t)                                       \
-    ((type *) dst_vector->u.v.vector)[i] - dest->dim[0].lower_bound);   \
-  break
-          switch (dst_vector->u.v.kind)
-          {
-            KINDCASE(1, int8_t);
-            KINDCASE(2, int16_t);
-            KINDCASE(4, int32_t);
-            KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-            KINDCASE(16, __int128);
-#endif
-            default:
-              caf_runtime_error(unreachable);
-              return;
-          }
-#undef KINDCASE
-        }
-        arr_dsp_d[i] = array_offset_dst;
-      }
+  p = TOKEN(token_s);
+  /* Now transfer data to the remote dest. */
+  if (dst_same_image)
+    unpack_local(dest, dst_vector, dst_t_buff, size);
+  else if (dst_contiguous && dst_vector == NULL)
+  {
+    const size_t trans_size = size * dst_size;
+    CAF_Win_lock_put(dst_remote_image, offset_s, trans_size, *p);
+    ierr = put_bytes(dst_t_buff, trans_size, dst_remote_image, offset_s, *p);
+    chk_err(ierr);
+    ierr = CAF_Win_unlock_put(dst_remote_image, offset_s,
+                              trans_size, *p); chk_err(ierr);
+  }
+  else
+  {
+    /* dst_t_buff holds the converted and padded elements, so any kind of
+     * destination is written by a single put. */
+    MPI_Datatype dt_s, dt_d;
+    MPI_Aint dt_lb, dt_extent;
 
-      ierr = MPI_Type_vector(size, 1, 1, base_type_dst, &dt_s); chk_err(ierr);
-      ierr = MPI_Type_indexed(size, arr_bl, arr_dsp_d, base_type_dst, &dt_d);
+    if (dst_vector != NULL)
+    {
+      ierr = put_vector(dst_t_buff, dest, dst_vector, dst_size, size,
+                        dst_remote_image, offset_s, *p); chk_err(ierr);
+    }
+    else
+    {
+      get_array_type(NULL, dst_size, size, &dt_s);
+      get_array_type(dest, dst_size, size, &dt_d);
+      ierr = MPI_Type_get_true_extent(dt_d, &dt_lb, &dt_extent);
       chk_err(ierr);
 
-      free(arr_bl);
-      free(arr_dsp_d);
+      CAF_Win_lock_put(dst_remote_image, offset_s + dt_lb, dt_extent, *p);
+      ierr = MPI_Put(dst_t_buff, 1, dt_s, dst_remote_image, offset_s, 1,
+                     dt_d, *p); chk_err(ierr);
+      CAF_Win_unlock_put(dst_remote_image, offset_s + dt_lb, dt_extent, *p);
     }
 
-    ierr = MPI_Type_commit(&dt_s); chk_err(ierr);
-    ierr = MPI_Type_commit(&dt_d); chk_err(ierr);
-
-    CAF_Win_lock(MPI_LOCK_EXCLUSIVE, dst_remote_image, *p);
-    ierr = MPI_Put(dst_t_buff, 1, dt_s, dst_remote_image, offset_s, 1,
-                   dt_d, *p); chk_err(ierr);
-    CAF_Win_unlock(dst_remote_image, *p);
-
 #ifdef WITH_FAILED_IMAGES
     check_image_health(image_index_s, stat);
 
@@ -2741,81 +5089,16 @@ case kind:                                                              \
       return;
     }
 #endif
-    ierr = MPI_Type_free(&dt_s); chk_err(ierr);
-    ierr = MPI_Type_free(&dt_d); chk_err(ierr);
   }
-#endif // STRIDED
-  else
-  {
-    if (!dst_same_image)
-      CAF_Win_lock(MPI_LOCK_EXCLUSIVE, dst_remote_image, *p);
-    for (i = 0; i < size; ++i)
-    {
-      ptrdiff_t array_offset_dst = 0, extent = 1, tot_ext = 1;
-      if (dst_vector == NULL)
-      {
-        for (j = 0; j < dst_rank - 1; ++j)
-        {
-          extent = dest->dim[j]._ubound - dest->dim[j].lower_bound + 1;
-          array_offset_dst += ((i / tot_ext) % extent) * dest->dim[j]._stride;
-          tot_ext *= extent;
-        }
-
-        array_offset_dst += (i / tot_ext) * dest->dim[dst_rank - 1]._stride;
-      }
-      else
-      {
-#define KINDCASE(kind, type)                                         \
-case kind:                                                           \
-  array_offset_dst = ((ptrdiff_t)                                    \
-    ((type *)dst_vector->u.v.vector)[i] - dest->dim[0].lower_bound); \
-  break
-        switch (dst_vector->u.v.kind)
-        {
-          KINDCASE(1, int8_t);
-          KINDCASE(2, int16_t);
-          KINDCASE(4, int32_t);
-          KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-          KINDCASE(16, __int128);
-#endif
-          default:
-            caf_runtime_error(unreachable);
-            return;
-        }
-      }
-#undef KINDCASE
-      dst_offset = array_offset_dst * dst_size;
-
-      void *sr = (void *)((char *)dst_t_buff + i * dst_size);
 
-      if (!dst_same_image)
-      {
-        // Do the more likely first.
-        ierr = MPI_Put(sr, dst_size, MPI_BYTE, dst_remote_image,
-                       offset_s + dst_offset, dst_size, MPI_BYTE, *p);
-         chk_err(ierr);
-      }
-      else
-        memmove(dest->base_addr + dst_offset, sr, dst_size);
-
-#ifndef WITH_FAILED_IMAGES
-      if (ierr != 0)
-      {
-        caf_runtime_error("MPI Error: %d", ierr);
-        return;
-      }
+#if MPI_VERSION >= 3
+done:
 #endif
-    } /* for */
-    if (!dst_same_image)
-      CAF_Win_unlock(dst_remote_image, *p);
-  }
-
   /* Free memory, when not allocated on stack. */
   if (free_src_t_buff)
-    free(src_t_buff);
+    staging_free(src_t_buff);
   if (free_dst_t_buff)
-    free(dst_t_buff);
+    staging_free(dst_t_buff);
   if (free_pad_str)
     free(pad_str);
 
@@ -2843,6 +5126,65 @@ case kind:                                                           \
 }
 
 
+/* Move the scalar local to the scalar coarray remote at offset in token on
+ * image image_index, or from it when put is false, without the descriptor
+ * walks, buffers and padding of send and get.  Only done for rank 0 scalars of
+ * the same type, kind and size on both sides; returns false when the generic
+ * path is needed. */
+
+static bool
+scalar_transfer(bool put, caf_token_t token, size_t offset, int image_index,
+                gfc_descriptor_t *remote, gfc_descriptor_t *local,
+                int remote_kind, int local_kind, int *stat)
+{
+  const size_t size = GFC_DESCRIPTOR_SIZE(local);
+  MPI_Win win;
+  int rank, ierr;
+#ifdef CAF_NODE_SHARED_MEMORY
+  void *node_mem;
+#endif
+
+#ifdef WITH_FAILED_IMAGES
+  /* The health of the image is checked by the generic path. */
+  return false;
+#endif
+  if (GFC_DESCRIPTOR_RANK(remote) != 0 || GFC_DESCRIPTOR_RANK(local) != 0
+      || GFC_DESCRIPTOR_TYPE(remote) != GFC_DESCRIPTOR_TYPE(local)
+      || remote_kind != local_kind || GFC_DESCRIPTOR_SIZE(remote) != size)
+    return false;
+#ifdef GCC_GE_7
+  if (stat)
+    *stat = 0;
+#endif
+  if (image_index == caf_this_image)
+  {
+    if (put)
+      memmove(remote->base_addr, local->base_addr, size);
+    else
+      memmove(local->base_addr, remote->base_addr, size);
+    return true;
+  }
+#ifdef CAF_NODE_SHARED_MEMORY
+  if ((node_mem = node_address(token, image_index, offset)))
+  {
+    if (put)
+      memcpy(node_mem, local->base_addr, size);
+    else
+      memcpy(local->base_addr, node_mem, size);
+    return true;
+  }
+#endif
+  win = *TOKEN(token);
+  rank = translate_rank(win, image_index - 1);
+  if (put)
+    ierr = put_window_bytes(local->base_addr, size, rank, offset, win);
+  else
+    ierr = get_window_bytes(local->base_addr, size, rank, offset, win);
+  chk_err(ierr);
+  return true;
+}
+
+
 /* Send array data from src to dest on a remote image.
  * The argument mrt means may_require_temporary */
 
@@ -2852,6 +5194,11 @@ PREFIX(send) (caf_token_t token, size_t offset, int image_index,
               gfc_descriptor_t *src, int dst_kind, int src_kind,
               bool mrt, int *pstat)
 {
+  if (dst_vector == NULL
+      && scalar_transfer(true, token, offset, image_index, dest, src,
+                         dst_kind, src_kind, pstat))
+    return;
+
   int j, ierr = 0;
   size_t i, size;
   ptrdiff_t dimextent;
@@ -2872,23 +5219,13 @@ PREFIX(send) (caf_token_t token, size_t offset, int image_index,
     same_type_and_kind = dst_type == src_type && dst_kind == src_kind;
 
   MPI_Win *p = TOKEN(token);
-  ptrdiff_t dst_offset = 0;
   void *pad_str = NULL, *t_buff = NULL;
   bool free_pad_str = false, free_t_buff = false;
   const bool dest_char_array_is_longer
       = dst_type == BT_CHARACTER && dst_size > src_size && !same_image;
   int remote_image = image_index - 1;
   if (!same_image)
-  {
-    MPI_Group current_team_group, win_group;
-    ierr = MPI_Comm_group(CAF_COMM_WORLD, &current_team_group); chk_err(ierr);
-    ierr = MPI_Win_get_group(*p, &win_group); chk_err(ierr);
-    ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                     (int[]){remote_image}, win_group,
-                                     &remote_image); chk_err(ierr);
-    ierr = MPI_Group_free(&current_team_group); chk_err(ierr);
-    ierr = MPI_Group_free(&win_group); chk_err(ierr);
-  }
+    remote_image = translate_rank(*p, remote_image);
 
   /* Ensure stat is always set. */
 #ifdef GCC_GE_7
@@ -2900,6 +5237,23 @@ PREFIX(send) (caf_token_t token, size_t offset, int image_index,
   int * stat = NULL;
 #endif
 
+#ifdef CAF_NODE_SHARED_MEMORY
+  /* The memory of images on this node is written like that of this image. */
+  if (!same_image)
+  {
+    gfc_max_dim_descriptor_t node_dest;
+    void *node_mem = node_address(token, image_index, offset);
+
+    if (node_mem != NULL)
+    {
+      PREFIX(send) (token, offset, caf_this_image,
+                    rebase_descriptor(&node_dest, dest, node_mem), dst_vector,
+                    src, dst_kind, src_kind, mrt, pstat);
+      return;
+    }
+  }
+#endif // CAF_NODE_SHARED_MEMORY
+
   size = 1;
   for (j = 0; j < dst_rank; ++j)
   {
@@ -2916,6 +5270,13 @@ PREFIX(send) (caf_token_t token, size_t offset, int image_index,
          dst_vector, image_index, offset);
   check_image_health(image_index, stat);
 
+  if (same_image)
+  {
+    copy_local(dest, dst_vector, dst_kind, src, NULL, src_kind, size, mrt,
+               stat);
+    return;
+  }
+
   /* For char arrays: create the padding array, when dst is longer than src. */
   if (dest_char_array_is_longer)
   {
@@ -2944,453 +5305,138 @@ PREFIX(send) (caf_token_t token, size_t offset, int image_index,
 
   if (src_contiguous && dst_contiguous && dst_vector == NULL)
   {
-    if (same_image)
+    if (dst_kind != src_kind || dest_char_array_is_longer || src_rank == 0)
     {
-      dprint("in caf_this == image_index, size = %zd, dst_kind = %d, "
-             "src_kind = %d\n", size, dst_kind, src_kind);
-      if (dst_type == BT_CHARACTER)
-        /* The size is encoded in the descriptor's type for char arrays. */
-        copy_char_to_self(src->base_addr, src_type, src_size, src_kind,
-                          dest->base_addr, dst_type, dst_size, dst_kind,
-                          size, src_rank == 0);
-      else
-        copy_to_self(src, src_kind, dest, dst_kind, size, stat);
-      return;
+      t_buff = staging_alloc(dst_size * size);
+      free_t_buff = true;
     }
-    else
-    {
-      if (dst_kind != src_kind || dest_char_array_is_longer || src_rank == 0)
+
+    if ((same_type_and_kind && dst_rank == src_rank)
+        || dst_type == BT_CHARACTER)
       {
-        if ((free_t_buff = ((t_buff = alloca(dst_size * size)) == NULL)))
+        if (dest_char_array_is_longer
+            || (dst_kind != src_kind && dst_type == BT_CHARACTER))
         {
-          t_buff = malloc(dst_size * size);
-          if (t_buff == NULL)
-            caf_runtime_error("Unable to allocate memory "
-                              "for internal buffer in send().");
+          copy_char_to_self(src->base_addr, src_type, src_size,
+                            src_kind, t_buff, dst_type, dst_size,
+                            dst_kind, size, src_rank == 0);
+          ierr = put_window_bytes(t_buff, dst_size, remote_image, offset,
+                                  *p); chk_err(ierr);
         }
-      }
-
-      if ((same_type_and_kind && dst_rank == src_rank)
-          || dst_type == BT_CHARACTER)
+        else
         {
-          if (dest_char_array_is_longer
-              || (dst_kind != src_kind && dst_type == BT_CHARACTER))
-          {
-            copy_char_to_self(src->base_addr, src_type, src_size,
-                              src_kind, t_buff, dst_type, dst_size,
-                              dst_kind, size, src_rank == 0);
-            CAF_Win_lock(MPI_LOCK_EXCLUSIVE, remote_image, *p);
-            ierr = MPI_Put(t_buff, dst_size, MPI_BYTE, remote_image,
-                           offset, dst_size, MPI_BYTE, *p); chk_err(ierr);
-            CAF_Win_unlock(remote_image, *p);
-          }
-          else
-          {
-            const size_t trans_size =
-              ((dst_size > src_size) ? src_size : dst_size) * size;
-            CAF_Win_lock(MPI_LOCK_EXCLUSIVE, remote_image, *p);
-            ierr = MPI_Put(src->base_addr, trans_size, MPI_BYTE, remote_image,
-                           offset, trans_size, MPI_BYTE, *p); chk_err(ierr);
-            CAF_Win_unlock(remote_image, *p);
-          }
+          const size_t trans_size =
+            ((dst_size > src_size) ? src_size : dst_size) * size;
+          ierr = put_window_bytes(src->base_addr, trans_size, remote_image,
+                                  offset, *p); chk_err(ierr);
         }
-      else
-      {
-        convert_with_strides(t_buff, dst_type, dst_kind, dst_size,
-                             src->base_addr, src_type, src_kind,
-                             (src_rank > 0) ? src_size: 0, size, stat);
-        CAF_Win_lock(MPI_LOCK_EXCLUSIVE, remote_image, *p);
-        ierr = MPI_Put(t_buff, dst_size * size, MPI_BYTE, remote_image,
-                       offset, dst_size * size, MPI_BYTE, *p); chk_err(ierr);
-        ierr = CAF_Win_unlock(remote_image, *p); chk_err(ierr);
-      }
-#if NONBLOCKING_PUT
-      /* Pending puts init */
-      if (pending_puts == NULL)
-      {
-        pending_puts = calloc(1,sizeof(win_sync));
-        pending_puts->next = NULL;
-        pending_puts->win = token;
-        pending_puts->img = remote_image;
-        last_elem = pending_puts;
-        last_elem->next = NULL;
-      }
-      else
-      {
-        last_elem->next = calloc(1,sizeof(win_sync));
-        last_elem = last_elem->next;
-        last_elem->win = token;
-        last_elem->img = remote_image;
-        last_elem->next = NULL;
       }
-#endif // CAF_MPI_LOCK_UNLOCK
+    else
+    {
+      convert_with_strides(t_buff, dst_type, dst_kind, dst_size,
+                           src->base_addr, src_type, src_kind,
+                           (src_rank > 0) ? src_size: 0, size, stat);
+      ierr = put_window_bytes(t_buff, dst_size * size, remote_image, offset,
+                              *p); chk_err(ierr);
     }
   }
 
 #ifdef STRIDED
-  else if (!same_image && same_type_and_kind && dst_type != BT_CHARACTER)
+  else if (same_type_and_kind && dst_type != BT_CHARACTER
+           && dst_vector == NULL)
   {
     /* For strided copy, no type and kind conversion, copy to self or
-     * character arrays are supported. */
-    MPI_Datatype dt_s, dt_d, base_type_src, base_type_dst;
-    int *arr_bl, *arr_dsp_s, *arr_dsp_d;
-
-    selectType(src_size, &base_type_src);
-    selectType(dst_size, &base_type_dst);
-
-    if (dst_rank == 1)
-    {
-      if (dst_vector == NULL)
-      {
-        dprint("Setting up mpi datatype vector with "
-               "stride %d, size %d and offset %d.\n",
-               dest->dim[0]._stride, size, offset);
-        ierr = MPI_Type_vector(size, 1, dest->dim[0]._stride, base_type_dst,
-                               &dt_d); chk_err(ierr);
-      }
-      else
-      {
-        arr_bl = calloc(size, sizeof(int));
-        arr_dsp_d = calloc(size, sizeof(int));
-
-        dprint("Setting up strided vector index.\n");
-#define KINDCASE(kind, type)                                            \
-case kind:                                                              \
-  for (i = 0; i < size; ++i)                                            \
-  {                                                                     \
-    arr_dsp_d[i] = ((ptrdiff_t)                                         \
-      ((type *) dst_vector->u.v.vector)[i] - dest->dim[0].lower_bound); \
-    arr_bl[i] = 1;                                                      \
-  }                                                                     \
-  break
-        switch (dst_vector->u.v.kind)
-        {
-          KINDCASE(1, int8_t);
-          KINDCASE(2, int16_t);
-          KINDCASE(4, int32_t);
-          KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-          KINDCASE(16, __int128);
-#endif
-        default:
-          caf_runtime_error(unreachable);
-          return;
-        }
-#undef KINDCASE
-        ierr = MPI_Type_indexed(size, arr_bl, arr_dsp_d, base_type_dst, &dt_d);
-        chk_err(ierr);
-        free(arr_bl);
-        free(arr_dsp_d);
-      }
-      MPI_Type_vector(size, 1, src->dim[0]._stride, base_type_src, &dt_s);
-    }
-    else
-    {
-      arr_bl = calloc(size, sizeof(int));
-      arr_dsp_s = calloc(size, sizeof(int));
-      arr_dsp_d = calloc(size, sizeof(int));
-
-      for (i = 0; i < size; ++i)
-      {
-        arr_bl[i] = 1;
-      }
-
-      for (i = 0; i < size; ++i)
-      {
-        ptrdiff_t array_offset_dst = 0, extent = 1, tot_ext = 1;
-        if (dst_vector == NULL)
-        {
-          for (j = 0; j < dst_rank - 1; ++j)
-          {
-            extent = dest->dim[j]._ubound - dest->dim[j].lower_bound + 1;
-            array_offset_dst += ((i / tot_ext) % extent) * dest->dim[j]._stride;
-            tot_ext *= extent;
-          }
-
-          array_offset_dst += (i / tot_ext) * dest->dim[dst_rank - 1]._stride;
-        }
-        else
-        {
-#define KINDCASE(kind, type)                                          \
-case kind:                                                            \
-  array_offset_dst = ((ptrdiff_t)                                     \
-    ((type *) dst_vector->u.v.vector)[i] - dest->dim[0].lower_bound); \
-  break
-          switch (dst_vector->u.v.kind)
-          {
-            KINDCASE(1, int8_t);
-            KINDCASE(2, int16_t);
-            KINDCASE(4, int32_t);
-            KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-            KINDCASE(16, __int128);
-#endif
-            default:
-              caf_runtime_error(unreachable);
-              return;
-          }
-#undef KINDCASE
-        }
-        arr_dsp_d[i] = array_offset_dst;
-
-        if (src_rank != 0)
-        {
-          ptrdiff_t array_offset_sr = 0;
-          extent = 1;
-          tot_ext = 1;
-          for (j = 0; j < src_rank - 1; ++j)
-          {
-            extent = src->dim[j]._ubound - src->dim[j].lower_bound + 1;
-            array_offset_sr += ((i / tot_ext) % extent) * src->dim[j]._stride;
-            tot_ext *= extent;
-          }
-
-          array_offset_sr += (i / tot_ext) * src->dim[src_rank - 1]._stride;
-          arr_dsp_s[i] = array_offset_sr;
-        }
-        else
-          arr_dsp_s[i] = 0;
-      }
-
-      ierr = MPI_Type_indexed(size, arr_bl, arr_dsp_s, base_type_src, &dt_s);
-      chk_err(ierr);
-      ierr = MPI_Type_indexed(size, arr_bl, arr_dsp_d, base_type_dst, &dt_d);
-      chk_err(ierr);
+     * character arrays are supported.  Vector subscripts are put from the
+     * packed elements below. */
+    MPI_Datatype dt_s, dt_d;
+    MPI_Aint dt_lb, dt_extent;
 
-      free(arr_bl);
-      free(arr_dsp_s);
-      free(arr_dsp_d);
-    }
-
-    ierr = MPI_Type_commit(&dt_s); chk_err(ierr);
-    ierr = MPI_Type_commit(&dt_d); chk_err(ierr);
+    get_array_type(src, src_size, size, &dt_s);
+    get_array_type(dest, dst_size, size, &dt_d);
+    ierr = MPI_Type_get_true_extent(dt_d, &dt_lb, &dt_extent); chk_err(ierr);
 
-    CAF_Win_lock(MPI_LOCK_EXCLUSIVE, remote_image, *p);
+    CAF_Win_lock_put(remote_image, offset + dt_lb, dt_extent, *p);
     ierr = MPI_Put(src->base_addr, 1, dt_s, remote_image, offset, 1, dt_d, *p);
     chk_err(ierr);
-    CAF_Win_unlock(remote_image, *p);
-
-#ifdef WITH_FAILED_IMAGES
-    check_image_health(image_index, stat);
-
-    if (!stat && ierr == STAT_FAILED_IMAGE)
-      terminate_internal(ierr, 1);
-
-    if (stat)
-      *stat = ierr;
-#else
-    if (ierr != 0)
-    {
-      terminate_internal(ierr, 1);
-      return;
-    }
-#endif
-    ierr = MPI_Type_free(&dt_s); chk_err(ierr);
-    ierr = MPI_Type_free(&dt_d); chk_err(ierr);
-  }
-#endif // STRIDED
-  else
-  {
-    if (same_image && mrt)
-    {
-      if ((free_t_buff = (((t_buff = alloca(dst_size * size))) == NULL)))
-      {
-        t_buff = malloc(dst_size * size);
-        if (t_buff == NULL)
-          caf_runtime_error("Unable to allocate memory "
-                            "for internal buffer in send().");
-      }
-    }
-    else if (!same_type_and_kind && !same_image)
-    {
-      if ((free_t_buff = (((t_buff = alloca(dst_size))) == NULL)))
-      {
-        t_buff = malloc(dst_size);
-        if (t_buff == NULL)
-          caf_runtime_error("Unable to allocate memory "
-                            "for internal buffer in send().");
-      }
-    }
-
-    for (i = 0; i < size; ++i)
-    {
-      ptrdiff_t array_offset_dst = 0, extent = 1, tot_ext = 1;
-      if (!same_image || !mrt)
-      {
-        /* For same image and may require temp, the dst_offset is
-         * computed on storage. */
-        if (dst_vector == NULL)
-        {
-          for (j = 0; j < dst_rank - 1; ++j)
-          {
-            extent = dest->dim[j]._ubound - dest->dim[j].lower_bound + 1;
-            array_offset_dst += ((i / tot_ext) % extent) * dest->dim[j]._stride;
-            tot_ext *= extent;
-          }
-          array_offset_dst += (i / tot_ext) * dest->dim[dst_rank - 1]._stride;
-        }
-        else
-        {
-#define KINDCASE(kind, type)                                          \
-case kind:                                                            \
-  array_offset_dst = ((ptrdiff_t)                                     \
-    ((type *)dst_vector->u.v.vector)[i] - dest->dim[0].lower_bound);  \
-  break
-          switch (dst_vector->u.v.kind)
-          {
-            KINDCASE(1, int8_t);
-            KINDCASE(2, int16_t);
-            KINDCASE(4, int32_t);
-            KINDCASE(8, int64_t);
-  #ifdef HAVE_GFC_INTEGER_16
-            KINDCASE(16, __int128);
-  #endif
-            default:
-              caf_runtime_error(unreachable);
-              return;
-          }
-        }
-        dst_offset = array_offset_dst * dst_size;
-      }
-
-      void *sr;
-      if (src_rank != 0)
-      {
-        ptrdiff_t array_offset_sr = 0;
-        extent = 1;
-        tot_ext = 1;
-        for (j = 0; j < src_rank - 1; ++j)
-        {
-          extent = src->dim[j]._ubound - src->dim[j].lower_bound + 1;
-          array_offset_sr += ((i / tot_ext) % extent) * src->dim[j]._stride;
-          tot_ext *= extent;
-        }
-
-        array_offset_sr += (i / tot_ext) * src->dim[dst_rank - 1]._stride;
-        sr = (void *)((char *)src->base_addr + array_offset_sr * src_size);
-      }
-      else
-        sr = src->base_addr;
+    CAF_Win_unlock_put(remote_image, offset + dt_lb, dt_extent, *p);
 
-      if (!same_image)
-      {
-        // Do the more likely first.
-        dprint("kind(dst) = %d, el_sz(dst) = %zd, "
-               "kind(src) = %d, el_sz(src) = %zd, lb(dst) = %zd.\n",
-               dst_kind, dst_size, src_kind,
-               src_size, dest->dim[0].lower_bound);
-        if (same_type_and_kind)
-        {
-          const size_t trans_size = (src_size < dst_size) ? src_size : dst_size;
-          CAF_Win_lock(MPI_LOCK_EXCLUSIVE, remote_image, *p);
-          ierr = MPI_Put(sr, trans_size, MPI_BYTE, remote_image,
-                         offset + dst_offset, trans_size, MPI_BYTE, *p);
-          chk_err(ierr);
-          if (pad_str)
-          {
-            ierr = MPI_Put(pad_str, dst_size - src_size, MPI_BYTE,
-                           remote_image, offset + dst_offset + src_size,
-                           dst_size - src_size, MPI_BYTE, *p); chk_err(ierr);
-          }
-          CAF_Win_unlock(remote_image, *p);
-        }
-        else if (dst_type == BT_CHARACTER)
-        {
-          copy_char_to_self(sr, src_type, src_size, src_kind,
-                            t_buff, dst_type, dst_size, dst_kind, 1, true);
-          CAF_Win_lock(MPI_LOCK_EXCLUSIVE, remote_image, *p);
-          ierr = MPI_Put(t_buff, dst_size, MPI_BYTE, remote_image,
-                         offset + dst_offset, dst_size, MPI_BYTE, *p);
-          CAF_Win_unlock(remote_image, *p);
-          chk_err(ierr);
-        }
-        else
-        {
-          convert_type(t_buff, dst_type, dst_kind,
-                       sr, src_type, src_kind, stat);
-          CAF_Win_lock(MPI_LOCK_EXCLUSIVE, remote_image, *p);
-          ierr = MPI_Put(t_buff, dst_size, MPI_BYTE, remote_image,
-                         offset + dst_offset, dst_size, MPI_BYTE, *p);
-          CAF_Win_unlock(remote_image, *p);
-          chk_err(ierr);
-        }
-      }
-      else
-      {
-        if (!mrt)
-        {
-          dprint("strided same_image, no temp, for i = %zd, "
-                 "dst_offset = %zd, offset = %zd.\n",
-                 i, dst_offset, offset);
-          if (same_type_and_kind)
-            memmove(dest->base_addr + dst_offset, sr, src_size);
-          else
-            convert_type(dest->base_addr + dst_offset, dst_type,
-                         dst_kind, sr, src_type, src_kind, stat);
-        }
-        else
-        {
-          dprint("strided same_image, *WITH* temp, for i = %zd.\n", i);
-          if (same_type_and_kind)
-            memmove(t_buff + i * dst_size, sr, src_size);
-          else
-            convert_type(t_buff + i * dst_size, dst_type, dst_kind,
-                         sr, src_type, src_kind, stat);
-        }
-      }
+#ifdef WITH_FAILED_IMAGES
+    check_image_health(image_index, stat);
 
-#ifndef WITH_FAILED_IMAGES
-      if (ierr != 0)
-      {
-        caf_runtime_error("MPI Error: %d", ierr);
-        return;
-      }
-#endif
-    }
+    if (!stat && ierr == STAT_FAILED_IMAGE)
+      terminate_internal(ierr, 1);
 
-    if (same_image && mrt)
+    if (stat)
+      *stat = ierr;
+#else
+    if (ierr != 0)
+    {
+      terminate_internal(ierr, 1);
+      return;
+    }
+#endif
+  }
+#endif // STRIDED
+  else
+  {
+    /* Pack the converted and padded elements into one staging buffer, which
+     * is then moved by a single put.  A non-contiguous source is gathered
+     * behind them first, so that the conversion runs over one block. */
+    const bool gather_src = src_rank != 0 && !src_contiguous;
+    const size_t buff_size =
+      (dst_size + (gather_src ? src_size : 0)) * size;
+    void *packed_src = src->base_addr;
+
+    t_buff = staging_alloc(buff_size);
+    free_t_buff = true;
+    if (gather_src)
     {
+      packed_src = (void *)((char *)t_buff + dst_size * size);
       for (i = 0; i < size; ++i)
-      {
-        ptrdiff_t array_offset_dst = 0, extent = 1, tot_ext = 1;
-        if (dst_vector == NULL)
-        {
-          for (j = 0; j < dst_rank - 1; ++j)
-          {
-            extent = dest->dim[j]._ubound - dest->dim[j].lower_bound + 1;
-            array_offset_dst += ((i / tot_ext) % extent) * dest->dim[j]._stride;
-            tot_ext *= extent;
-          }
+        memcpy((char *)packed_src + i * src_size,
+               (char *)src->base_addr + element_offset(src, i) * src_size,
+               src_size);
+    }
+    convert_elements(t_buff, dst_type, dst_kind, dst_size,
+                     packed_src, src_type, src_kind, src_size,
+                     size, src_rank == 0, stat);
+
+    dprint("kind(dst) = %d, el_sz(dst) = %zd, "
+           "kind(src) = %d, el_sz(src) = %zd, lb(dst) = %zd.\n",
+           dst_kind, dst_size, src_kind,
+           src_size, dest->dim[0].lower_bound);
+    if (dst_contiguous && dst_vector == NULL)
+    {
+      const size_t trans_size = dst_size * size;
+      CAF_Win_lock_put(remote_image, offset, trans_size, *p);
+      ierr = put_bytes(t_buff, trans_size, remote_image, offset, *p);
+      chk_err(ierr);
+      CAF_Win_unlock_put(remote_image, offset, trans_size, *p);
+    }
+    else if (dst_vector != NULL)
+    {
+      ierr = put_vector(t_buff, dest, dst_vector, dst_size, size,
+                        remote_image, offset, *p); chk_err(ierr);
+    }
+    else
+    {
+      MPI_Datatype dt_s, dt_d;
+      MPI_Aint dt_lb, dt_extent;
 
-          array_offset_dst += (i / tot_ext) * dest->dim[dst_rank - 1]._stride;
-        }
-        else
-        {
-          switch (dst_vector->u.v.kind)
-          {
-            // KINDCASE is defined above.
-            KINDCASE(1, int8_t);
-            KINDCASE(2, int16_t);
-            KINDCASE(4, int32_t);
-            KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-            KINDCASE(16, __int128);
-#endif
-            default:
-              caf_runtime_error(unreachable);
-              return;
-          }
-#undef KINDCASE
-        }
-        dst_offset = array_offset_dst * dst_size;
-        memmove(dest->base_addr + dst_offset, t_buff + i * dst_size, dst_size);
-      }
+      get_array_type(NULL, dst_size, size, &dt_s);
+      get_array_type(dest, dst_size, size, &dt_d);
+      ierr = MPI_Type_get_true_extent(dt_d, &dt_lb, &dt_extent);
+      chk_err(ierr);
+
+      CAF_Win_lock_put(remote_image, offset + dt_lb, dt_extent, *p);
+      ierr = MPI_Put(t_buff, 1, dt_s, remote_image, offset, 1, dt_d, *p);
+      chk_err(ierr);
+      CAF_Win_unlock_put(remote_image, offset + dt_lb, dt_extent, *p);
     }
   }
-
   /* Free memory, when not allocated on stack. */
   if (free_t_buff)
-    free(t_buff);
+    staging_free(t_buff);
   if (free_pad_str)
     free(pad_str);
 
@@ -3425,6 +5471,11 @@ PREFIX(get) (caf_token_t token, size_t offset, int image_index,
              gfc_descriptor_t *dest, int src_kind, int dst_kind,
              bool mrt, int *pstat)
 {
+  if (src_vector == NULL
+      && scalar_transfer(false, token, offset, image_index, src, dest,
+                         src_kind, dst_kind, pstat))
+    return;
+
   int j, ierr = 0;
   size_t i, size;
   const int
@@ -3444,23 +5495,14 @@ PREFIX(get) (caf_token_t token, size_t offset, int image_index,
     same_type_and_kind = dst_type == src_type && dst_kind == src_kind;
 
   MPI_Win *p = TOKEN(token);
-  ptrdiff_t dimextent, src_offset = 0;
+  ptrdiff_t dimextent;
   void *pad_str = NULL, *t_buff = NULL;
   bool free_pad_str = false, free_t_buff = false;
   const bool dest_char_array_is_longer
       = dst_type == BT_CHARACTER && dst_size > src_size && !same_image;
   int remote_image = image_index - 1;
   if (!same_image)
-  {
-    MPI_Group current_team_group, win_group;
-    ierr = MPI_Comm_group(CAF_COMM_WORLD, &current_team_group); chk_err(ierr);
-    ierr = MPI_Win_get_group(*p, &win_group); chk_err(ierr);
-    ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                     (int[]){remote_image}, win_group,
-                                     &remote_image); chk_err(ierr);
-    ierr = MPI_Group_free(&current_team_group); chk_err(ierr);
-    ierr = MPI_Group_free(&win_group); chk_err(ierr);
-  }
+    remote_image = translate_rank(*p, remote_image);
 
   /* Ensure stat is always set. */
 #ifdef GCC_GE_7
@@ -3472,6 +5514,23 @@ PREFIX(get) (caf_token_t token, size_t offset, int image_index,
   int * stat = NULL;
 #endif
 
+#ifdef CAF_NODE_SHARED_MEMORY
+  /* The memory of images on this node is read like that of this image. */
+  if (!same_image)
+  {
+    gfc_max_dim_descriptor_t node_src;
+    void *node_mem = node_address(token, image_index, offset);
+
+    if (node_mem != NULL)
+    {
+      PREFIX(get) (token, offset, caf_this_image,
+                   rebase_descriptor(&node_src, src, node_mem), src_vector,
+                   dest, src_kind, dst_kind, mrt, pstat);
+      return;
+    }
+  }
+#endif // CAF_NODE_SHARED_MEMORY
+
   size = 1;
   for (j = 0; j < dst_rank; ++j)
   {
@@ -3488,6 +5547,13 @@ PREFIX(get) (caf_token_t token, size_t offset, int image_index,
          src_vector, image_index, offset);
   check_image_health(image_index, stat);
 
+  if (same_image)
+  {
+    copy_local(dest, NULL, dst_kind, src, src_vector, src_kind, size, mrt,
+               stat);
+    return;
+  }
+
   /* For char arrays: create the padding array, when dst is longer than src. */
   if (dest_char_array_is_longer)
   {
@@ -3514,402 +5580,138 @@ PREFIX(get) (caf_token_t token, size_t offset, int image_index,
     }
   }
 
-  if (src_contiguous && dst_contiguous && src_vector == NULL)
-  {
-    if (same_image)
-    {
-      dprint("in caf_this == image_index, size = %zd, "
-             "dst_kind = %d, src_kind = %d\n",
-             size, dst_kind, src_kind);
-      if (dst_type == BT_CHARACTER)
-        /* The size is encoded in the descriptor's type for char arrays. */
-        copy_char_to_self(src->base_addr, src_type, src_size, src_kind,
-                          dest->base_addr, dst_type, dst_size, dst_kind,
-                          size, src_rank == 0);
-      else
-        copy_to_self(src, src_kind, dest, dst_kind, size, stat);
-      return;
-    }
-    else
-    {
-      if (dst_kind != src_kind || dest_char_array_is_longer || src_rank == 0)
-      {
-        if ((free_t_buff = ((t_buff = alloca(src_size * size)) == NULL)))
-        {
-          t_buff = malloc(src_size * size);
-          if (t_buff == NULL)
-            caf_runtime_error("Unable to allocate memory "
-                              "for internal buffer in get().");
-        }
-      }
-
-      if ((same_type_and_kind && dst_rank == src_rank)
-          || dst_type == BT_CHARACTER)
-      {
-        if (!dest_char_array_is_longer
-            && (dst_kind == src_kind || dst_type != BT_CHARACTER))
-        {
-          const size_t trans_size =
-            ((dst_size > src_size) ? src_size : dst_size) * size;
-          CAF_Win_lock(MPI_LOCK_SHARED, remote_image, *p);
-          ierr = MPI_Get(dest->base_addr, trans_size, MPI_BYTE, remote_image,
-                         offset, trans_size, MPI_BYTE, *p); chk_err(ierr);
-          CAF_Win_unlock(remote_image, *p);
-        }
-        else
-        {
-          CAF_Win_lock(MPI_LOCK_SHARED, remote_image, *p);
-          ierr = MPI_Get(t_buff, src_size, MPI_BYTE, remote_image,
-                         offset, src_size, MPI_BYTE, *p); chk_err(ierr);
-          CAF_Win_unlock(remote_image, *p);
-          copy_char_to_self(t_buff, src_type, src_size, src_kind,
-                            dest->base_addr, dst_type, dst_size,
-                            dst_kind, size, src_rank == 0);
-        }
-      }
-      else
-      {
-        CAF_Win_lock(MPI_LOCK_SHARED, remote_image, *p);
-        ierr = MPI_Get(t_buff, src_size * size, MPI_BYTE, remote_image, offset,
-                       src_size * size, MPI_BYTE, *p); chk_err(ierr);
-        CAF_Win_unlock(remote_image, *p);
-        convert_with_strides(dest->base_addr, dst_type, dst_kind, dst_size,
-                             t_buff, src_type, src_kind,
-                             (src_rank > 0) ? src_size: 0, size, stat);
-      }
-    }
-  }
-#ifdef STRIDED
-  else if (!same_image && same_type_and_kind && dst_type != BT_CHARACTER)
-  {
-    /* For strided copy, no type and kind conversion, copy to self or
-     * character arrays are supported. */
-    MPI_Datatype dt_s, dt_d, base_type_src, base_type_dst;
-    int *arr_bl;
-    int *arr_dsp_s, *arr_dsp_d;
-
-    selectType(src_size, &base_type_src);
-    selectType(dst_size, &base_type_dst);
-
-    if (src_rank == 1)
-    {
-      if (src_vector == NULL)
-      {
-        dprint("Setting up mpi datatype vector with stride %d, "
-               "size %d and offset %d.\n",
-               src->dim[0]._stride, size, offset);
-        ierr = MPI_Type_vector(size, 1, src->dim[0]._stride, base_type_src,
-                               &dt_s); chk_err(ierr);
-      }
-      else
-      {
-        arr_bl = calloc(size, sizeof(int));
-        arr_dsp_s = calloc(size, sizeof(int));
-
-        dprint("Setting up strided vector index.\n",
-               caf_this_image, caf_num_images, __FUNCTION__);
-#define KINDCASE(kind, type)                                            \
-case kind:                                                              \
-  for (i = 0; i < size; ++i)                                            \
-  {                                                                     \
-    arr_dsp_s[i] = ((ptrdiff_t)                                         \
-      ((type *) src_vector->u.v.vector)[i] - src->dim[0].lower_bound);  \
-    arr_bl[i] = 1;                                                      \
-  }                                                                     \
-  break
-        switch (src_vector->u.v.kind)
-        {
-          KINDCASE(1, int8_t);
-          KINDCASE(2, int16_t);
-          KINDCASE(4, int32_t);
-          KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-          KINDCASE(16, __int128);
-#endif
-        default:
-          caf_runtime_error(unreachable);
-          return;
-        }
-#undef KINDCASE
-        ierr = MPI_Type_indexed(size, arr_bl, arr_dsp_s, base_type_src, &dt_s);
-        chk_err(ierr);
-        free(arr_bl);
-        free(arr_dsp_s);
-      }
-      ierr = MPI_Type_vector(size, 1, dest->dim[0]._stride, base_type_dst,
-                             &dt_d); chk_err(ierr);
-    }
-    else
-    {
-      arr_bl = calloc(size, sizeof(int));
-      arr_dsp_s = calloc(size, sizeof(int));
-      arr_dsp_d = calloc(size, sizeof(int));
-
-      for (i = 0; i < size; ++i)
-      {
-        arr_bl[i] = 1;
-      }
-
-      for (i = 0; i < size; ++i)
-      {
-        ptrdiff_t array_offset_sr = 0, extent = 1, tot_ext = 1;
-        if (src_vector == NULL)
-        {
-          for (j = 0; j < src_rank - 1; ++j)
-          {
-            extent = src->dim[j]._ubound - src->dim[j].lower_bound + 1;
-            array_offset_sr += ((i / tot_ext) % extent) * src->dim[j]._stride;
-            tot_ext *= extent;
-          }
-
-          array_offset_sr += (i / tot_ext) * src->dim[src_rank - 1]._stride;
-        }
-        else
-        {
-#define KINDCASE(kind, type)                                          \
-case kind:                                                            \
-  array_offset_sr = ((ptrdiff_t)                                      \
-    ((type *) src_vector->u.v.vector)[i] - src->dim[0].lower_bound);  \
-  break
-          switch (src_vector->u.v.kind)
-          {
-            KINDCASE(1, int8_t);
-            KINDCASE(2, int16_t);
-            KINDCASE(4, int32_t);
-            KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-            KINDCASE(16, __int128);
-#endif
-            default:
-              caf_runtime_error(unreachable);
-              return;
-          }
-#undef KINDCASE
-        }
-        arr_dsp_s[i] = array_offset_sr;
-
-        if (dst_rank != 0)
-        {
-          ptrdiff_t array_offset_dst = 0;
-          extent = 1;
-          tot_ext = 1;
-          for (j = 0; j < dst_rank - 1; ++j)
-          {
-            extent = dest->dim[j]._ubound - dest->dim[j].lower_bound + 1;
-            array_offset_dst += ((i / tot_ext) % extent) * dest->dim[j]._stride;
-            tot_ext *= extent;
-          }
-
-          array_offset_dst += (i / tot_ext) * dest->dim[src_rank - 1]._stride;
-          arr_dsp_d[i] = array_offset_dst;
-        }
-        else
-          arr_dsp_d[i] = 0;
-      }
-
-      ierr = MPI_Type_indexed(size, arr_bl, arr_dsp_s, base_type_src, &dt_s);
-      chk_err(ierr);
-      ierr = MPI_Type_indexed(size, arr_bl, arr_dsp_d, base_type_dst, &dt_d);
-      chk_err(ierr);
-
-      free(arr_bl);
-      free(arr_dsp_s);
-      free(arr_dsp_d);
-    }
-
-    ierr = MPI_Type_commit(&dt_s); chk_err(ierr);
-    ierr = MPI_Type_commit(&dt_d); chk_err(ierr);
-
-    CAF_Win_lock(MPI_LOCK_SHARED, remote_image, *p);
-    ierr = MPI_Get(dest->base_addr, 1, dt_d, remote_image, offset, 1, dt_s, *p);
-    chk_err(ierr);
-    CAF_Win_unlock(remote_image, *p);
-
-#ifdef WITH_FAILED_IMAGES
-    check_image_health(image_index, stat);
-
-    if (!stat && ierr == STAT_FAILED_IMAGE)
-      terminate_internal(ierr, 1);
-
-    if (stat)
-      *stat = ierr;
-#else
-    if (ierr != 0)
-    {
-      terminate_internal(ierr, 1);
-      return;
-    }
-#endif
-    ierr = MPI_Type_free(&dt_s); chk_err(ierr);
-    ierr = MPI_Type_free(&dt_d); chk_err(ierr);
-  }
-#endif // STRIDED
-  else
-  {
-    if (same_image && mrt)
-    {
-      if ((free_t_buff = (((t_buff = alloca(src_size * size))) == NULL)))
-      {
-        t_buff = malloc(src_size * size);
-        if (t_buff == NULL)
-          caf_runtime_error("Unable to allocate memory "
-                            "for internal buffer in get().");
-      }
-    }
-    else if (!same_type_and_kind && !same_image)
-    {
-      if ((free_t_buff = (((t_buff = alloca(src_size))) == NULL)))
-      {
-        t_buff = malloc(src_size);
-        if (t_buff == NULL)
-          caf_runtime_error("Unable to allocate memory "
-                            "for internal buffer in get().");
-      }
-    }
-
-    for (i = 0; i < size; ++i)
-    {
-      ptrdiff_t array_offset_sr = 0, extent = 1, tot_ext = 1;
-      if (src_vector == NULL)
-      {
-        for (j = 0; j < src_rank - 1; ++j)
-        {
-          extent = src->dim[j]._ubound - src->dim[j].lower_bound + 1;
-          array_offset_sr += ((i / tot_ext) % extent) * src->dim[j]._stride;
-          tot_ext *= extent;
-        }
-
-        array_offset_sr += (i / tot_ext) * src->dim[src_rank - 1]._stride;
-      }
-      else
-      {
-#define KINDCASE(kind, type)                                        \
-case kind:                                                          \
-  array_offset_sr = ((ptrdiff_t)                                    \
-    ((type *)src_vector->u.v.vector)[i] - src->dim[0].lower_bound); \
-  break
-        switch (src_vector->u.v.kind)
-        {
-          KINDCASE(1, int8_t);
-          KINDCASE(2, int16_t);
-          KINDCASE(4, int32_t);
-          KINDCASE(8, int64_t);
-#ifdef HAVE_GFC_INTEGER_16
-          KINDCASE(16, __int128);
-#endif
-          default:
-            caf_runtime_error(unreachable);
-            return;
-        }
-      }
-      src_offset = array_offset_sr * src_size;
-#undef KINDCASE
-
-      void *dst;
-      if (!same_image || !mrt)
-      {
-        if (dst_rank != 0)
-        {
-          ptrdiff_t array_offset_dst = 0;
-          extent = 1;
-          tot_ext = 1;
-          for (j = 0; j < dst_rank - 1; ++j)
-          {
-            extent = dest->dim[j]._ubound - dest->dim[j].lower_bound + 1;
-            array_offset_dst += ((i / tot_ext) % extent) * dest->dim[j]._stride;
-            tot_ext *= extent;
-          }
-
-          array_offset_dst += (i / tot_ext) * dest->dim[dst_rank - 1]._stride;
-          dst = (void *)((char *)dest->base_addr + array_offset_dst * dst_size);
-        }
-        else
-          dst = dest->base_addr;
-       }
-
-      if (!same_image)
-      {
-        // Do the more likely first.
-        dprint("kind(dst) = %d, el_sz(dst) = %zd, "
-               "kind(src) = %d, el_sz(src) = %zd, lb(dst) = %zd.\n",
-               dst_kind, dst_size, src_kind, src_size, src->dim[0].lower_bound);
-        if (same_type_and_kind)
-        {
-          const size_t trans_size = (src_size < dst_size) ? src_size : dst_size;
-          CAF_Win_lock(MPI_LOCK_SHARED, remote_image, *p);
-          ierr = MPI_Get(dst, trans_size, MPI_BYTE, remote_image,
-                         offset + src_offset, trans_size, MPI_BYTE, *p);
-          CAF_Win_unlock(remote_image, *p);
-          chk_err(ierr);
-          if (pad_str)
-            memcpy((void *)((char *)dst + src_size), pad_str,
-                   dst_size - src_size);
-        }
-        else if (dst_type == BT_CHARACTER)
-        {
-          CAF_Win_lock(MPI_LOCK_SHARED, remote_image, *p);
-          ierr = MPI_Get(t_buff, src_size, MPI_BYTE, remote_image,
-                         offset + src_offset, src_size, MPI_BYTE, *p);
-          CAF_Win_unlock(remote_image, *p);
-          chk_err(ierr);
-          copy_char_to_self(t_buff, src_type, src_size, src_kind,
-                            dst, dst_type, dst_size, dst_kind, 1, true);
-        }
-        else
-        {
-          CAF_Win_lock(MPI_LOCK_SHARED, remote_image, *p);
-          ierr = MPI_Get(t_buff, src_size, MPI_BYTE, remote_image,
-                         offset + src_offset, src_size, MPI_BYTE, *p);
-          CAF_Win_unlock(remote_image, *p);
-          chk_err(ierr);
-          convert_type(dst, dst_type, dst_kind, t_buff,
-                       src_type, src_kind, stat);
-        }
-      }
-      else
-      {
-        if (!mrt)
-        {
-          dprint("strided same_image, no temp, for i = %zd, "
-                 "src_offset = %zd, offset = %zd.\n",
-                 i, src_offset, offset);
-          if (same_type_and_kind)
-            memmove(dst, src->base_addr + src_offset, src_size);
-          else
-            convert_type(dst, dst_type, dst_kind,
-                         src->base_addr + src_offset, src_type, src_kind, stat);
-        }
-        else
-        {
-          dprint("strided same_image, *WITH* temp, for i = %zd.\n", i);
-          if (same_type_and_kind)
-            memmove(t_buff + i * dst_size,
-                    src->base_addr + src_offset, src_size);
-          else
-            convert_type(t_buff + i * dst_size, dst_type, dst_kind,
-                         src->base_addr + src_offset, src_type, src_kind, stat);
-        }
-      }
+  if (src_contiguous && dst_contiguous && src_vector == NULL)
+  {
+    if (dst_kind != src_kind || dest_char_array_is_longer || src_rank == 0)
+    {
+      t_buff = staging_alloc(src_size * size);
+      free_t_buff = true;
+    }
 
-#ifndef WITH_FAILED_IMAGES
-      if (ierr != 0)
+    if ((same_type_and_kind && dst_rank == src_rank)
+        || dst_type == BT_CHARACTER)
+    {
+      if (!dest_char_array_is_longer
+          && (dst_kind == src_kind || dst_type != BT_CHARACTER))
       {
-        caf_runtime_error("MPI Error: %d", ierr);
-        return;
+        const size_t trans_size =
+          ((dst_size > src_size) ? src_size : dst_size) * size;
+        CAF_Win_lock_get(remote_image, offset, trans_size, *p);
+        ierr = get_bytes(dest->base_addr, trans_size, remote_image, offset,
+                         *p); chk_err(ierr);
+        CAF_Win_unlock_local(remote_image, *p);
       }
-#endif
+      else
+      {
+        CAF_Win_lock_get(remote_image, offset, src_size, *p);
+        ierr = get_bytes(t_buff, src_size, remote_image, offset, *p);
+        chk_err(ierr);
+        CAF_Win_unlock_local(remote_image, *p);
+        copy_char_to_self(t_buff, src_type, src_size, src_kind,
+                          dest->base_addr, dst_type, dst_size,
+                          dst_kind, size, src_rank == 0);
+      }
+    }
+    else
+    {
+      CAF_Win_lock_get(remote_image, offset, src_size * size, *p);
+      ierr = get_bytes(t_buff, src_size * size, remote_image, offset, *p);
+      chk_err(ierr);
+      CAF_Win_unlock_local(remote_image, *p);
+      convert_with_strides(dest->base_addr, dst_type, dst_kind, dst_size,
+                           t_buff, src_type, src_kind,
+                           (src_rank > 0) ? src_size: 0, size, stat);
     }
+  }
+#ifdef STRIDED
+  else if (same_type_and_kind && dst_type != BT_CHARACTER
+           && src_vector == NULL)
+  {
+    /* For strided copy, no type and kind conversion, copy to self or
+     * character arrays are supported.  Vector subscripts are fetched into
+     * the staging buffer below. */
+    MPI_Datatype dt_s, dt_d;
+    MPI_Aint dt_lb, dt_extent;
+
+    get_array_type(src, src_size, size, &dt_s);
+    get_array_type(dest, dst_size, size, &dt_d);
+    ierr = MPI_Type_get_true_extent(dt_s, &dt_lb, &dt_extent); chk_err(ierr);
+
+    CAF_Win_lock_get(remote_image, offset + dt_lb, dt_extent, *p);
+    ierr = MPI_Get(dest->base_addr, 1, dt_d, remote_image, offset, 1, dt_s, *p);
+    chk_err(ierr);
+    CAF_Win_unlock_local(remote_image, *p);
 
-    if (same_image && mrt)
+#ifdef WITH_FAILED_IMAGES
+    check_image_health(image_index, stat);
+
+    if (!stat && ierr == STAT_FAILED_IMAGE)
+      terminate_internal(ierr, 1);
+
+    if (stat)
+      *stat = ierr;
+#else
+    if (ierr != 0)
     {
-      dprint("Same image temporary move.\n");
-      memmove(dest->base_addr, t_buff, size * dst_size);
+      terminate_internal(ierr, 1);
+      return;
     }
+#endif
   }
+#endif // STRIDED
+  else
+  {
+    /* Fetch all elements with a single get into one staging buffer and
+     * convert them in one go, directly into a contiguous dest, otherwise into
+     * the staging buffer behind them, from where they are scattered. */
+    const size_t buff_size =
+      (src_size + (dst_contiguous ? 0 : dst_size)) * size;
+    void *unpacked;
+
+    t_buff = staging_alloc(buff_size);
+    free_t_buff = true;
+    dprint("kind(dst) = %d, el_sz(dst) = %zd, "
+           "kind(src) = %d, el_sz(src) = %zd, lb(dst) = %zd.\n",
+           dst_kind, dst_size, src_kind, src_size, src->dim[0].lower_bound);
+    if (src_contiguous && src_vector == NULL)
+    {
+      CAF_Win_lock_get(remote_image, offset, src_size * size, *p);
+      ierr = get_bytes(t_buff, src_size * size, remote_image, offset, *p);
+      chk_err(ierr);
+      CAF_Win_unlock_local(remote_image, *p);
+    }
+    else if (src_vector != NULL)
+    {
+      ierr = get_vector(t_buff, src, src_vector, src_size, size,
+                        remote_image, offset, *p); chk_err(ierr);
+    }
+    else
+    {
+      MPI_Datatype dt_s, dt_d;
+      MPI_Aint dt_lb, dt_extent;
+
+      get_array_type(src, src_size, size, &dt_s);
+      get_array_type(NULL, src_size, size, &dt_d);
+      ierr = MPI_Type_get_true_extent(dt_s, &dt_lb, &dt_extent);
+      chk_err(ierr);
+      CAF_Win_lock_get(remote_image, offset + dt_lb, dt_extent, *p);
+      ierr = MPI_Get(t_buff, 1, dt_d, remote_image, offset, 1, dt_s, *p);
+      chk_err(ierr);
+      CAF_Win_unlock_local(remote_image, *p);
+    }
 
+    unpacked = dst_contiguous ? dest->base_addr
+                              : (void *)((char *)t_buff + src_size * size);
+    convert_elements(unpacked, dst_type, dst_kind, dst_size,
+                     t_buff, src_type, src_kind, src_size, size, false, stat);
+    if (!dst_contiguous)
+      for (i = 0; i < size; ++i)
+        memcpy((char *)dest->base_addr + element_offset(dest, i) * dst_size,
+               (char *)unpacked + i * dst_size, dst_size);
+  }
   /* Free memory, when not allocated on stack. */
   if (free_t_buff)
-    free(t_buff);
+    staging_free(t_buff);
   if (free_pad_str)
     free(pad_str);
 
@@ -3937,6 +5739,250 @@ case kind:                                                          \
 
 
 #ifdef GCC_GE_7
+/* Transfer plan of the *_by_ref routines.  The reference walkers get_for_ref()
+ * and send_for_ref() visit the elements of a section one by one.  While a plan
+ * is open, get_data() and put_data() only record the remote displacement and
+ * local address of each element.  Closing the plan moves all recorded
+ * elements with one RMA operation, whose target datatype describes the
+ * elements coalesced into contiguous runs.  Elements with other transfer
+ * parameters than the recorded ones close the pending transfer first. */
+typedef struct ref_plan_t
+{
+  bool open, put;
+  MPI_Win win;
+  int rank, dst_type, src_type, dst_kind, src_kind, *stat;
+  size_t dst_size, src_size;
+  /* The number of elements recorded and the capacity of the arrays. */
+  size_t n, cap;
+  /* Remote displacement, local address and item count of each element. */
+  MPI_Aint *disp;
+  char **local;
+  size_t *num;
+  /* The runs of the target datatype, at most nruns_max of run_cap used. */
+  size_t nruns_max, run_cap;
+  int *run_len;
+  MPI_Aint *run_disp;
+} ref_plan_t;
+
+static ref_plan_t ref_plan;
+
+static void
+open_ref_plan(bool put)
+{
+  ref_plan.open = true;
+  ref_plan.put = put;
+  ref_plan.n = 0;
+}
+
+/* Move the elements recorded in the plan. */
+
+static void
+execute_ref_plan(void)
+{
+  ref_plan_t *p = &ref_plan;
+  /* The size of an item at the remote side. */
+  const size_t item_size = p->put ? p->dst_size : p->src_size;
+  size_t k, first, total = 0, nruns = 0;
+  MPI_Aint lo, hi, run_end = 0;
+  MPI_Datatype target_type, origin_type;
+  char *buf, *cur, *self;
+  int ierr;
+
+  if (p->n == 0)
+    return;
+
+  /* Coalesce the elements into runs of at most large_count_limit bytes. */
+  lo = hi = p->disp[0];
+  for (k = 0; k < p->n; ++k)
+  {
+    size_t bytes = item_size * p->num[k];
+    MPI_Aint disp = p->disp[k];
+
+    total += bytes;
+    lo = MIN(lo, disp);
+    hi = MAX(hi, MPI_Aint_add(disp, bytes));
+    while (bytes > 0)
+    {
+      size_t len = MIN(bytes, large_count_block);
+
+      if (nruns > 0 && disp == run_end
+          && (size_t)p->run_len[nruns - 1] + len <= large_count_limit)
+        p->run_len[nruns - 1] += len;
+      else
+      {
+        p->run_len[nruns] = len;
+        p->run_disp[nruns] = disp;
+        ++nruns;
+      }
+      disp = MPI_Aint_add(disp, len);
+      run_end = disp;
+      bytes -= len;
+    }
+  }
+  dprint("ref plan: %zd elements, %zd runs, %zd bytes, %s.\n",
+         p->n, nruns, total, p->put ? "put" : "get");
+
+  buf = staging_alloc(total);
+  if (p->put)
+  {
+    /* Pack consecutive elements with contiguous local addresses at once. */
+    for (k = first = 0, cur = buf; k < p->n; ++k)
+      if (k + 1 == p->n
+          || p->local[k + 1] != p->local[k] + p->src_size * p->num[k])
+      {
+        size_t num = 0, j;
+
+        for (j = first; j <= k; ++j)
+          num += p->num[j];
+        convert_elements(cur, p->dst_type, p->dst_kind, p->dst_size,
+                         p->local[first], p->src_type, p->src_kind,
+                         p->src_size, num, false, p->stat);
+        cur += p->dst_size * num;
+        first = k + 1;
+      }
+  }
+
+  for (k = 0; k < nruns; ++k)
+    p->run_disp[k] -= lo;
+  if ((self = self_address(p->win, p->rank, lo)))
+  {
+    /* The target is this image, copy the runs directly. */
+    for (k = 0, cur = buf; k < nruns; cur += p->run_len[k++])
+      if (p->put)
+        memcpy(self + p->run_disp[k], cur, p->run_len[k]);
+      else
+        memcpy(cur, self + p->run_disp[k], p->run_len[k]);
+  }
+  else
+  {
+    if (nruns == 1)
+    {
+      ierr = MPI_Type_contiguous(p->run_len[0], MPI_BYTE, &target_type);
+      chk_err(ierr);
+    }
+    else
+    {
+      ierr = MPI_Type_create_hindexed(nruns, p->run_len, p->run_disp,
+                                      MPI_BYTE, &target_type); chk_err(ierr);
+    }
+    ierr = MPI_Type_commit(&target_type); chk_err(ierr);
+    bytes_type(total, &origin_type);
+    ierr = MPI_Type_commit(&origin_type); chk_err(ierr);
+
+    if (p->put)
+    {
+      CAF_Win_lock_put(p->rank, lo, hi - lo, p->win);
+      ierr = MPI_Put(buf, 1, origin_type, p->rank, lo, 1, target_type,
+                     p->win); chk_err(ierr);
+      CAF_Win_unlock_put(p->rank, lo, hi - lo, p->win);
+    }
+    else
+    {
+      CAF_Win_lock_get(p->rank, lo, hi - lo, p->win);
+      ierr = MPI_Get(buf, 1, origin_type, p->rank, lo, 1, target_type,
+                     p->win); chk_err(ierr);
+      CAF_Win_unlock_local(p->rank, p->win);
+    }
+    ierr = MPI_Type_free(&target_type); chk_err(ierr);
+    ierr = MPI_Type_free(&origin_type); chk_err(ierr);
+  }
+
+  if (!p->put)
+  {
+    /* Unpack into consecutive elements with contiguous local addresses at
+     * once. */
+    for (k = first = 0, cur = buf; k < p->n; ++k)
+      if (k + 1 == p->n
+          || p->local[k + 1] != p->local[k] + p->dst_size * p->num[k])
+      {
+        size_t num = 0, j;
+
+        for (j = first; j <= k; ++j)
+          num += p->num[j];
+        convert_elements(p->local[first], p->dst_type, p->dst_kind,
+                         p->dst_size, cur, p->src_type, p->src_kind,
+                         p->src_size, num, false, p->stat);
+        cur += p->src_size * num;
+        first = k + 1;
+      }
+  }
+  staging_free(buf);
+  p->n = 0;
+}
+
+static void
+close_ref_plan(void)
+{
+  execute_ref_plan();
+  ref_plan.open = false;
+}
+
+/* Record an element of the open plan. */
+
+static void
+plan_element(MPI_Win win, int rank, MPI_Aint disp, void *local, int dst_type,
+             int src_type, int dst_kind, int src_kind, size_t dst_size,
+             size_t src_size, size_t num, int *stat)
+{
+  ref_plan_t *p = &ref_plan;
+  /* The number of runs an element may need. */
+  const size_t max_runs =
+    ((p->put ? dst_size : src_size) * num) / large_count_block + 1;
+
+  if (p->n > 0
+      && (p->win != win || p->rank != rank || p->dst_type != dst_type
+          || p->src_type != src_type || p->dst_kind != dst_kind
+          || p->src_kind != src_kind || p->dst_size != dst_size
+          || p->src_size != src_size || p->stat != stat))
+    execute_ref_plan();
+  if (p->n == 0)
+  {
+    p->win = win;
+    p->rank = rank;
+    p->dst_type = dst_type;
+    p->src_type = src_type;
+    p->dst_kind = dst_kind;
+    p->src_kind = src_kind;
+    p->dst_size = dst_size;
+    p->src_size = src_size;
+    p->stat = stat;
+    p->nruns_max = 0;
+  }
+  if (p->n == p->cap)
+  {
+    p->cap = p->cap ? 2 * p->cap : 64;
+    p->disp = (MPI_Aint *)realloc(p->disp, p->cap * sizeof(MPI_Aint));
+    p->local = (char **)realloc(p->local, p->cap * sizeof(char *));
+    p->num = (size_t *)realloc(p->num, p->cap * sizeof(size_t));
+    if (!p->disp || !p->local || !p->num)
+      caf_runtime_error("Unable to allocate the transfer plan.");
+  }
+  p->nruns_max += max_runs;
+  if (p->nruns_max > p->run_cap)
+  {
+    p->run_cap = MAX(2 * p->run_cap, p->nruns_max);
+    p->run_len = (int *)realloc(p->run_len, p->run_cap * sizeof(int));
+    p->run_disp = (MPI_Aint *)realloc(p->run_disp, p->run_cap * sizeof(MPI_Aint));
+    if (!p->run_len || !p->run_disp)
+      caf_runtime_error("Unable to allocate the transfer plan.");
+  }
+  p->disp[p->n] = disp;
+  p->local[p->n] = local;
+  p->num[p->n] = num;
+  ++p->n;
+}
+
+static void
+free_ref_plan(void)
+{
+  free(ref_plan.disp);
+  free(ref_plan.local);
+  free(ref_plan.num);
+  free(ref_plan.run_len);
+  free(ref_plan.run_disp);
+  memset(&ref_plan, 0, sizeof(ref_plan));
+}
+
 /* Get a chunk of data from one image to the current one, with type conversion.
  *
  * Copied from the gcc:libgfortran/caf/single.c. Can't say much about it. */
@@ -3948,6 +5994,13 @@ get_data(void *ds, mpi_caf_token_t *token, MPI_Aint offset, int dst_type,
   size_t k;
   int ierr;
   MPI_Win win = (token == NULL) ? global_dynamic_win : token->memptr_win;
+
+  if (ref_plan.open)
+  {
+    plan_element(win, image_index, offset, ds, dst_type, src_type, dst_kind,
+                 src_kind, dst_size, src_size, num, stat);
+    return;
+  }
 #ifdef EXTRA_DEBUG_OUTPUT
   if (token)
     dprint("%p = win(%d): %d -> offset: %zd of size %zd -> %zd, "
@@ -3963,9 +6016,7 @@ get_data(void *ds, mpi_caf_token_t *token, MPI_Aint offset, int dst_type,
   if (dst_type == src_type && dst_kind == src_kind)
   {
     size_t sz = ((dst_size > src_size) ? src_size : dst_size) * num;
-    CAF_Win_lock(MPI_LOCK_SHARED, image_index, win);
-    ierr = MPI_Get(ds, sz, MPI_BYTE, image_index, offset, sz, MPI_BYTE, win);
-    CAF_Win_unlock(image_index, win);
+    ierr = get_window_bytes(ds, sz, image_index, offset, win);
     chk_err(ierr);
     if ((dst_type == BT_CHARACTER || src_type == BT_CHARACTER)
         && dst_size > src_size)
@@ -3983,42 +6034,35 @@ get_data(void *ds, mpi_caf_token_t *token, MPI_Aint offset, int dst_type,
   }
   else if (dst_type == BT_CHARACTER && dst_kind == 1)
   {
-    /* Get the required amount of memory on the stack. */
-    void *srh = alloca(src_size);
-    CAF_Win_lock(MPI_LOCK_SHARED, image_index, win);
-    ierr = MPI_Get(srh, src_size, MPI_BYTE, image_index, offset, src_size,
-                   MPI_BYTE, win); chk_err(ierr);
-    CAF_Win_unlock(image_index, win);
+    /* Get the staging buffer from the arena. */
+    void *srh = staging_alloc(src_size);
+    ierr = get_window_bytes(srh, src_size, image_index, offset, win);
+    chk_err(ierr);
     assign_char1_from_char4(dst_size, src_size, ds, srh);
+    staging_free(srh);
   }
   else if (dst_type == BT_CHARACTER)
   {
-    /* Get the required amount of memory on the stack. */
-    void *srh = alloca(src_size);
-    CAF_Win_lock(MPI_LOCK_SHARED, image_index, win);
-    ierr = MPI_Get(srh, src_size, MPI_BYTE, image_index, offset, src_size,
-                   MPI_BYTE, win); chk_err(ierr);
-    CAF_Win_unlock(image_index, win);
+    /* Get the staging buffer from the arena. */
+    void *srh = staging_alloc(src_size);
+    ierr = get_window_bytes(srh, src_size, image_index, offset, win);
+    chk_err(ierr);
     assign_char4_from_char1(dst_size, src_size, ds, srh);
+    staging_free(srh);
   }
   else
   {
-    /* Get the required amount of memory on the stack. */
-    void *srh = alloca(src_size * num);
+    /* Get the staging buffer from the arena. */
+    void *srh = staging_alloc(src_size * num);
     dprint("type/kind convert %zd items: "
            "type %d(%d) -> type %d(%d), local buffer: %p\n",
            num, src_type, src_kind, dst_type, dst_kind, srh);
-    CAF_Win_lock(MPI_LOCK_SHARED, image_index, win);
-    ierr = MPI_Get(srh, src_size * num, MPI_BYTE, image_index, offset,
-                   src_size * num, MPI_BYTE, win); chk_err(ierr);
-    CAF_Win_unlock(image_index, win);
+    ierr = get_window_bytes(srh, src_size * num, image_index, offset, win);
+    chk_err(ierr);
     dprint("srh[0] = %d, ierr = %d\n", (int)((char *)srh)[0], ierr);
-    for (k = 0; k < num; ++k)
-    {
-      convert_type(ds, dst_type, dst_kind, srh, src_type, src_kind, stat);
-      ds += dst_size;
-      srh += src_size;
-    }
+    convert_with_strides(ds, dst_type, dst_kind, dst_size,
+                         srh, src_type, src_kind, src_size, num, stat);
+    staging_free(srh);
   }
 }
 
@@ -4044,19 +6088,6 @@ do                                                              \
 ((desc)->dim[i]._ubound + 1 - (desc)->dim[i].lower_bound)
 
 
-#define sizeof_desc_for_rank(rank) \
-(sizeof(gfc_descriptor_t) + (rank) * sizeof(descriptor_dimension))
-
-/* Define the descriptor of max rank.
- * 
- *  This typedef is made to allow storing a copy of a remote descriptor on the
- *  stack without having to care about the rank. */
-typedef struct gfc_max_dim_descriptor_t
-{
-  gfc_descriptor_t base;
-  descriptor_dimension dim[GFC_MAX_DIMENSIONS];
-} gfc_max_dim_descriptor_t;
-
 typedef struct gfc_dim1_descriptor_t
 {
   gfc_descriptor_t base;
@@ -4111,21 +6142,16 @@ get_for_ref(caf_reference_t *ref, size_t *i, size_t dst_index,
           sr_byte_offset += ref->u.c.offset;
           if (sr_global)
           {
-            CAF_Win_lock(MPI_LOCK_SHARED, global_dynamic_win_rank, global_dynamic_win);
-            ierr = MPI_Get(&sr, stdptr_size, MPI_BYTE, global_dynamic_win_rank,
-                           MPI_Aint_add((MPI_Aint)sr, sr_byte_offset),
-                           stdptr_size, MPI_BYTE, global_dynamic_win);
-            CAF_Win_unlock(global_dynamic_win_rank, global_dynamic_win);
-            chk_err(ierr);
+            ierr = get_remote_meta(&sr, stdptr_size, global_dynamic_win_rank,
+                                   MPI_Aint_add((MPI_Aint)sr, sr_byte_offset),
+                                   global_dynamic_win); chk_err(ierr);
             desc_global = true;
           }
           else
           {
-            CAF_Win_lock(MPI_LOCK_SHARED, memptr_win_rank, mpi_token->memptr_win);
-            ierr = MPI_Get(&sr, stdptr_size, MPI_BYTE, memptr_win_rank,
-                           sr_byte_offset, stdptr_size, MPI_BYTE,
-                           mpi_token->memptr_win); chk_err(ierr);
-            CAF_Win_unlock(memptr_win_rank, mpi_token->memptr_win);
+            ierr = get_remote_meta(&sr, stdptr_size, memptr_win_rank,
+                                   sr_byte_offset,
+                                   mpi_token->memptr_win); chk_err(ierr);
             sr_global = true;
           }
           sr_byte_offset = 0;
@@ -4207,21 +6233,16 @@ get_for_ref(caf_reference_t *ref, size_t *i, size_t dst_index,
         rdesc = sr;
         if (sr_global)
         {
-          CAF_Win_lock(MPI_LOCK_SHARED, global_dynamic_win_rank, global_dynamic_win);
-          ierr = MPI_Get(&sr, stdptr_size, MPI_BYTE, global_dynamic_win_rank,
-                         MPI_Aint_add((MPI_Aint)sr, sr_byte_offset),
-                         stdptr_size, MPI_BYTE, global_dynamic_win);
-          CAF_Win_unlock(global_dynamic_win_rank, global_dynamic_win);
-          chk_err(ierr);
+          ierr = get_remote_meta(&sr, stdptr_size, global_dynamic_win_rank,
+                                 MPI_Aint_add((MPI_Aint)sr, sr_byte_offset),
+                                 global_dynamic_win); chk_err(ierr);
           desc_global = true;
         }
         else
         {
-          CAF_Win_lock(MPI_LOCK_SHARED, memptr_win_rank, mpi_token->memptr_win);
-          ierr = MPI_Get(&sr, stdptr_size, MPI_BYTE, memptr_win_rank,
-                         sr_byte_offset, stdptr_size, MPI_BYTE,
-                         mpi_token->memptr_win); chk_err(ierr);
-          CAF_Win_unlock(memptr_win_rank, mpi_token->memptr_win);
+          ierr = get_remote_meta(&sr, stdptr_size, memptr_win_rank,
+                                 sr_byte_offset,
+                                 mpi_token->memptr_win); chk_err(ierr);
           sr_global = true;
         }
         sr_byte_offset = 0;
@@ -4265,24 +6286,19 @@ get_for_ref(caf_reference_t *ref, size_t *i, size_t dst_index,
           {
             MPI_Aint disp = MPI_Aint_add((MPI_Aint)rdesc, desc_byte_offset);
             dprint("Fetching remote descriptor from %p.\n", disp);
-            CAF_Win_lock(MPI_LOCK_SHARED, global_dynamic_win_rank, global_dynamic_win);
-            ierr = MPI_Get(&src_desc_data, sizeof_desc_for_rank(ref_rank),
-                           MPI_BYTE, global_dynamic_win_rank, disp,
-                           sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           global_dynamic_win); chk_err(ierr);
-            CAF_Win_unlock(global_dynamic_win_rank, global_dynamic_win);
+            ierr = get_remote_meta(&src_desc_data,
+                                   sizeof_desc_for_rank(ref_rank),
+                                   global_dynamic_win_rank, disp,
+                                   global_dynamic_win); chk_err(ierr);
             sr = src_desc_data.base.base_addr;
           }
           else
           {
             dprint("Fetching remote data.\n");
-            CAF_Win_lock(MPI_LOCK_SHARED, memptr_win_rank, mpi_token->memptr_win);
-            ierr = MPI_Get(&src_desc_data,
-                           sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           memptr_win_rank, desc_byte_offset,
-                           sizeof_desc_for_rank(ref_rank),
-                           MPI_BYTE, mpi_token->memptr_win); chk_err(ierr);
-            CAF_Win_unlock(memptr_win_rank, mpi_token->memptr_win);
+            ierr = get_remote_meta(&src_desc_data,
+                                   sizeof_desc_for_rank(ref_rank),
+                                   memptr_win_rank, desc_byte_offset,
+                                   mpi_token->memptr_win); chk_err(ierr);
             desc_global = true;
           }
           src = (gfc_descriptor_t *)&src_desc_data;
@@ -4648,20 +6664,10 @@ PREFIX(get_by_ref) (caf_token_t token, int image_index,
   if (stat)
     *stat = 0;
 
-  MPI_Group current_team_group, win_group;
-  int global_dynamic_win_rank, memptr_win_rank;
-  ierr = MPI_Comm_group(CAF_COMM_WORLD, &current_team_group); chk_err(ierr);
-  ierr = MPI_Win_get_group(global_dynamic_win, &win_group); chk_err(ierr);
-  ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                   (int[]){image_index - 1}, win_group,
-                                   &global_dynamic_win_rank); chk_err(ierr);
-  ierr = MPI_Group_free(&win_group); chk_err(ierr);
-  ierr = MPI_Win_get_group(mpi_token->memptr_win, &win_group); chk_err(ierr);
-  ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                   (int[]){image_index - 1}, win_group,
-                                   &memptr_win_rank); chk_err(ierr);
-  ierr = MPI_Group_free(&current_team_group); chk_err(ierr);
-  ierr = MPI_Group_free(&win_group); chk_err(ierr);
+  int
+    global_dynamic_win_rank = translate_rank(global_dynamic_win,
+                                             image_index - 1),
+    memptr_win_rank = translate_rank(mpi_token->memptr_win, image_index - 1);
 
   check_image_health(global_dynamic_win_rank, stat);
 
@@ -4685,12 +6691,11 @@ PREFIX(get_by_ref) (caf_token_t token, int image_index,
           remote_base_memptr = remote_memptr;
           if (access_data_through_global_win)
           {
-            CAF_Win_lock(MPI_LOCK_SHARED, global_dynamic_win_rank, global_dynamic_win);
-            ierr = MPI_Get(&remote_memptr, stdptr_size, MPI_BYTE, global_dynamic_win_rank,
-                           MPI_Aint_add((MPI_Aint)remote_memptr, data_offset),
-                           stdptr_size, MPI_BYTE, global_dynamic_win);
-            CAF_Win_unlock(global_dynamic_win_rank, global_dynamic_win);
-            chk_err(ierr);
+            ierr = get_remote_meta(&remote_memptr, stdptr_size,
+                                   global_dynamic_win_rank,
+                                   MPI_Aint_add((MPI_Aint)remote_memptr,
+                                                data_offset),
+                                   global_dynamic_win); chk_err(ierr);
             dprint("global_win access: remote_memptr(old) = %p, remote_memptr(new) = %p, offset = %zd.\n",
                    remote_base_memptr, remote_memptr, data_offset);
             /* On the second indirection access also the remote descriptor
@@ -4699,11 +6704,9 @@ PREFIX(get_by_ref) (caf_token_t token, int image_index,
           }
           else
           {
-            CAF_Win_lock(MPI_LOCK_SHARED, memptr_win_rank, mpi_token->memptr_win);
-            ierr = MPI_Get(&remote_memptr, stdptr_size, MPI_BYTE, memptr_win_rank,
-                           data_offset, stdptr_size, MPI_BYTE,
-                           mpi_token->memptr_win); chk_err(ierr);
-            CAF_Win_unlock(memptr_win_rank, mpi_token->memptr_win);
+            ierr = get_remote_meta(&remote_memptr, stdptr_size, memptr_win_rank,
+                                   data_offset,
+                                   mpi_token->memptr_win); chk_err(ierr);
             dprint("get(custom_token %d): remote_memptr(old) = %p, remote_memptr(new) = %p, offset = %zd\n",
                    mpi_token->memptr_win, remote_base_memptr, remote_memptr, data_offset);
             /* All future access is through the global dynamic window. */
@@ -4741,22 +6744,18 @@ PREFIX(get_by_ref) (caf_token_t token, int image_index,
             size_t datasize = sizeof_desc_for_rank(ref_rank);
             dprint("remote desc fetch from %p, offset = %zd, ref_rank = %d, get_size = %u, rank = %d\n",
                    remote_base_memptr, desc_offset, ref_rank, datasize, global_dynamic_win_rank);
-            CAF_Win_lock(MPI_LOCK_SHARED, global_dynamic_win_rank, global_dynamic_win);
-            ierr = MPI_Get(src, datasize, MPI_BYTE, global_dynamic_win_rank,
-                           MPI_Aint_add((MPI_Aint)remote_base_memptr, desc_offset),
-                           datasize, MPI_BYTE, global_dynamic_win);
-            CAF_Win_unlock(global_dynamic_win_rank, global_dynamic_win);
-            chk_err(ierr);
+            ierr = get_remote_meta(src, datasize, global_dynamic_win_rank,
+                                   MPI_Aint_add((MPI_Aint)remote_base_memptr,
+                                                desc_offset),
+                                   global_dynamic_win); chk_err(ierr);
           }
           else
           {
             dprint("remote desc fetch from win %d, offset = %zd, ref_rank = %d\n",
                    mpi_token->memptr_win, desc_offset, ref_rank);
-            CAF_Win_lock(MPI_LOCK_SHARED, memptr_win_rank, mpi_token->memptr_win);
-            ierr = MPI_Get(src, sizeof_desc_for_rank(ref_rank), MPI_BYTE, memptr_win_rank,
-                           desc_offset, sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           mpi_token->memptr_win); chk_err(ierr);
-            CAF_Win_unlock(memptr_win_rank, mpi_token->memptr_win);
+            ierr = get_remote_meta(src, sizeof_desc_for_rank(ref_rank),
+                                   memptr_win_rank, desc_offset,
+                                   mpi_token->memptr_win); chk_err(ierr);
             access_desc_through_global_win = true;
           }
         }
@@ -5189,6 +7188,7 @@ case kind:                                                      \
 #endif
   i = 0;
   dprint("get_by_ref() calling get_for_ref.\n");
+  open_ref_plan(false);
   get_for_ref(refs, &i, dst_index, mpi_token, dst, mpi_token->desc,
               dst->base_addr, remote_memptr, 0, NULL, 0, dst_kind, src_kind, 0,
               0, 1, stat, global_dynamic_win_rank, memptr_win_rank, false, false
@@ -5196,6 +7196,7 @@ case kind:                                                      \
                , src_type
 #endif
                );
+  close_ref_plan();
 }
 
 static void
@@ -5206,6 +7207,13 @@ put_data(mpi_caf_token_t *token, MPI_Aint offset, void *sr, int dst_type,
   size_t k;
   int ierr;
   MPI_Win win = (token == NULL) ? global_dynamic_win : token->memptr_win;
+
+  if (ref_plan.open)
+  {
+    plan_element(win, image_index, offset, sr, dst_type, src_type, dst_kind,
+                 src_kind, dst_size, src_size, num, stat);
+    return;
+  }
 #ifdef EXTRA_DEBUG_OUTPUT
   if (token)
     dprint("(win: %d, image: %d, offset: %zd) <- %p, "
@@ -5221,9 +7229,7 @@ put_data(mpi_caf_token_t *token, MPI_Aint offset, void *sr, int dst_type,
   if (dst_type == src_type && dst_kind == src_kind)
   {
     size_t sz = (dst_size > src_size ? src_size : dst_size) * num;
-    CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image_index, win);
-    ierr = MPI_Put(sr, sz, MPI_BYTE, image_index, offset, sz, MPI_BYTE, win);
-    CAF_Win_unlock(image_index, win);
+    ierr = put_window_bytes(sr, sz, image_index, offset, win);
     chk_err(ierr);
     dprint("sr[] = %d, num = %zd, num bytes = %zd\n",
            (int)((char*)sr)[0], num, sz);
@@ -5231,7 +7237,7 @@ put_data(mpi_caf_token_t *token, MPI_Aint offset, void *sr, int dst_type,
         && dst_size > src_size)
     {
       const size_t trans_size = dst_size / dst_kind - src_size / src_kind;
-      void *pad = alloca(trans_size * dst_kind);
+      void *pad = staging_alloc(trans_size * dst_kind);
       if (dst_kind == 1)
       {
         memset((void*)(char*) pad, ' ', trans_size);
@@ -5243,51 +7249,43 @@ put_data(mpi_caf_token_t *token, MPI_Aint offset, void *sr, int dst_type,
           ((int32_t*) pad)[k] = (int32_t) ' ';
         }
       }
-      CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image_index, win);
-      ierr = MPI_Put(pad, trans_size * dst_kind, MPI_BYTE, image_index,
-                     offset + (src_size / src_kind) * dst_kind,
-                     trans_size * dst_kind, MPI_BYTE, win); chk_err(ierr);
-      CAF_Win_unlock(image_index, win);
+      ierr = put_window_bytes(pad, trans_size * dst_kind, image_index,
+                              offset + (src_size / src_kind) * dst_kind, win);
+      chk_err(ierr);
+      staging_free(pad);
     }
   }
   else if (dst_type == BT_CHARACTER && dst_kind == 1)
   {
-    /* Get the required amount of memory on the stack. */
-    void *dsh = alloca(dst_size);
+    /* Get the staging buffer from the arena. */
+    void *dsh = staging_alloc(dst_size);
     assign_char1_from_char4(dst_size, src_size, dsh, sr);
-    CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image_index, win);
-    ierr = MPI_Put(dsh, dst_size, MPI_BYTE, image_index, offset, dst_size,
-                   MPI_BYTE, win); chk_err(ierr);
-    CAF_Win_unlock(image_index, win);
+    ierr = put_window_bytes(dsh, dst_size, image_index, offset, win);
+    chk_err(ierr);
+    staging_free(dsh);
   }
   else if (dst_type == BT_CHARACTER)
   {
-    /* Get the required amount of memory on the stack. */
-    void *dsh = alloca(dst_size);
+    /* Get the staging buffer from the arena. */
+    void *dsh = staging_alloc(dst_size);
     assign_char4_from_char1(dst_size, src_size, dsh, sr);
-    CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image_index, win);
-    ierr = MPI_Put(dsh, dst_size, MPI_BYTE, image_index, offset, dst_size,
-                   MPI_BYTE, win); chk_err(ierr);
-    CAF_Win_unlock(image_index, win);
+    ierr = put_window_bytes(dsh, dst_size, image_index, offset, win);
+    chk_err(ierr);
+    staging_free(dsh);
   }
   else
   {
-    /* Get the required amount of memory on the stack. */
-    void *dsh = alloca(dst_size * num), *dsh_iter = dsh;
+    /* Get the staging buffer from the arena. */
+    void *dsh = staging_alloc(dst_size * num);
     dprint("type/kind convert %zd items: "
            "type %d(%d) -> type %d(%d), local buffer: %p\n",
            num, src_type, src_kind, dst_type, dst_kind, dsh);
-    for (k = 0; k < num; ++k)
-    {
-      convert_type(dsh_iter, dst_type, dst_kind, sr, src_type, src_kind, stat);
-      dsh_iter += dst_size;
-      sr += src_size;
-    }
+    convert_with_strides(dsh, dst_type, dst_kind, dst_size,
+                         sr, src_type, src_kind, src_size, num, stat);
     // dprint("dsh[0] = %d\n", ((int *)dsh)[0]);
-    CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image_index, win);
-    ierr = MPI_Put(dsh, dst_size * num, MPI_BYTE, image_index, offset,
-                   dst_size * num, MPI_BYTE, win); chk_err(ierr);
-    CAF_Win_unlock(image_index, win);
+    ierr = put_window_bytes(dsh, dst_size * num, image_index, offset, win);
+    chk_err(ierr);
+    staging_free(dsh);
   }
 }
 
@@ -5342,21 +7340,16 @@ send_for_ref(caf_reference_t *ref, size_t *i, size_t src_index,
         {
           if (ds_global)
           {
-            CAF_Win_lock(MPI_LOCK_SHARED, global_dynamic_win_rank, global_dynamic_win);
-            ierr = MPI_Get(&ds, stdptr_size, MPI_BYTE, global_dynamic_win_rank,
-                           MPI_Aint_add((MPI_Aint)ds, dst_byte_offset),
-                           stdptr_size, MPI_BYTE, global_dynamic_win);
-            CAF_Win_unlock(global_dynamic_win_rank, global_dynamic_win);
-            chk_err(ierr);
+            ierr = get_remote_meta(&ds, stdptr_size, global_dynamic_win_rank,
+                                   MPI_Aint_add((MPI_Aint)ds, dst_byte_offset),
+                                   global_dynamic_win); chk_err(ierr);
             desc_global = true;
           }
           else
           {
-            CAF_Win_lock(MPI_LOCK_SHARED, memptr_win_rank, mpi_token->memptr_win);
-            ierr = MPI_Get(&ds, stdptr_size, MPI_BYTE, memptr_win_rank,
-                           dst_byte_offset, stdptr_size, MPI_BYTE,
-                           mpi_token->memptr_win); chk_err(ierr);
-            CAF_Win_unlock(memptr_win_rank, mpi_token->memptr_win);
+            ierr = get_remote_meta(&ds, stdptr_size, memptr_win_rank,
+                                   dst_byte_offset,
+                                   mpi_token->memptr_win); chk_err(ierr);
             ds_global = true;
           }
           dst_byte_offset = 0;
@@ -5444,21 +7437,16 @@ send_for_ref(caf_reference_t *ref, size_t *i, size_t src_index,
         desc_byte_offset = dst_byte_offset;
         if (ds_global)
         {
-          CAF_Win_lock(MPI_LOCK_SHARED, global_dynamic_win_rank, global_dynamic_win);
-          ierr = MPI_Get(&ds, stdptr_size, MPI_BYTE, global_dynamic_win_rank,
-                         MPI_Aint_add((MPI_Aint)ds, dst_byte_offset),
-                         stdptr_size, MPI_BYTE, global_dynamic_win);
-          CAF_Win_unlock(global_dynamic_win_rank, global_dynamic_win);
-          chk_err(ierr);
+          ierr = get_remote_meta(&ds, stdptr_size, global_dynamic_win_rank,
+                                 MPI_Aint_add((MPI_Aint)ds, dst_byte_offset),
+                                 global_dynamic_win); chk_err(ierr);
           desc_global = true;
         }
         else
         {
-          CAF_Win_lock(MPI_LOCK_SHARED, memptr_win_rank, mpi_token->memptr_win);
-          ierr = MPI_Get(&ds, stdptr_size, MPI_BYTE, memptr_win_rank,
-                         dst_byte_offset, stdptr_size, MPI_BYTE,
-                         mpi_token->memptr_win); chk_err(ierr);
-          CAF_Win_unlock(memptr_win_rank, mpi_token->memptr_win);
+          ierr = get_remote_meta(&ds, stdptr_size, memptr_win_rank,
+                                 dst_byte_offset,
+                                 mpi_token->memptr_win); chk_err(ierr);
           ds_global = true;
         }
         dst_byte_offset = 0;
@@ -5501,22 +7489,18 @@ send_for_ref(caf_reference_t *ref, size_t *i, size_t src_index,
           /* Get the remote descriptor. */
           if (desc_global)
           {
-            CAF_Win_lock(MPI_LOCK_SHARED, global_dynamic_win_rank, global_dynamic_win);
-            ierr = MPI_Get(&dst_desc_data, sizeof_desc_for_rank(ref_rank),
-                           MPI_BYTE, global_dynamic_win_rank,
-                           MPI_Aint_add((MPI_Aint)ds, desc_byte_offset),
-                           sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           global_dynamic_win); chk_err(ierr);
-            CAF_Win_unlock(global_dynamic_win_rank, global_dynamic_win);
+            ierr = get_remote_meta(&dst_desc_data,
+                                   sizeof_desc_for_rank(ref_rank),
+                                   global_dynamic_win_rank,
+                                   MPI_Aint_add((MPI_Aint)ds, desc_byte_offset),
+                                   global_dynamic_win); chk_err(ierr);
           }
           else
           {
-            CAF_Win_lock(MPI_LOCK_SHARED, memptr_win_rank, mpi_token->memptr_win);
-            ierr = MPI_Get(&dst_desc_data, sizeof_desc_for_rank(ref_rank),
-                           MPI_BYTE, memptr_win_rank, desc_byte_offset,
-                           sizeof_desc_for_rank(ref_rank),
-                           MPI_BYTE, mpi_token->memptr_win); chk_err(ierr);
-            CAF_Win_unlock(memptr_win_rank, mpi_token->memptr_win);
+            ierr = get_remote_meta(&dst_desc_data,
+                                   sizeof_desc_for_rank(ref_rank),
+                                   memptr_win_rank, desc_byte_offset,
+                                   mpi_token->memptr_win); chk_err(ierr);
             desc_global = true;
           }
           dst = (gfc_descriptor_t *)&dst_desc_data;
@@ -5875,8 +7859,6 @@ PREFIX(send_by_ref) (caf_token_t token, int image_index,
     "libcaf_mpi::caf_send_by_ref(): rank out of range.\n";
   const char extentoutofrange[] =
     "libcaf_mpi::caf_send_by_ref(): extent out of range.\n";
-  const char cannotallocdst[] =
-    "libcaf_mpi::caf_send_by_ref(): can not allocate %d bytes of memory.\n";
   const char unabletoallocdst[] =
     "libcaf_mpi::caf_send_by_ref(): "
     "unable to allocate memory on remote image.\n";
@@ -5910,20 +7892,10 @@ PREFIX(send_by_ref) (caf_token_t token, int image_index,
   if (stat)
     *stat = 0;
 
-  MPI_Group current_team_group, win_group;
-  int global_dynamic_win_rank, memptr_win_rank;
-  ierr = MPI_Comm_group(CAF_COMM_WORLD, &current_team_group); chk_err(ierr);
-  ierr = MPI_Win_get_group(global_dynamic_win, &win_group); chk_err(ierr);
-  ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                   (int[]){image_index - 1}, win_group,
-                                   &global_dynamic_win_rank); chk_err(ierr);
-  ierr = MPI_Group_free(&win_group); chk_err(ierr);
-  ierr = MPI_Win_get_group(mpi_token->memptr_win, &win_group); chk_err(ierr);
-  ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                   (int[]){image_index - 1}, win_group,
-                                   &memptr_win_rank); chk_err(ierr);
-  ierr = MPI_Group_free(&current_team_group); chk_err(ierr);
-  ierr = MPI_Group_free(&win_group); chk_err(ierr);
+  int
+    global_dynamic_win_rank = translate_rank(global_dynamic_win,
+                                             image_index - 1),
+    memptr_win_rank = translate_rank(mpi_token->memptr_win, image_index - 1);
 
   check_image_health(global_dynamic_win_rank, stat);
 
@@ -5950,12 +7922,11 @@ PREFIX(send_by_ref) (caf_token_t token, int image_index,
           {
             data_offset += riter->u.c.offset;
             remote_base_memptr = remote_memptr;
-            CAF_Win_lock(MPI_LOCK_SHARED, global_dynamic_win_rank, global_dynamic_win);
-            ierr = MPI_Get(&remote_memptr, stdptr_size, MPI_BYTE, global_dynamic_win_rank,
-                           MPI_Aint_add((MPI_Aint)remote_memptr, data_offset),
-                           stdptr_size, MPI_BYTE, global_dynamic_win);
-            CAF_Win_unlock(global_dynamic_win_rank, global_dynamic_win);
-            chk_err(ierr);
+            ierr = get_remote_meta(&remote_memptr, stdptr_size,
+                                   global_dynamic_win_rank,
+                                   MPI_Aint_add((MPI_Aint)remote_memptr,
+                                                data_offset),
+                                   global_dynamic_win); chk_err(ierr);
             /* On the second indirection access also the remote descriptor
              * using the global window. */
             access_desc_through_global_win = true;
@@ -5963,11 +7934,9 @@ PREFIX(send_by_ref) (caf_token_t token, int image_index,
           else
           {
             data_offset += riter->u.c.offset;
-            CAF_Win_lock(MPI_LOCK_SHARED, memptr_win_rank, mpi_token->memptr_win);
-            ierr = MPI_Get(&remote_memptr, stdptr_size, MPI_BYTE, memptr_win_rank,
-                           data_offset, stdptr_size, MPI_BYTE,
-                           mpi_token->memptr_win); chk_err(ierr);
-            CAF_Win_unlock(memptr_win_rank, mpi_token->memptr_win);
+            ierr = get_remote_meta(&remote_memptr, stdptr_size, memptr_win_rank,
+                                   data_offset,
+                                   mpi_token->memptr_win); chk_err(ierr);
             /* All future access is through the global dynamic window. */
             access_data_through_global_win = true;
           }
@@ -5996,25 +7965,19 @@ PREFIX(send_by_ref) (caf_token_t token, int image_index,
           {
             dprint("remote desc fetch from %p, offset = %zd\n",
                    remote_base_memptr, desc_offset);
-            CAF_Win_lock(MPI_LOCK_SHARED, global_dynamic_win_rank, global_dynamic_win);
-            ierr = MPI_Get(dst, sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           global_dynamic_win_rank,
-                           MPI_Aint_add(
-                            (MPI_Aint)remote_base_memptr, desc_offset),
-                           sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           global_dynamic_win); chk_err(ierr);
-            CAF_Win_unlock(global_dynamic_win_rank, global_dynamic_win);
+            ierr = get_remote_meta(dst, sizeof_desc_for_rank(ref_rank),
+                                   global_dynamic_win_rank,
+                                   MPI_Aint_add((MPI_Aint)remote_base_memptr,
+                                                desc_offset),
+                                   global_dynamic_win); chk_err(ierr);
           }
           else
           {
             dprint("remote desc fetch from win %d, offset = %zd\n",
                    mpi_token->memptr_win, desc_offset);
-            CAF_Win_lock(MPI_LOCK_SHARED, memptr_win_rank, mpi_token->memptr_win);
-            ierr = MPI_Get(dst, sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           memptr_win_rank, desc_offset,
-                           sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           mpi_token->memptr_win); chk_err(ierr);
-            CAF_Win_unlock(memptr_win_rank, mpi_token->memptr_win);
+            ierr = get_remote_meta(dst, sizeof_desc_for_rank(ref_rank),
+                                   memptr_win_rank, desc_offset,
+                                   mpi_token->memptr_win); chk_err(ierr);
             access_desc_through_global_win = true;
           }
         }
@@ -6313,16 +8276,8 @@ case kind:                                                      \
     }
 
     cap *= GFC_DESCRIPTOR_SIZE(src);
-    temp_src.base.base_addr = alloca(cap);
-    if ((free_temp_src = (temp_src.base.base_addr == NULL)))
-    {
-      temp_src.base.base_addr = malloc(cap);
-      if (temp_src.base.base_addr == NULL)
-      {
-        caf_internal_error(cannotallocdst, stat, NULL, cap);
-        return;
-      }
-    }
+    temp_src.base.base_addr = staging_alloc(cap);
+    free_temp_src = true;
     memcpy(temp_src.base.base_addr, src->base_addr, cap);
     src = (gfc_descriptor_t *)&temp_src;
   }
@@ -6330,6 +8285,7 @@ case kind:                                                      \
   i = 0;
   dprint("calling send_for_ref. num elems: size = %zd, elem size in bytes: "
          "dst_size = %zd\n", size, dst_size);
+  open_ref_plan(true);
   send_for_ref(refs, &i, src_index, mpi_token, mpi_token->desc, src,
                remote_memptr, src->base_addr, 0, 0, dst_kind, src_kind, 0, 0,
                1, stat, global_dynamic_win_rank, memptr_win_rank,
@@ -6338,9 +8294,10 @@ case kind:                                                      \
                , dst_type
 #endif
                );
+  close_ref_plan();
   if (free_temp_src)
   {
-    free(temp_src.base.base_addr);
+    staging_free(temp_src.base.base_addr);
   }
 }
 
@@ -6376,7 +8333,6 @@ PREFIX(sendget_by_ref) (caf_token_t dst_token, int dst_image_index,
   caf_reference_t *riter = src_refs;
   long delta;
   ptrdiff_t data_offset = 0, desc_offset = 0;
-  MPI_Group current_team_group, win_group;
   int global_dst_rank, global_src_rank, memptr_dst_rank, memptr_src_rank;
   /* Set when the first non-scalar array reference is encountered. */
   bool in_array_ref = false;
@@ -6394,28 +8350,12 @@ PREFIX(sendget_by_ref) (caf_token_t dst_token, int dst_image_index,
   if (src_stat)
     *src_stat = 0;
 
-  ierr = MPI_Comm_group(CAF_COMM_WORLD, &current_team_group); chk_err(ierr);
-
-  ierr = MPI_Win_get_group(global_dynamic_win, &win_group); chk_err(ierr);
-  ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                  (int[]){src_image_index - 1}, win_group,
-                                  &global_src_rank); chk_err(ierr);
-  ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                  (int[]){dst_image_index - 1}, win_group,
-                                  &global_dst_rank); chk_err(ierr);
-  ierr = MPI_Group_free(&win_group); chk_err(ierr);
-
-  ierr = MPI_Win_get_group(src_mpi_token->memptr_win, &win_group); chk_err(ierr);
-  ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                  (int[]){src_image_index - 1}, win_group,
-                                  &memptr_src_rank); chk_err(ierr);
-  ierr = MPI_Group_free(&win_group); chk_err(ierr);
-  ierr = MPI_Win_get_group(dst_mpi_token->memptr_win, &win_group); chk_err(ierr);
-  ierr = MPI_Group_translate_ranks(current_team_group, 1,
-                                  (int[]){dst_image_index - 1}, win_group,
-                                  &memptr_dst_rank); chk_err(ierr);
-  ierr = MPI_Group_free(&win_group); chk_err(ierr);
-  ierr = MPI_Group_free(&current_team_group); chk_err(ierr);
+  global_src_rank = translate_rank(global_dynamic_win, src_image_index - 1);
+  global_dst_rank = translate_rank(global_dynamic_win, dst_image_index - 1);
+  memptr_src_rank = translate_rank(src_mpi_token->memptr_win,
+                                   src_image_index - 1);
+  memptr_dst_rank = translate_rank(dst_mpi_token->memptr_win,
+                                   dst_image_index - 1);
 
   check_image_health(global_src_rank, src_stat);
 
@@ -6438,25 +8378,19 @@ PREFIX(sendget_by_ref) (caf_token_t dst_token, int dst_image_index,
           remote_base_memptr = remote_memptr;
           if (access_data_through_global_win)
           {
-            CAF_Win_lock(MPI_LOCK_SHARED, global_src_rank, global_dynamic_win);
-            ierr = MPI_Get(&remote_memptr, stdptr_size, MPI_BYTE,
-                           global_src_rank,
-                           MPI_Aint_add((MPI_Aint)remote_memptr, data_offset),
-                           stdptr_size, MPI_BYTE, global_dynamic_win);
-            CAF_Win_unlock(global_src_rank, global_dynamic_win);
-            chk_err(ierr);
+            ierr = get_remote_meta(&remote_memptr, stdptr_size, global_src_rank,
+                                   MPI_Aint_add((MPI_Aint)remote_memptr,
+                                                data_offset),
+                                   global_dynamic_win); chk_err(ierr);
             /* On the second indirection access also the remote descriptor
              * using the global window. */
             access_desc_through_global_win = true;
           }
           else
           {
-            CAF_Win_lock(MPI_LOCK_SHARED, memptr_src_rank,
-                         src_mpi_token->memptr_win);
-            ierr = MPI_Get(&remote_memptr, stdptr_size, MPI_BYTE,
-                           memptr_src_rank, data_offset, stdptr_size, MPI_BYTE,
-                           src_mpi_token->memptr_win); chk_err(ierr);
-            CAF_Win_unlock(memptr_src_rank, src_mpi_token->memptr_win);
+            ierr = get_remote_meta(&remote_memptr, stdptr_size, memptr_src_rank,
+                                   data_offset,
+                                   src_mpi_token->memptr_win); chk_err(ierr);
             /* All future access is through the global dynamic window. */
             access_data_through_global_win = true;
           }
@@ -6484,26 +8418,19 @@ PREFIX(sendget_by_ref) (caf_token_t dst_token, int dst_image_index,
           {
             dprint("remote desc fetch from %p, offset = %zd\n",
                    remote_base_memptr, desc_offset);
-            CAF_Win_lock(MPI_LOCK_SHARED, global_src_rank, global_dynamic_win);
-            ierr = MPI_Get(src, sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           global_src_rank,
-                           MPI_Aint_add(
-                            (MPI_Aint)remote_base_memptr, desc_offset),
-                           sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           global_dynamic_win); chk_err(ierr);
-            CAF_Win_unlock(global_src_rank, global_dynamic_win);
+            ierr = get_remote_meta(src, sizeof_desc_for_rank(ref_rank),
+                                   global_src_rank,
+                                   MPI_Aint_add((MPI_Aint)remote_base_memptr,
+                                                desc_offset),
+                                   global_dynamic_win); chk_err(ierr);
           }
           else
           {
             dprint("remote desc fetch from win %d, offset = %zd\n",
                    src_mpi_token->memptr_win, desc_offset);
-            CAF_Win_lock(MPI_LOCK_SHARED, memptr_src_rank,
-                         src_mpi_token->memptr_win);
-            ierr = MPI_Get(src, sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                           memptr_src_rank, desc_offset,
-                           sizeof_desc_for_rank(ref_rank),
-                           MPI_BYTE, src_mpi_token->memptr_win); chk_err(ierr);
-            CAF_Win_unlock(memptr_src_rank, src_mpi_token->memptr_win);
+            ierr = get_remote_meta(src, sizeof_desc_for_rank(ref_rank),
+                                   memptr_src_rank, desc_offset,
+                                   src_mpi_token->memptr_win); chk_err(ierr);
             access_desc_through_global_win = true;
           }
         }
@@ -6738,6 +8665,7 @@ case kind:                                                        \
 #endif
   i = 0;
   dprint("calling get_for_ref.\n");
+  open_ref_plan(false);
   get_for_ref(src_refs, &i, dst_index, src_mpi_token,
               (gfc_descriptor_t *)&temp_src_desc, src_mpi_token->desc,
               temp_src_desc.base.base_addr, remote_memptr, 0, NULL, 0, dst_kind,
@@ -6747,10 +8675,12 @@ case kind:                                                        \
               , src_type
 #endif
               );
+  close_ref_plan();
   dprint("calling send_for_ref. num elems: size = %zd, elem size in bytes: "
          "src_size = %zd\n", size, src_size);
   i = 0;
 
+  open_ref_plan(true);
   send_for_ref(dst_refs, &i, src_index, dst_mpi_token, dst_mpi_token->desc,
                (gfc_descriptor_t *)&temp_src_desc, dst_mpi_token->memptr,
                temp_src_desc.base.base_addr, 0, 0, dst_kind, src_kind, 0, 0,
@@ -6759,6 +8689,7 @@ case kind:                                                        \
                , dst_type
 #endif
                );
+  close_ref_plan();
 }
 
 int
@@ -6771,8 +8702,11 @@ PREFIX(is_present) (caf_token_t token, int image_index, caf_reference_t *refs)
   const char remotesInnerRefNA[] =
     "Memory referenced on the remote image is not allocated.";
   const int ptr_size = sizeof(void *);
-  const int remote_image = image_index - 1;
   mpi_caf_token_t *mpi_token = (mpi_caf_token_t *)token;
+  const int
+    global_dynamic_win_rank = translate_rank(global_dynamic_win,
+                                             image_index - 1),
+    memptr_win_rank = translate_rank(mpi_token->memptr_win, image_index - 1);
   ptrdiff_t local_offset = 0;
   void *remote_memptr = NULL, *remote_base_memptr = NULL;
   bool carryOn = true, firstDesc = true;
@@ -6789,11 +8723,9 @@ PREFIX(is_present) (caf_token_t token, int image_index, caf_reference_t *refs)
       case CAF_REF_COMPONENT:
         if (riter->u.c.caf_token_offset)
         {
-          CAF_Win_lock(MPI_LOCK_SHARED, remote_image, mpi_token->memptr_win);
-          ierr = MPI_Get(&remote_memptr, ptr_size, MPI_BYTE, remote_image,
-                         local_offset + riter->u.c.offset, ptr_size,
-                         MPI_BYTE, mpi_token->memptr_win); chk_err(ierr);
-          CAF_Win_unlock(remote_image, mpi_token->memptr_win);
+          ierr = get_remote_meta(&remote_memptr, ptr_size, memptr_win_rank,
+                                 local_offset + riter->u.c.offset,
+                                 mpi_token->memptr_win); chk_err(ierr);
           dprint("Got first remote address %p from offset %zd\n",
                  remote_memptr, local_offset);
           local_offset = 0;
@@ -6890,11 +8822,10 @@ PREFIX(is_present) (caf_token_t token, int image_index, caf_reference_t *refs)
         firstDesc = firstDesc && riter->u.c.caf_token_offset == 0;
         local_offset += riter->u.c.offset;
         remote_base_memptr = remote_memptr + local_offset;
-        CAF_Win_lock(MPI_LOCK_SHARED, remote_image, global_dynamic_win);
-        ierr = MPI_Get(&remote_memptr, ptr_size, MPI_BYTE, remote_image,
-                       (MPI_Aint)remote_base_memptr, ptr_size,
-                       MPI_BYTE, global_dynamic_win); chk_err(ierr);
-        CAF_Win_unlock(remote_image, global_dynamic_win);
+        ierr = get_remote_meta(&remote_memptr, ptr_size,
+                               global_dynamic_win_rank,
+                               (MPI_Aint)remote_base_memptr,
+                               global_dynamic_win); chk_err(ierr);
         dprint("Got remote address %p from offset %zd nd base memptr %p\n",
                remote_memptr, local_offset, remote_base_memptr);
         local_offset = 0;
@@ -6923,12 +8854,9 @@ PREFIX(is_present) (caf_token_t token, int image_index, caf_reference_t *refs)
           dprint("Getting remote descriptor of rank %zd from win: %d, "
                  "sizeof() %zd\n", ref_rank, mpi_token->memptr_win,
                  sizeof_desc_for_rank(ref_rank));
-          CAF_Win_lock(MPI_LOCK_SHARED, remote_image, mpi_token->memptr_win);
-          ierr = MPI_Get(&src_desc, sizeof_desc_for_rank(ref_rank),
-                         MPI_BYTE, remote_image, local_offset,
-                         sizeof_desc_for_rank(ref_rank),
-                         MPI_BYTE, mpi_token->memptr_win); chk_err(ierr);
-          CAF_Win_unlock(remote_image, mpi_token->memptr_win);
+          ierr = get_remote_meta(&src_desc, sizeof_desc_for_rank(ref_rank),
+                                 memptr_win_rank, local_offset,
+                                 mpi_token->memptr_win); chk_err(ierr);
           firstDesc = false;
         }
         else
@@ -6941,12 +8869,10 @@ PREFIX(is_present) (caf_token_t token, int image_index, caf_reference_t *refs)
           dprint("Getting remote descriptor of rank %zd from: %p, "
                  "sizeof() %zd\n", ref_rank, remote_base_memptr,
                  sizeof_desc_for_rank(ref_rank));
-          CAF_Win_lock(MPI_LOCK_SHARED, remote_image, global_dynamic_win);
-          ierr = MPI_Get(&src_desc, sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                         remote_image, (MPI_Aint)remote_base_memptr,
-                         sizeof_desc_for_rank(ref_rank), MPI_BYTE,
-                         global_dynamic_win); chk_err(ierr);
-          CAF_Win_unlock(remote_image, global_dynamic_win);
+          ierr = get_remote_meta(&src_desc, sizeof_desc_for_rank(ref_rank),
+                                 global_dynamic_win_rank,
+                                 (MPI_Aint)remote_base_memptr,
+                                 global_dynamic_win); chk_err(ierr);
         }
 #ifdef EXTRA_DEBUG_OUTPUT
         {
@@ -7028,6 +8954,134 @@ PREFIX(is_present) (caf_token_t token, int image_index, caf_reference_t *refs)
 #endif // GCC_GE_7
 
 
+/* Least recently used cache of the requests of SYNC IMAGES.  Stencil codes
+ * synchronize with the same images in every step, therefore the receives and
+ * sends for an image list are created once as persistent requests and started
+ * by each SYNC IMAGES with that list.  The key is the list, whose hash is
+ * compared first; a list found in the cache was checked for duplicates
+ * already.  The capacity is read from OPENCOARRAYS_SYNC_IMAGES_PLANS.  The
+ * cache is off by default, because with Open MPI 4.1 waiting for restarted
+ * persistent receives costs more than posting new ones.  The plans are
+ * dropped, when the current team changes.  Hits and misses are reported by
+ * PREFIX(sync_plan_stats). */
+
+static void
+free_sync_plan(sync_plan_t *plan)
+{
+  int i, ierr;
+
+  /* Receives left pending by a stopped image complete into arrived later. */
+  for (i = 0; i < 2 * plan->count; ++i)
+  {
+    ierr = MPI_Request_free(&plan->requests[i]); chk_err(ierr);
+  }
+  free(plan->requests);
+  free(plan->images);
+  free(plan);
+  --sync_plan_entries;
+}
+
+/* Return the plan of the list images of count images and move it to the
+ * front, or NULL, when it is not in the cache. */
+
+static sync_plan_t *
+find_sync_plan(int count, int images[], uint64_t hash)
+{
+  sync_plan_t *plan, **prev;
+
+  for (prev = &sync_plans; (plan = *prev); prev = &plan->next)
+  {
+    if (plan->hash == hash && plan->count == count
+        && memcmp(plan->images, images, count * sizeof(int)) == 0)
+    {
+      ++sync_plan_hits;
+      *prev = plan->next;
+      plan->next = sync_plans;
+      sync_plans = plan;
+      return plan;
+    }
+  }
+  ++sync_plan_misses;
+  return NULL;
+}
+
+/* Create the plan of the list images, evicting the least recently used one,
+ * when the cache is full.  Returns NULL, when the cache is disabled. */
+
+static sync_plan_t *
+new_sync_plan(int count, int images[], uint64_t hash)
+{
+  sync_plan_t *plan, **prev;
+  int i, ierr;
+
+  if (sync_plan_capacity == 0)
+    return NULL;
+  if (sync_plan_entries >= sync_plan_capacity)
+  {
+    for (prev = &sync_plans; (*prev)->next; prev = &(*prev)->next)
+      ;
+    free_sync_plan(*prev);
+    *prev = NULL;
+  }
+  plan = (sync_plan_t *) malloc(sizeof(sync_plan_t));
+  plan->hash = hash;
+  plan->count = count;
+  plan->images = (int *) malloc(count * sizeof(int));
+  memcpy(plan->images, images, count * sizeof(int));
+  plan->requests = (MPI_Request *) malloc(2 * count * sizeof(MPI_Request));
+  for (i = 0; i < count; ++i)
+  {
+    ierr = MPI_Recv_init(&arrived[images[i] - 1], 1, MPI_INT, images[i] - 1,
+                         MPI_TAG_CAF_SYNC_IMAGES, CAF_COMM_WORLD,
+                         &plan->requests[i]); chk_err(ierr);
+    ierr = MPI_Send_init(&sync_plan_zero, 1, MPI_INT, images[i] - 1,
+                         MPI_TAG_CAF_SYNC_IMAGES, CAF_COMM_WORLD,
+                         &plan->requests[count + i]); chk_err(ierr);
+  }
+  plan->next = sync_plans;
+  sync_plans = plan;
+  ++sync_plan_entries;
+  return plan;
+}
+
+/* Remove plan from the cache, when a SYNC IMAGES with it did not complete. */
+
+static void
+drop_sync_plan(sync_plan_t *plan)
+{
+  sync_plan_t **prev;
+
+  for (prev = &sync_plans; *prev != plan; prev = &(*prev)->next)
+    ;
+  *prev = plan->next;
+  free_sync_plan(plan);
+}
+
+static void
+free_sync_plans(void)
+{
+  sync_plan_t *plan;
+
+  dprint("Sync images plans: %lld hits, %lld misses.\n", sync_plan_hits,
+         sync_plan_misses);
+  while ((plan = sync_plans))
+  {
+    sync_plans = plan->next;
+    free_sync_plan(plan);
+  }
+}
+
+void
+PREFIX(sync_plan_stats) (long long *hits, long long *misses, int *entries)
+{
+  if (hits)
+    *hits = sync_plan_hits;
+  if (misses)
+    *misses = sync_plan_misses;
+  if (entries)
+    *entries = sync_plan_entries;
+}
+
 /* SYNC IMAGES. Note: SYNC IMAGES(*) is passed as count == -1 while
  * SYNC IMAGES([]) has count == 0. Note further that SYNC IMAGES(*)
  * is not semantically equivalent to SYNC ALL. */
@@ -7043,8 +9097,10 @@ static void
 sync_images_internal(int count, int images[], int *stat, char *errmsg,
                      size_t errmsg_len, bool internal)
 {
-  int ierr = 0, i = 0, j = 0, int_zero = 0, done_count = 0, flag;
-  MPI_Status s;
+  int ierr = 0, i = 0, j, n, int_zero = 0, done_count = 0, flag;
+  MPI_Request *recv_handles = sync_handles, *send_handles = sync_send_handles;
+  sync_plan_t *plan = NULL;
+  uint64_t hash;
 
 #ifdef WITH_FAILED_IMAGES
   no_stopped_images_check_in_errhandler = true;
@@ -7061,21 +9117,6 @@ sync_images_internal(int count, int images[], int *stat, char *errmsg,
     return;
   }
 
-  /* halt execution if sync images contains duplicate image numbers */
-  for (i = 0; i < count; ++i)
-  {
-    for (j = 0; j < i; ++j)
-    {
-      if (images[i] == images[j])
-      {
-        ierr = STAT_DUP_SYNC_IMAGES;
-        if (stat)
-          *stat = ierr;
-        goto sync_images_err_chk;
-      }
-    }
-  }
-
 #ifdef GFC_CAF_CHECK
     for (i = 0; i < count; ++i)
     {
@@ -7088,21 +9129,54 @@ sync_images_internal(int count, int images[], int *stat, char *errmsg,
     }
 #endif
 
-  if (unlikely(caf_is_finalized))
+  if (count == -1)
   {
-    ierr = STAT_STOPPED_IMAGE;
+    count = caf_num_images - 1;
+    images = images_full;
   }
-  else
+  hash = fnv1a(0xcbf29ce484222325ULL, images, count * sizeof(int));
+  if (count > 0)
+    plan = find_sync_plan(count, images, hash);
+
+  /* halt execution if sync images contains duplicate image numbers.  The
+   * images seen are stamped with a new epoch, so that the stamps need not be
+   * cleared. */
+  if (plan == NULL && ++sync_images_epoch == INT_MAX)
+  {
+    memset(sync_images_seen, 0, caf_num_images * sizeof(int));
+    sync_images_epoch = 1;
+  }
+  for (i = 0; plan == NULL && i < count; ++i)
   {
-    if (count == -1)
+    bool dup = false;
+
+    if (images[i] >= 1 && images[i] <= caf_num_images)
+    {
+      dup = sync_images_seen[images[i] - 1] == sync_images_epoch;
+      sync_images_seen[images[i] - 1] = sync_images_epoch;
+    }
+    else
     {
-      count = caf_num_images - 1;
-      images = images_full;
+      /* Invalid image indices are left to MPI, but still compared. */
+      for (j = 0; j < i && !dup; ++j)
+        dup = images[i] == images[j];
     }
+    if (dup)
+    {
+      ierr = STAT_DUP_SYNC_IMAGES;
+      if (stat)
+        *stat = ierr;
+      goto sync_images_err_chk;
+    }
+  }
 
-#if defined(NONBLOCKING_PUT) && !defined(CAF_MPI_LOCK_UNLOCK)
+  if (unlikely(caf_is_finalized))
+  {
+    ierr = STAT_STOPPED_IMAGE;
+  }
+  else
+  {
     explicit_flush();
-#endif
 
 #ifdef WITH_FAILED_IMAGES
     /* Provoke detecting process fails. */
@@ -7128,32 +9202,51 @@ sync_images_internal(int count, int images[], int *stat, char *errmsg,
      * also have reached a sync images statement.  This implementation makes
      * no assumption when the image continues or in which order synced
      * images continue. */
-    for (i = 0; i < count; ++i)
+    if (plan == NULL && count > 0)
+      plan = new_sync_plan(count, images, hash);
+    if (plan != NULL)
     {
-      /* Need to have the request handlers contigously in the handlers
-       * array or waitany below will trip about the handler as illegal. */
-      ierr = MPI_Irecv(&arrived[images[i] - 1], 1, MPI_INT, images[i] - 1,
-                       MPI_TAG_CAF_SYNC_IMAGES, CAF_COMM_WORLD,
-                       &sync_handles[i]); chk_err(ierr);
+      recv_handles = plan->requests;
+      send_handles = plan->requests + count;
+      ierr = MPI_Startall(2 * count, plan->requests); chk_err(ierr);
     }
-    for (i = 0; i < count; ++i)
+    else
     {
-      ierr = MPI_Send(&int_zero, 1, MPI_INT, images[i] - 1,
-                      MPI_TAG_CAF_SYNC_IMAGES, CAF_COMM_WORLD); chk_err(ierr);
+      for (i = 0; i < count; ++i)
+      {
+        /* Need to have the request handlers contigously in the handlers
+         * array or waitany below will trip about the handler as illegal. */
+        ierr = MPI_Irecv(&arrived[images[i] - 1], 1, MPI_INT, images[i] - 1,
+                         MPI_TAG_CAF_SYNC_IMAGES, CAF_COMM_WORLD,
+                         &sync_handles[i]); chk_err(ierr);
+      }
+      /* The sends do not wait for each other, they are completed after the
+       * receives. */
+      for (i = 0; i < count; ++i)
+      {
+        ierr = MPI_Isend(&int_zero, 1, MPI_INT, images[i] - 1,
+                         MPI_TAG_CAF_SYNC_IMAGES, CAF_COMM_WORLD,
+                         &sync_send_handles[i]); chk_err(ierr);
+      }
     }
     done_count = 0;
     while (done_count < count)
     {
-      ierr = MPI_Waitany(count, sync_handles, &i, &s);
-      if (ierr == MPI_SUCCESS && i != MPI_UNDEFINED)
+      ierr = MPI_Waitsome(count, recv_handles, &n, sync_done,
+                          MPI_STATUSES_IGNORE);
+      if (ierr == MPI_SUCCESS && n != MPI_UNDEFINED)
       {
-        ++done_count;
-        if (ierr == MPI_SUCCESS && arrived[s.MPI_SOURCE] == STAT_STOPPED_IMAGE)
+        done_count += n;
+        for (j = 0; j < n; ++j)
+        {
+          if (arrived[images[sync_done[j]] - 1] == STAT_STOPPED_IMAGE)
+            ierr = STAT_STOPPED_IMAGE;
+        }
+        if (ierr == STAT_STOPPED_IMAGE)
         {
           /* Possible future extension: Abort pending receives.  At the
            * moment the receives are discarded by the program
            * termination.  For the tested mpi-implementation this is ok. */
-          ierr = STAT_STOPPED_IMAGE;
           break;
         }
       }
@@ -7175,6 +9268,14 @@ sync_images_internal(int count, int images[], int *stat, char *errmsg,
         break;
 #endif // WITH_FAILED_IMAGES
     }
+    /* An error of the receives takes precedence. */
+    if (ierr == MPI_SUCCESS)
+      ierr = MPI_Waitall(count, send_handles, MPI_STATUSES_IGNORE);
+    else
+      MPI_Waitall(count, send_handles, MPI_STATUSES_IGNORE);
+    /* The receives of the plan may still be active. */
+    if (plan != NULL && done_count < count)
+      drop_sync_plan(plan);
   }
 
 sync_images_err_chk:
@@ -7732,6 +9833,202 @@ PREFIX(co_max) (gfc_descriptor_t *a, int result_image, int *stat,
 }
 
 
+/* Report the puts and bytes taken by the write-combining buffers and the puts
+ * issued for them. */
+
+void
+PREFIX(put_combining_stats) (long long *puts, long long *bytes,
+                             long long *flushes)
+{
+#if MPI_VERSION >= 3
+  if (puts)
+    *puts = combine_puts;
+  if (bytes)
+    *bytes = combine_bytes;
+  if (flushes)
+    *flushes = combine_flushes;
+#else
+  if (puts)
+    *puts = 0;
+  if (bytes)
+    *bytes = 0;
+  if (flushes)
+    *flushes = 0;
+#endif
+}
+
+/* Split-phase transfers */
+
+/* Return the token of the coarray containing the address addr of this image
+ * and store the displacement of addr in the window of the coarray to disp,
+ * or return NULL when addr is in no coarray. */
+
+static caf_token_t
+find_coarray_token(void *addr, MPI_Aint *disp)
+{
+  struct caf_allocated_tokens_t *cur;
+
+  for (cur = caf_allocated_tokens; cur; cur = cur->prev)
+  {
+    if ((char *)addr >= cur->base && (char *)addr < cur->base + cur->size)
+    {
+      *disp = (char *)addr - cur->base;
+      return cur->token;
+    }
+  }
+  return NULL;
+}
+
+/* Start the transfer of bytes contiguous bytes between local on this image
+ * and the object at the address remote of a coarray on image image_index.
+ * The address remote is that of the object on this image, the coarray gives
+ * the memory on the other image.  The handle of the request is stored to
+ * request, or zero, when the transfer is complete already. */
+
+static void
+start_async(bool put, void *local, void *remote, size_t bytes,
+            int image_index, int *request)
+{
+  MPI_Aint disp;
+  caf_token_t token = find_coarray_token(remote, &disp);
+  MPI_Win win;
+  int rank, ierr;
+  void *direct;
+
+  *request = 0;
+  if (token == NULL)
+    caf_runtime_error("caf_%s_async: %p is not the address of a coarray",
+                      put ? "put" : "get", remote);
+  if (bytes == 0)
+    return;
+  win = *TOKEN(token);
+  rank = translate_rank(win, image_index - 1);
+  direct = self_address(win, rank, disp);
+#ifdef CAF_NODE_SHARED_MEMORY
+  if (direct == NULL)
+    direct = node_address(token, image_index, disp);
+#endif
+  if (direct)
+  {
+    if (put)
+      memmove(direct, local, bytes);
+    else
+      memmove(local, direct, bytes);
+    return;
+  }
+
+#if MPI_VERSION >= 3
+  {
+    async_request_t *r;
+    MPI_Datatype dt = MPI_BYTE;
+    int count = bytes;
+
+    if (put)
+      CAF_Win_lock_put(rank, disp, bytes, win);
+    else
+      CAF_Win_lock_get(rank, disp, bytes, win);
+    *request = new_async_request();
+    r = &async_requests[*request - 1];
+    r->win = win;
+    r->rank = rank;
+    r->put = put;
+    r->lo = disp;
+    r->len = bytes;
+    if (bytes > large_count_limit)
+    {
+      bytes_type(bytes, &dt);
+      ierr = MPI_Type_commit(&dt); chk_err(ierr);
+      count = 1;
+    }
+    if (put)
+      ierr = MPI_Rput(local, count, dt, rank, disp, count, dt, win, &r->req);
+    else
+      ierr = MPI_Rget(local, count, dt, rank, disp, count, dt, win, &r->req);
+    chk_err(ierr);
+    if (dt != MPI_BYTE)
+      MPI_Type_free(&dt);
+    r->active = true;
+    ++num_async_pending;
+  }
+#else // MPI_VERSION
+  /* Without request based RMA operations the transfer is done now. */
+  if (put)
+  {
+    CAF_Win_lock_put(rank, disp, bytes, win);
+    ierr = put_bytes(local, bytes, rank, disp, win); chk_err(ierr);
+    CAF_Win_unlock_put(rank, disp, bytes, win);
+  }
+  else
+  {
+    CAF_Win_lock_get(rank, disp, bytes, win);
+    ierr = get_bytes(local, bytes, rank, disp, win); chk_err(ierr);
+    CAF_Win_unlock_local(rank, win);
+  }
+#endif // MPI_VERSION
+}
+
+void
+PREFIX(get_async) (void *dest, void *remote, size_t bytes, int image_index,
+                   int *request)
+{
+  start_async(false, dest, remote, bytes, image_index, request);
+}
+
+void
+PREFIX(put_async) (void *remote, void *src, size_t bytes, int image_index,
+                   int *request)
+{
+  start_async(true, src, remote, bytes, image_index, request);
+}
+
+/* Complete the transfer of request and set the handle to zero. */
+
+void
+PREFIX(wait) (int *request)
+{
+#if MPI_VERSION >= 3
+  if (*request > 0 && *request <= async_requests_cap
+      && async_requests[*request - 1].active)
+    finish_async(&async_requests[*request - 1], false);
+#endif
+  *request = 0;
+}
+
+/* Set flag to whether the transfer of request is complete, completing it
+ * and setting the handle to zero, when it is. */
+
+void
+PREFIX(test) (int *request, bool *flag)
+{
+#if MPI_VERSION >= 3
+  if (*request > 0 && *request <= async_requests_cap
+      && async_requests[*request - 1].active)
+  {
+    async_request_t *r = &async_requests[*request - 1];
+    int done, ierr;
+
+    ierr = MPI_Test(&r->req, &done, MPI_STATUS_IGNORE); chk_err(ierr);
+    *flag = done;
+    if (!done)
+      return;
+    finish_async(r, true);
+  }
+#endif
+  *flag = true;
+  *request = 0;
+}
+
+/* Complete all pending transfers. */
+
+void
+PREFIX(wait_all) (void)
+{
+#if MPI_VERSION >= 3
+  complete_async(-1, MPI_WIN_NULL);
+#endif
+}
+
+
 /* Locking functions */
 
 void
@@ -7739,8 +10036,8 @@ PREFIX(lock) (caf_token_t token, size_t index, int image_index,
               int *acquired_lock, int *stat, char *errmsg,
               charlen_t errmsg_len)
 {
-  MPI_Win *p = TOKEN(token);
-  mutex_lock(*p, (image_index == 0) ? caf_this_image : image_index,
+  explicit_flush();
+  mutex_lock(token, (image_index == 0) ? caf_this_image : image_index,
              index, stat, acquired_lock, errmsg, errmsg_len);
 }
 
@@ -7749,13 +10046,84 @@ void
 PREFIX(unlock) (caf_token_t token, size_t index, int image_index,
                 int *stat, char *errmsg, charlen_t errmsg_len)
 {
-  MPI_Win *p = TOKEN(token);
-  mutex_unlock(*p, (image_index == 0) ? caf_this_image : image_index,
+  explicit_flush();
+  mutex_unlock(token, (image_index == 0) ? caf_this_image : image_index,
                index, stat, errmsg, errmsg_len);
 }
 
 /* Atomics operations */
 
+/* The accumulate operations of MPI are atomic with respect to each other
+ * under a shared lock too, therefore the atomics take shared locks on the
+ * target only and images updating the same variable do not serialize on an
+ * exclusive lock.  In lock_all mode no lock is taken at all; the operations
+ * are completed by a flush in the persistent epoch. */
+
+#ifdef CAF_NODE_SHARED_MEMORY
+/* The operations of node_atomic() besides the GFC_CAF_ATOMIC_* codes of
+ * atomic_op. */
+#define NODE_ATOMIC_DEFINE (-1)
+#define NODE_ATOMIC_REF (-2)
+#define NODE_ATOMIC_CAS (-3)
+
+/* Execute the atomic operation op on the variable of kind bytes at addr with
+ * the atomic instructions of the processor.  The previous value is stored to
+ * old, when old is not NULL.  Returns false for operations and kinds not
+ * supported. */
+
+static bool
+node_atomic(int op, void *addr, void *value, void *compare, void *old,
+            int kind)
+{
+#define KINDCASE(kind, type)                                                 \
+case kind:                                                                   \
+  {                                                                          \
+    type *var = (type *) addr, val = value ? *(type *) value : 0, prev = 0;  \
+    switch (op)                                                              \
+    {                                                                        \
+      case NODE_ATOMIC_DEFINE:                                               \
+        __atomic_store_n(var, val, __ATOMIC_SEQ_CST);                        \
+        break;                                                               \
+      case NODE_ATOMIC_REF:                                                  \
+        prev = __atomic_load_n(var, __ATOMIC_SEQ_CST);                       \
+        break;                                                               \
+      case NODE_ATOMIC_CAS:                                                  \
+        prev = *(type *) compare;                                            \
+        __atomic_compare_exchange_n(var, &prev, val, false,                  \
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);     \
+        break;                                                               \
+      case GFC_CAF_ATOMIC_ADD:                                               \
+        prev = __atomic_fetch_add(var, val, __ATOMIC_SEQ_CST);               \
+        break;                                                               \
+      case GFC_CAF_ATOMIC_AND:                                               \
+        prev = __atomic_fetch_and(var, val, __ATOMIC_SEQ_CST);               \
+        break;                                                               \
+      case GFC_CAF_ATOMIC_OR:                                                \
+        prev = __atomic_fetch_or(var, val, __ATOMIC_SEQ_CST);                \
+        break;                                                               \
+      case GFC_CAF_ATOMIC_XOR:                                               \
+        prev = __atomic_fetch_xor(var, val, __ATOMIC_SEQ_CST);               \
+        break;                                                               \
+      default:                                                               \
+        return false;                                                        \
+    }                                                                        \
+    if (old)                                                                 \
+      *(type *) old = prev;                                                  \
+  }                                                                          \
+  return true
+  switch (kind)
+  {
+    KINDCASE(1, int8_t);
+    KINDCASE(2, int16_t);
+    KINDCASE(4, int32_t);
+    KINDCASE(8, int64_t);
+    default:
+      return false;
+  }
+#undef KINDCASE
+}
+#endif // CAF_NODE_SHARED_MEMORY
+
 void
 PREFIX(atomic_define) (caf_token_t token, size_t offset,
                        int image_index, void *value, int *stat,
@@ -7764,12 +10132,24 @@ PREFIX(atomic_define) (caf_token_t token, size_t offset,
   MPI_Win *p = TOKEN(token);
   MPI_Datatype dt;
   int ierr = 0,
-      image = (image_index != 0) ? image_index - 1 : caf_this_image - 1;
+      image = translate_rank(*p, (image_index != 0) ? image_index - 1
+                                                    : caf_this_image - 1);
 
   selectType(kind, &dt);
 
+#ifdef CAF_NODE_SHARED_MEMORY
+  void *addr = node_atomic_address(token, image_index, offset);
+  if (addr != NULL && node_atomic(NODE_ATOMIC_DEFINE, addr, value, NULL, NULL,
+                                  kind))
+  {
+    if (stat)
+      *stat = 0;
+    return;
+  }
+#endif // CAF_NODE_SHARED_MEMORY
+
 #if MPI_VERSION >= 3
-  CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image, *p);
+  CAF_Win_lock(MPI_LOCK_SHARED, image, *p);
   ierr = MPI_Accumulate(value, 1, dt, image, offset, 1, dt, MPI_REPLACE, *p);
   chk_err(ierr);
   CAF_Win_unlock(image, *p);
@@ -7796,19 +10176,31 @@ PREFIX(atomic_ref) (caf_token_t token, size_t offset,
   MPI_Win *p = TOKEN(token);
   MPI_Datatype dt;
   int ierr = 0, 
-      image = (image_index != 0) ? image_index - 1 : caf_this_image - 1;
+      image = translate_rank(*p, (image_index != 0) ? image_index - 1
+                                                    : caf_this_image - 1);
 
   selectType(kind, &dt);
 
+#ifdef CAF_NODE_SHARED_MEMORY
+  void *addr = node_atomic_address(token, image_index, offset);
+  if (addr != NULL && node_atomic(NODE_ATOMIC_REF, addr, NULL, NULL, value,
+                                  kind))
+  {
+    if (stat)
+      *stat = 0;
+    return;
+  }
+#endif // CAF_NODE_SHARED_MEMORY
+
 #if MPI_VERSION >= 3
-  CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image, *p);
+  CAF_Win_lock(MPI_LOCK_SHARED, image, *p);
   ierr = MPI_Fetch_and_op(NULL, value, dt, image, offset, MPI_NO_OP, *p);
   chk_err(ierr);
-  CAF_Win_unlock(image, *p);
+  CAF_Win_unlock_local(image, *p);
 #else // MPI_VERSION
   CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image, *p);
   ierr = MPI_Get(value, 1, dt, image, offset, 1, dt, *p); chk_err(ierr);
-  CAF_Win_unlock(image, *p);
+  CAF_Win_unlock_local(image, *p);
 #endif // MPI_VERSION
 
   if (stat)
@@ -7827,12 +10219,24 @@ PREFIX(atomic_cas) (caf_token_t token, size_t offset, int image_index,
   MPI_Win *p = TOKEN(token);
   MPI_Datatype dt;
   int ierr = 0,
-      image = (image_index != 0) ? image_index - 1 : caf_this_image - 1;
+      image = translate_rank(*p, (image_index != 0) ? image_index - 1
+                                                    : caf_this_image - 1);
 
   selectType(kind, &dt);
 
+#ifdef CAF_NODE_SHARED_MEMORY
+  void *addr = node_atomic_address(token, image_index, offset);
+  if (addr != NULL && node_atomic(NODE_ATOMIC_CAS, addr, new_val, compare, old,
+                                  kind))
+  {
+    if (stat)
+      *stat = 0;
+    return;
+  }
+#endif // CAF_NODE_SHARED_MEMORY
+
 #if MPI_VERSION >= 3
-  CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image, *p);
+  CAF_Win_lock(MPI_LOCK_SHARED, image, *p);
   ierr = MPI_Compare_and_swap(new_val, compare, old, dt, image, offset, *p);
   chk_err(ierr);
   CAF_Win_unlock(image, *p);
@@ -7858,39 +10262,53 @@ PREFIX(atomic_op) (int op, caf_token_t token, size_t offset, int image_index,
   int ierr = 0;
   MPI_Datatype dt;
   MPI_Win *p = TOKEN(token);
-  int image = (image_index != 0) ? image_index - 1 : caf_this_image - 1;
+  int image = translate_rank(*p, (image_index != 0) ? image_index - 1
+                                                    : caf_this_image - 1);
+
+#ifdef CAF_NODE_SHARED_MEMORY
+  void *addr = node_atomic_address(token, image_index, offset);
+  if (addr != NULL && node_atomic(op, addr, value, NULL, old, kind))
+  {
+    if (stat)
+      *stat = 0;
+    return;
+  }
+#endif // CAF_NODE_SHARED_MEMORY
 
 #if MPI_VERSION >= 3
-  old = malloc(kind);
-  selectType(kind, &dt);
+  MPI_Op mpi_op = MPI_OP_NULL;
 
-  CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image, *p);
-  /* Atomic_add */
+  selectType(kind, &dt);
   switch(op) {
-    case 1:
-      ierr = MPI_Fetch_and_op(value, old, dt, image, offset, MPI_SUM, *p);
-      chk_err(ierr);
+    case GFC_CAF_ATOMIC_ADD:
+      mpi_op = MPI_SUM;
       break;
-    case 2:
-      ierr = MPI_Fetch_and_op(value, old, dt, image, offset, MPI_BAND, *p);
-      chk_err(ierr);
+    case GFC_CAF_ATOMIC_AND:
+      mpi_op = MPI_BAND;
       break;
-    case 4:
-      ierr = MPI_Fetch_and_op(value, old, dt, image, offset, MPI_BOR, *p);
-      chk_err(ierr);
+    case GFC_CAF_ATOMIC_OR:
+      mpi_op = MPI_BOR;
       break;
-    case 5:
-      ierr = MPI_Fetch_and_op(value, old, dt, image, offset, MPI_BXOR, *p);
-      chk_err(ierr);
+    case GFC_CAF_ATOMIC_XOR:
+      mpi_op = MPI_BXOR;
       break;
     default:
       printf("We apologize but the atomic operation requested for MPI < 3 "
              "is not yet implemented\n");
       break;
     }
-  CAF_Win_unlock(image, *p);
 
-  free(old);
+  /* The fetched value is returned in old, when the caller asks for it. */
+  if (mpi_op != MPI_OP_NULL)
+  {
+    CAF_Win_lock(MPI_LOCK_SHARED, image, *p);
+    if (old)
+      ierr = MPI_Fetch_and_op(value, old, dt, image, offset, mpi_op, *p);
+    else
+      ierr = MPI_Accumulate(value, 1, dt, image, offset, 1, dt, mpi_op, *p);
+    chk_err(ierr);
+    CAF_Win_unlock(image, *p);
+  }
 #else // MPI_VERSION
   #warning atomic_op for MPI is not yet implemented
   printf("We apologize but atomic_op for MPI < 3 is not yet implemented\n");
@@ -7905,6 +10323,11 @@ PREFIX(atomic_op) (int op, caf_token_t token, size_t offset, int image_index,
 
 /* Events */
 
+/* The counters of events are updated with accumulate operations, which are
+ * atomic with respect to each other under shared locks too, therefore posts
+ * and queries of the same event do not serialize on an exclusive lock.  In
+ * lock_all mode they are completed by a flush in the persistent epoch. */
+
 void
 PREFIX(event_post) (caf_token_t token, size_t index, int image_index,
                     int *stat, char *errmsg, charlen_t errmsg_len)
@@ -7912,16 +10335,32 @@ PREFIX(event_post) (caf_token_t token, size_t index, int image_index,
   int value = 1, ierr = 0, flag;
   MPI_Win *p = TOKEN(token);
   const char msg[] = "Error on event post";
-  int image = (image_index == 0) ? caf_this_image - 1 : image_index - 1;
+  int image = translate_rank(*p, (image_index == 0) ? caf_this_image - 1
+                                                    : image_index - 1);
 
   if (stat != NULL)
     *stat = 0;
 
 #if MPI_VERSION >= 3
-  CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image, *p);
-  ierr = MPI_Accumulate(&value, 1, MPI_INT, image, index * sizeof(int), 1, 
-                        MPI_INT, MPI_SUM, *p); chk_err(ierr);
-  CAF_Win_unlock(image, *p);
+  /* The data written before the post has to be visible to the waiting
+   * image. */
+  explicit_flush();
+#ifdef CAF_NODE_SHARED_MEMORY
+  int *count = node_atomic_address(token, image_index, index * sizeof(int));
+  if (count != NULL)
+  {
+    __atomic_fetch_add(count, value, __ATOMIC_SEQ_CST);
+    event_wake(image_index);
+  }
+  else
+#endif // CAF_NODE_SHARED_MEMORY
+  {
+    CAF_Win_lock(MPI_LOCK_SHARED, image, *p);
+    ierr = MPI_Accumulate(&value, 1, MPI_INT, image, index * sizeof(int), 1,
+                          MPI_INT, MPI_SUM, *p); chk_err(ierr);
+    CAF_Win_unlock(image, *p);
+    event_notify(image_index);
+  }
 #else // MPI_VERSION
   #warning Events for MPI-2 are not implemented
   printf("Events for MPI-2 are not supported, "
@@ -7949,44 +10388,73 @@ void
 PREFIX(event_wait) (caf_token_t token, size_t index, int until_count,
                     int *stat, char *errmsg, charlen_t errmsg_len)
 {
-  int ierr = 0, count = 0, i, image = caf_this_image - 1;
-  int *var = NULL, flag, old = 0, newval = 0;
-  const int spin_loop_max = 20000;
   MPI_Win *p = TOKEN(token);
+  int ierr = 0, count = 0, i, image = translate_rank(*p, caf_this_image - 1);
+  int *var = NULL, flag, old = 0, newval = 0;
   const char msg[] = "Error on event wait";
 
   if (stat != NULL)
     *stat = 0;
 
+  explicit_flush();
+
   ierr = MPI_Win_get_attr(*p, MPI_WIN_BASE, &var, &flag); chk_err(ierr);
 
-  MPI_Win_lock_all(MPI_MODE_NOCHECK, *p);
-  for (i = 0; i < spin_loop_max; ++i)
+#ifdef CAF_NODE_SHARED_MEMORY
+  if (node_atomic_address(token, 0, 0) != NULL)
   {
-    ierr = MPI_Win_sync(*p); chk_err(ierr);
-    count = var[index];
-    if (count >= until_count)
-      break;
+    for (i = 0; ; ++i)
+    {
+      const int word = event_word();
+      count = __atomic_load_n(&var[index], __ATOMIC_SEQ_CST);
+      if (count >= until_count)
+        break;
+      if (i >= event_spin)
+        event_sleep(word);
+    }
   }
-
-  i = 1;
-  while (count < until_count)
+  else
+#endif // CAF_NODE_SHARED_MEMORY
   {
-    ierr = MPI_Win_sync(*p); chk_err(ierr);
-    count = var[index];
-    usleep(10 * i);
-    ++i;
-    /* Needed to enforce MPI progress */
-    ierr = MPI_Win_flush(image, *p); chk_err(ierr);
+    bool sleeping = false;
+
+    if (!caf_lock_all_epoch)
+      MPI_Win_lock_all(MPI_MODE_NOCHECK, *p);
+    for (i = 0; ; ++i)
+    {
+      ierr = MPI_Win_sync(*p); chk_err(ierr);
+      count = var[index];
+      if (count >= until_count)
+        break;
+      if (i < event_spin)
+        continue;
+      /* Block only after the counter was read again with the announcement
+       * set. */
+      if (sleeping)
+        wait_event_notification();
+      else
+        announce_event_sleep();
+      sleeping = !sleeping;
+    }
+    if (sleeping)
+      cancel_event_sleep();
+    if (!caf_lock_all_epoch)
+      MPI_Win_unlock_all(*p);
   }
 
   newval = -until_count;
 
-  MPI_Win_unlock_all(*p);
-  CAF_Win_lock(MPI_LOCK_SHARED, image, *p);
-  ierr = MPI_Fetch_and_op(&newval, &old, MPI_INT, image, index * sizeof(int),
-                          MPI_SUM, *p); chk_err(ierr);
-  CAF_Win_unlock(image, *p);
+#ifdef CAF_NODE_SHARED_MEMORY
+  if (node_atomic_address(token, 0, 0) != NULL)
+    __atomic_fetch_add(&var[index], newval, __ATOMIC_SEQ_CST);
+  else
+#endif // CAF_NODE_SHARED_MEMORY
+  {
+    CAF_Win_lock(MPI_LOCK_SHARED, image, *p);
+    ierr = MPI_Fetch_and_op(&newval, &old, MPI_INT, image,
+                            index * sizeof(int), MPI_SUM, *p); chk_err(ierr);
+    CAF_Win_unlock(image, *p);
+  }
 
   check_image_health(image, stat);
 
@@ -8011,16 +10479,25 @@ PREFIX(event_query) (caf_token_t token, size_t index,
 {
   MPI_Win *p = TOKEN(token);
   int ierr = 0,
-      image = (image_index == 0) ? caf_this_image - 1 : image_index - 1;
+      image = translate_rank(*p, (image_index == 0) ? caf_this_image - 1
+                                                    : image_index - 1);
 
   if (stat != NULL)
     *stat = 0;
 
 #if MPI_VERSION >= 3
-  CAF_Win_lock(MPI_LOCK_EXCLUSIVE, image, *p);
-  ierr = MPI_Fetch_and_op(NULL, count, MPI_INT, image, index * sizeof(int),
-                          MPI_NO_OP, *p); chk_err(ierr);
-  CAF_Win_unlock(image, *p);
+#ifdef CAF_NODE_SHARED_MEMORY
+  int *var = node_atomic_address(token, image_index, index * sizeof(int));
+  if (var != NULL)
+    *count = __atomic_load_n(var, __ATOMIC_SEQ_CST);
+  else
+#endif // CAF_NODE_SHARED_MEMORY
+  {
+    CAF_Win_lock(MPI_LOCK_SHARED, image, *p);
+    ierr = MPI_Fetch_and_op(NULL, count, MPI_INT, image, index * sizeof(int),
+                            MPI_NO_OP, *p); chk_err(ierr);
+    CAF_Win_unlock_local(image, *p);
+  }
 #else // MPI_VERSION
 #warning Events for MPI-2 are not implemented
   printf("Events for MPI-2 are not supported, "
@@ -8030,6 +10507,234 @@ PREFIX(event_query) (caf_token_t token, size_t index,
     *stat = ierr;
 }
 
+/* A post of event_post_many. */
+typedef struct
+{
+  int image_index;
+  int rank;
+  size_t index;
+  /* The address of the counter, when it is accessed directly. */
+  int *var;
+} event_post_t;
+
+static int
+compare_event_posts(const void *a, const void *b)
+{
+  const event_post_t *pa = (const event_post_t *) a,
+                     *pb = (const event_post_t *) b;
+  return pa->rank != pb->rank ? (pa->rank > pb->rank) - (pa->rank < pb->rank)
+                              : (pa->index > pb->index)
+                                - (pa->index < pb->index);
+}
+
+/* Post the events indices[i] (one based) of the event coarray at events on
+ * images[i] for i < count.  events is the address of the event variable or
+ * of the first element of the event array on this image.  The posts are
+ * grouped by target: the targets are locked together, all accumulates are
+ * issued and each target is unlocked, or flushed in lock_all mode, and
+ * notified once. */
+
+void
+PREFIX(event_post_many) (void *events, int count, int *indices, int *images)
+{
+  event_post_t *posts;
+  caf_token_t token;
+  MPI_Aint disp;
+  MPI_Win win;
+  int value = 1, ierr, i, first;
+
+  if (count <= 0)
+    return;
+  token = find_coarray_token(events, &disp);
+  if (token == NULL)
+    caf_runtime_error("caf_event_post_many: %p is not the address of an "
+                      "event coarray", events);
+  win = *TOKEN(token);
+
+  /* The data written before the posts has to be visible to the waiting
+   * images. */
+  explicit_flush();
+
+  posts = (event_post_t *) malloc(count * sizeof(event_post_t));
+  for (i = 0; i < count; ++i)
+  {
+    posts[i].image_index = images[i];
+    posts[i].rank = translate_rank(win, images[i] - 1);
+    posts[i].index = disp / sizeof(int) + indices[i] - 1;
+#ifdef CAF_NODE_SHARED_MEMORY
+    posts[i].var = node_atomic_address(token, images[i],
+                                       posts[i].index * sizeof(int));
+#else
+    posts[i].var = NULL;
+#endif
+  }
+  qsort(posts, count, sizeof(event_post_t), compare_event_posts);
+
+  /* The counters of a target are either all accessed directly or none. */
+  for (i = 0; i < count; i = first)
+  {
+    if (posts[i].var == NULL)
+      CAF_Win_lock(MPI_LOCK_SHARED, posts[i].rank, win);
+    for (first = i; first < count && posts[first].rank == posts[i].rank;
+         ++first)
+    {
+      if (posts[first].var != NULL)
+      {
+#ifdef CAF_NODE_SHARED_MEMORY
+        __atomic_fetch_add(posts[first].var, value, __ATOMIC_SEQ_CST);
+#endif
+        continue;
+      }
+      ierr = MPI_Accumulate(&value, 1, MPI_INT, posts[first].rank,
+                            posts[first].index * sizeof(int), 1, MPI_INT,
+                            MPI_SUM, win); chk_err(ierr);
+    }
+  }
+
+  for (i = 0; i < count; i = first)
+  {
+    for (first = i; first < count && posts[first].rank == posts[i].rank;
+         ++first)
+      ;
+#ifdef CAF_NODE_SHARED_MEMORY
+    if (posts[i].var != NULL)
+    {
+      event_wake(posts[i].image_index);
+      continue;
+    }
+#endif
+    ierr = CAF_Win_unlock(posts[i].rank, win); chk_err(ierr);
+    event_notify(posts[i].image_index);
+  }
+  free(posts);
+}
+
+/* Wait until one of the events indices[i] (one based) of the event coarrays
+ * at events[i] on this image, i < count, has been posted until_counts[i]
+ * times, subtract until_counts[i] from that one and return its position i + 1
+ * in the list.  After each wakeup the counters are read in one pass and the
+ * first event of the list found ready fires; the others are left alone.  So
+ * events made ready while this image waits fire in the order of their
+ * arrival, but of those ready at the call, or made ready between two passes,
+ * the first in the list fires, whichever was posted first. */
+
+int
+PREFIX(event_wait_any) (int count, void **events, int *indices,
+                        int *until_counts)
+{
+  MPI_Win *wins;
+  int **vars;
+  bool *direct;
+  bool any_direct = false, sleeping = false;
+  int which = -1, word = 0, newval, old, ierr, i, j, k;
+
+  if (count <= 0)
+    return 0;
+
+  explicit_flush();
+
+  wins = (MPI_Win *) malloc(count * sizeof(MPI_Win));
+  vars = (int **) malloc(count * sizeof(int *));
+  direct = (bool *) malloc(count * sizeof(bool));
+  for (i = 0; i < count; ++i)
+  {
+    MPI_Aint disp;
+    caf_token_t token = find_coarray_token(events[i], &disp);
+
+    if (token == NULL)
+      caf_runtime_error("caf_event_wait_any: %p is not the address of an "
+                        "event coarray", events[i]);
+    wins[i] = *TOKEN(token);
+    vars[i] = (int *) events[i] + indices[i] - 1;
+#ifdef CAF_NODE_SHARED_MEMORY
+    direct[i] = node_atomic_address(token, 0, 0) != NULL;
+#else
+    direct[i] = false;
+#endif
+    any_direct |= direct[i];
+    /* The counters accessed by RMA are read in an epoch of each window. */
+    for (j = 0; j < i && (direct[j] || wins[j] != wins[i]); ++j)
+      ;
+    if (!direct[i] && j == i && !caf_lock_all_epoch)
+      MPI_Win_lock_all(MPI_MODE_NOCHECK, wins[i]);
+  }
+
+  for (k = 0; which < 0; ++k)
+  {
+#ifdef CAF_NODE_SHARED_MEMORY
+    if (any_direct)
+      word = event_word();
+#endif
+    for (i = 0; i < count; ++i)
+    {
+      int value;
+
+      if (direct[i])
+        value = __atomic_load_n(vars[i], __ATOMIC_SEQ_CST);
+      else
+      {
+        ierr = MPI_Win_sync(wins[i]); chk_err(ierr);
+        value = *vars[i];
+      }
+      if (value >= until_counts[i])
+      {
+        which = i;
+        break;
+      }
+    }
+    if (which >= 0 || k < event_spin)
+      continue;
+#ifdef CAF_NODE_SHARED_MEMORY
+    /* The counters of RMA posts are read again after the sleep, which returns
+     * at least once per millisecond, so they need no notification. */
+    if (any_direct)
+      event_sleep(word);
+    else
+#endif
+    {
+      /* Block only after the counters were read again with the announcement
+       * set. */
+      if (sleeping)
+        wait_event_notification();
+      else
+        announce_event_sleep();
+      sleeping = !sleeping;
+    }
+  }
+  if (sleeping)
+    cancel_event_sleep();
+
+  for (i = 0; i < count; ++i)
+  {
+    for (j = 0; j < i && (direct[j] || wins[j] != wins[i]); ++j)
+      ;
+    if (!direct[i] && j == i && !caf_lock_all_epoch)
+      MPI_Win_unlock_all(wins[i]);
+  }
+
+  newval = -until_counts[which];
+  if (direct[which])
+    __atomic_fetch_add(vars[which], newval, __ATOMIC_SEQ_CST);
+  else
+  {
+    char *base;
+    int flag, rank = translate_rank(wins[which], caf_this_image - 1);
+
+    ierr = MPI_Win_get_attr(wins[which], MPI_WIN_BASE, &base, &flag);
+    chk_err(ierr);
+    CAF_Win_lock(MPI_LOCK_SHARED, rank, wins[which]);
+    ierr = MPI_Fetch_and_op(&newval, &old, MPI_INT, rank,
+                            (char *) vars[which] - base, MPI_SUM,
+                            wins[which]); chk_err(ierr);
+    CAF_Win_unlock(rank, wins[which]);
+  }
+
+  free(wins);
+  free(vars);
+  free(direct);
+  return which + 1;
+}
+
 
 /* Internal function to execute the part that is common to all (error) stop
  * functions. */
@@ -8172,7 +10877,7 @@ PREFIX(image_status) (int image)
       ierr = MPI_Get(&status, 1, MPI_INT, image - 1, 0, 1, MPI_INT, *stat_tok);
       chk_err(ierr);
       dprint("Image status of image #%d is: %d\n", image, status);
-      CAF_Win_unlock(image - 1, *stat_tok);
+      CAF_Win_unlock_local(image - 1, *stat_tok);
       image_stati[image - 1] = status;
     }
     else if (status == MPIX_ERR_PROC_FAILED)
@@ -8410,9 +11115,12 @@ void PREFIX(change_team) (caf_team_t *team,
   tmp_team = tmp_used->team_list_elem->team;
   tmp_comm = (MPI_Comm *)tmp_team;
   CAF_COMM_WORLD = *tmp_comm;
+  invalidate_win_rank_cache();
+  free_sync_plans();
   int ierr = MPI_Comm_rank(*tmp_comm,&caf_this_image); chk_err(ierr);
   caf_this_image++;
   ierr = MPI_Comm_size(*tmp_comm,&caf_num_images); chk_err(ierr);
+  explicit_flush();
   ierr = MPI_Barrier(*tmp_comm); chk_err(ierr);
 }
 
@@ -8445,6 +11153,7 @@ void PREFIX(end_team) (caf_team_t *team __attribute__((unused)))
   MPI_Comm *tmp_comm;
   int ierr;
 
+  explicit_flush();
   ierr = MPI_Barrier(CAF_COMM_WORLD); chk_err(ierr);
   if (used_teams->prev == NULL)
     caf_runtime_error("END TEAM called on initial team");
@@ -8456,6 +11165,8 @@ void PREFIX(end_team) (caf_team_t *team __attribute__((unused)))
   tmp_team = tmp_used->team_list_elem->team;
   tmp_comm = (MPI_Comm *)tmp_team;
   CAF_COMM_WORLD = *tmp_comm;
+  invalidate_win_rank_cache();
+  free_sync_plans();
   /* CAF_COMM_WORLD = (MPI_Comm)*tmp_used->team_list_elem->team; */
   ierr = MPI_Comm_rank(CAF_COMM_WORLD,&caf_this_image); chk_err(ierr);
   caf_this_image++;
@@ -8489,5 +11200,6 @@ void PREFIX(sync_team) (caf_team_t *team , int unused __attribute__((unused)))
     caf_runtime_error("SYNC TEAM called on team different from current, "
                       "or ancestor, or child");
 
+  explicit_flush();
   int ierr = MPI_Barrier(*tmp_comm); chk_err(ierr);
 }
@@ -0,0 +1,64 @@
+! Test the wakeup of images waiting for events: pairs of images pass a token
+! back and forth many times, so that posts arrive before, while and after the
+! partner blocks; an image only polls its event with event_query while it is
+! posted to, and then takes the posts without blocking; and every image posts
+! to its own event before waiting for it.
+
+program event_notify
+
+  use iso_fortran_env, only : event_type
+  implicit none
+
+  integer, parameter :: rounds = 500, posts = 2000
+  type(event_type) :: ping[*], polled[*], own[*]
+  integer :: me, np, partner, k, cnt
+
+  me = this_image()
+  np = num_images()
+  if (np < 2) error stop "Test failed: at least 2 images are needed."
+  partner = merge(me + 1, me - 1, mod(me, 2) == 1)
+
+  ! Ping-pong between image pairs.
+  if (partner <= np) then
+    do k = 1, rounds
+      if (mod(me, 2) == 1) then
+        event post (ping[partner])
+        event wait (ping)
+      else
+        event wait (ping)
+        event post (ping[partner])
+      end if
+    end do
+  end if
+  call event_query(ping, cnt)
+  if (cnt /= 0) error stop "Test failed: ping-pong count."
+  sync all
+
+  ! Image 1 posts to image 2, which polls only.
+  if (me == 1) then
+    do k = 1, posts
+      event post (polled[2])
+    end do
+  else if (me == 2) then
+    do
+      call event_query(polled, cnt)
+      if (cnt == posts) exit
+      if (cnt > posts) error stop "Test failed: too many posts."
+    end do
+    event wait (polled, until_count=posts)
+    call event_query(polled, cnt)
+    if (cnt /= 0) error stop "Test failed: polled count."
+  end if
+
+  ! Posts to this image.
+  do k = 1, 10
+    event post (own)
+  end do
+  event post (own[me])
+  event wait (own, until_count=11)
+  call event_query(own, cnt)
+  if (cnt /= 0) error stop "Test failed: local post count."
+
+  sync all
+  if (me == 1) print *, "Test passed."
+end program
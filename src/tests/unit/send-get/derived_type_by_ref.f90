@@ -0,0 +1,65 @@
+! Test gets and sends of the components of a derived type coarray, which
+! move a section element by element in the *_by_ref routines: a component
+! of all or every other element of an array of derived type, with and
+! without kind conversion, and sections of array and allocatable components.
+
+program derived_type_by_ref
+
+  implicit none
+
+  integer, parameter :: n = 10
+
+  type t
+    integer :: arr(4)
+    real(kind=8) :: ra(3)
+    integer, allocatable :: alloc(:)
+  end type t
+
+  type(t), save :: objs(n)[*]
+  type(t), save :: single[*]
+  integer :: ivals(n), iarr(4), j, k, me
+  real(kind=4) :: rvals(n)
+
+  if (num_images() < 2) error stop "Test failed: at least 2 images are needed."
+  me = this_image()
+
+  do k = 1, n
+    objs(k)%arr = [(me * 100 + 10 * k + j, j = 1, 4)]
+    objs(k)%ra = [(me * 1000 + 10 * k + j + 0.5d0, j = 1, 3)]
+  end do
+  single%arr = [(me * 10 + j, j = 1, 4)]
+  allocate(single%alloc(9))
+  single%alloc = [(me * 10 + k, k = 1, 9)]
+  sync all
+
+  if (me == 1) then
+    ! Gets
+    rvals = objs(:)[2]%ra(2)
+    if (any(rvals /= [(real(2000 + 10 * k + 2.5d0, 4), k = 1, n)])) &
+      error stop "Test failed: converting get of an array component element."
+    ivals(1:5) = objs(1:n:2)[2]%arr(4)
+    if (any(ivals(1:5) /= [(200 + 10 * k + 4, k = 1, n, 2)])) &
+      error stop "Test failed: strided get of an array component element."
+    iarr(1:2) = objs(5)[2]%arr(1:4:2)
+    if (any(iarr(1:2) /= [251, 253])) &
+      error stop "Test failed: get of an array component section."
+    iarr(1:2) = single[2]%arr(2:4:2)
+    if (any(iarr(1:2) /= [22, 24])) &
+      error stop "Test failed: get of a scalar's array component section."
+    iarr = single[2]%alloc(2:8:2)
+    if (any(iarr /= [22, 24, 26, 28])) &
+      error stop "Test failed: get of an allocatable component section."
+
+    ! Sends
+    single[2]%alloc(1:9:2) = [(-k, k = 1, 9, 2)]
+  end if
+  sync all
+
+  if (me == 2) then
+    if (any(single%alloc /= [-1, 22, -3, 24, -5, 26, -7, 28, -9])) &
+      error stop "Test failed: send to an allocatable component section."
+  end if
+
+  sync all
+  if (me == 1) print *, "Test passed."
+end program
@@ -0,0 +1,80 @@
+! Test reads of a remote image in the segment of puts to it: reads of the
+! bytes just put have to return the new values, and reads of other bytes the
+! old ones.  In the lock_all epoch the puts are completed at the next image
+! control statement or before a read overlapping them only.
+
+program read_after_write
+
+  implicit none
+
+  integer, parameter :: n = 400
+
+  type t
+    integer, allocatable :: alloc(:)
+  end type t
+
+  integer :: a(n)[*], b(n)[*]
+  type(t) :: obj[*]
+  integer :: x, v(n), k, me
+
+  if (num_images() < 2) error stop "Test failed: at least 2 images are needed."
+  me = this_image()
+  a = [(me * 1000 + k, k = 1, n)]
+  b = 0
+  allocate(obj%alloc(9))
+  obj%alloc = [(me * 10 + k, k = 1, 9)]
+  sync all
+
+  if (me == 1) then
+    ! Scalars.
+    a(5)[2] = -5
+    x = a(5)[2]
+    if (x /= -5) error stop "Test failed: scalar read after write."
+    x = a(6)[2]
+    if (x /= 2006) error stop "Test failed: disjoint scalar read."
+
+    ! Contiguous sections, overlapping and disjoint.
+    a(11:20)[2] = [(-k, k = 11, 20)]
+    v(1:10) = a(16:25)[2]
+    if (any(v(1:10) /= [(-k, k = 16, 20), (2000 + k, k = 21, 25)])) &
+      error stop "Test failed: overlapping read after write."
+    v(1:10) = a(101:110)[2]
+    if (any(v(1:10) /= [(2000 + k, k = 101, 110)])) &
+      error stop "Test failed: disjoint read after write."
+
+    ! Strided sections, interleaved and overlapping.
+    a(200:240:4)[2] = [(-k, k = 200, 240, 4)]
+    v(1:11) = a(201:241:4)[2]
+    if (any(v(1:11) /= [(2000 + k, k = 201, 241, 4)])) &
+      error stop "Test failed: interleaved strided read after write."
+    v(1:21) = a(200:240:2)[2]
+    if (any(v(1:21) /= [(merge(-k, 2000 + k, mod(k, 4) == 0), &
+                         k = 200, 240, 2)])) &
+      error stop "Test failed: overlapping strided read after write."
+
+    ! Vector subscripts.
+    a([305, 301, 303])[2] = [-305, -301, -303]
+    v(1:7) = a(300:306)[2]
+    if (any(v(1:7) /= [2300, -301, 2302, -303, 2304, -305, 2306])) &
+      error stop "Test failed: read after vector subscript write."
+
+    ! An allocatable component.
+    obj[2]%alloc(1:9:2) = [(-k, k = 1, 9, 2)]
+    v(1:5) = obj[2]%alloc(1:9:2)
+    if (any(v(1:5) /= [(-k, k = 1, 9, 2)])) &
+      error stop "Test failed: component read after write."
+
+    ! A sendget reading the bytes put.
+    a(351:360)[2] = [(-k, k = 351, 360)]
+    b(1:10)[2] = a(351:360)[2]
+  end if
+  sync all
+
+  if (me == 2) then
+    if (any(b(1:10) /= [(-k, k = 351, 360)]) .or. any(b(11:) /= 0)) &
+      error stop "Test failed: sendget after write."
+  end if
+
+  sync all
+  if (me == 1) print *, "Test passed."
+end program
@@ -0,0 +1,57 @@
+! Test that the cached pointers and descriptors of remote allocatable
+! components are reused within a segment only: image 1 reads and writes the
+! components of image 2 several times per segment, while image 2 deallocates
+! and reallocates them with other shapes between the segments.
+
+program remote_comp_cache
+
+  implicit none
+
+  type t
+    integer, allocatable :: v(:)
+    real, allocatable :: s
+  end type t
+
+  type(t), save :: obj[*]
+  integer, allocatable :: x(:)
+  integer :: i, k, me, step
+  real :: r
+
+  if (num_images() < 2) error stop "Test failed: at least 2 images are needed."
+  me = this_image()
+
+  do step = 1, 3
+    ! Image 2 changes the shape and the place of its components.
+    if (me == 2) then
+      if (allocated(obj%v)) deallocate(obj%v)
+      if (allocated(obj%s)) deallocate(obj%s)
+      allocate(obj%v(4 * step + 1))
+      obj%v = [(100 * step + i, i = 1, 4 * step + 1)]
+      allocate(obj%s)
+      obj%s = step
+    end if
+    sync all
+
+    if (me == 1) then
+      do k = 1, 3
+        x = obj[2]%v
+        if (size(x) /= 4 * step + 1) error stop "Test failed: wrong shape."
+        if (any(x /= [(100 * step + i, i = 1, 4 * step + 1)])) &
+          error stop "Test failed: wrong values."
+        r = obj[2]%s
+        if (r /= step) error stop "Test failed: wrong scalar."
+      end do
+      ! Writes through the cached component have to reach the current memory.
+      obj[2]%v(2) = -step
+      if (obj[2]%v(2) /= -step) error stop "Test failed: put not seen."
+    end if
+    sync all
+
+    if (me == 2) then
+      if (obj%v(2) /= -step) error stop "Test failed: put not received."
+    end if
+  end do
+
+  sync all
+  if (me == 1) print *, "Test passed."
+end program
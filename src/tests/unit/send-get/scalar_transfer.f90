@@ -0,0 +1,133 @@
+! Test puts and gets of scalar coarrays and of coarray elements, to the right
+! neighbour, from the left one and to this image: integers, reals and
+! logicals of each kind, elements of complex arrays, characters of kinds 1
+! and 4, a derived type, and scalars whose kind or length differs between both
+! sides, which take the generic path.  (gfortran passes a wrong offset for
+! complex scalar coarrays themselves.)
+
+program scalar_transfer
+
+  implicit none
+
+  integer, parameter :: ck4 = selected_char_kind("ISO_10646")
+
+  type t
+    integer :: i
+    real(kind=8) :: r
+    character(len=3) :: c
+  end type t
+
+  integer(kind=1) :: i1[*], li1
+  integer(kind=2) :: i2[*], li2
+  integer(kind=4) :: i4[*], li4, arr(5)[*]
+  integer(kind=8) :: i8[*], li8
+  real(kind=4) :: r4[*], lr4
+  real(kind=8) :: r8[*], lr8
+  complex(kind=4) :: z4(2)[*], lz4
+  complex(kind=8) :: z8(2)[*], lz8
+  logical :: l[*], ll
+  character(len=5) :: c5[*], lc5
+  character(len=2) :: lc2
+  character(kind=ck4, len=4) :: u4[*], lu4
+  type(t) :: d[*], ld
+  integer :: me, np, left, right, k
+
+  me = this_image()
+  np = num_images()
+  if (np < 2) error stop "Test failed: at least 2 images are needed."
+  left = merge(np, me - 1, me == 1)
+  right = merge(1, me + 1, me == np)
+  arr = 0
+  sync all
+
+  ! Puts of the same type and kind to the right neighbour.
+  i1[right] = int(me, 1)
+  i2[right] = int(-me * 100, 2)
+  i4[right] = me * 100000
+  i8[right] = me * 10000000000_8
+  r4[right] = me + 0.25
+  r8[right] = me + 0.125d0
+  z4(2)[right] = cmplx(me, -me, 4)
+  z8(1)[right] = cmplx(me, 2 * me, 8)
+  l[right] = mod(me, 2) == 0
+  lc5 = "abcde"
+  lc5(1:1) = achar(iachar("a") + me)
+  c5[right] = lc5
+  lu4 = ck4_"wxyz"
+  u4[right] = lu4
+  d[right] = t(me, me * 0.5d0, "pqr")
+  arr(3)[right] = -me
+  sync all
+
+  if (i1 /= left .or. i2 /= -left * 100 .or. i4 /= left * 100000 &
+      .or. i8 /= left * 10000000000_8) error stop "Test failed: integer put."
+  if (r4 /= left + 0.25 .or. r8 /= left + 0.125d0) &
+    error stop "Test failed: real put."
+  if (z4(2) /= cmplx(left, -left, 4) .or. z8(1) /= cmplx(left, 2 * left, 8)) &
+    error stop "Test failed: complex put."
+  if (l .neqv. mod(left, 2) == 0) error stop "Test failed: logical put."
+  if (c5 /= achar(iachar("a") + left) // "bcde") &
+    error stop "Test failed: character put."
+  if (u4 /= ck4_"wxyz") error stop "Test failed: character(kind=4) put."
+  if (d%i /= left .or. d%r /= left * 0.5d0 .or. d%c /= "pqr") &
+    error stop "Test failed: derived type put."
+  if (any(arr /= [0, 0, -left, 0, 0])) error stop "Test failed: element put."
+  sync all
+
+  ! Gets of the same type and kind from the left neighbour, which holds the
+  ! values put by its own left neighbour.
+  k = merge(np, left - 1, left == 1)
+  li1 = i1[left]
+  li2 = i2[left]
+  li4 = i4[left]
+  li8 = i8[left]
+  lr4 = r4[left]
+  lr8 = r8[left]
+  lz4 = z4(2)[left]
+  lz8 = z8(1)[left]
+  ll = l[left]
+  lc5 = c5[left]
+  lu4 = u4[left]
+  ld = d[left]
+  li4 = li4 + arr(3)[left]
+  if (li1 /= k .or. li2 /= -k * 100 .or. li4 /= k * 100000 - k &
+      .or. li8 /= k * 10000000000_8) error stop "Test failed: integer get."
+  if (lr4 /= k + 0.25 .or. lr8 /= k + 0.125d0) &
+    error stop "Test failed: real get."
+  if (lz4 /= cmplx(k, -k, 4) .or. lz8 /= cmplx(k, 2 * k, 8)) &
+    error stop "Test failed: complex get."
+  if (ll .neqv. mod(k, 2) == 0) error stop "Test failed: logical get."
+  if (lc5 /= achar(iachar("a") + k) // "bcde") &
+    error stop "Test failed: character get."
+  if (lu4 /= ck4_"wxyz") error stop "Test failed: character(kind=4) get."
+  if (ld%i /= k .or. ld%r /= k * 0.5d0 .or. ld%c /= "pqr") &
+    error stop "Test failed: derived type get."
+  sync all
+
+  ! Kinds and lengths that differ between both sides.
+  i4[right] = 7_8 * me
+  r8[right] = me * 3
+  lc2 = "ok"
+  c5[right] = lc2
+  sync all
+  if (i4 /= 7 * left .or. r8 /= left * 3d0 .or. c5 /= "ok   ") &
+    error stop "Test failed: converting put."
+  sync all
+  li8 = i4[left]
+  lr4 = r8[left]
+  lc2 = c5[left]
+  if (li8 /= 7 * k .or. lr4 /= k * 3.0 .or. lc2 /= "ok") &
+    error stop "Test failed: converting get."
+  sync all
+
+  ! This image.
+  i8[me] = -5_8
+  li8 = i8[me]
+  d[me] = t(-me, 1d0, "xyz")
+  ld = d[me]
+  if (i8 /= -5 .or. li8 /= -5 .or. ld%i /= -me .or. ld%c /= "xyz") &
+    error stop "Test failed: access to this image."
+
+  sync all
+  if (me == 1) print *, "Test passed."
+end program
@@ -0,0 +1,47 @@
+! Test sendget of arrays larger than a pipeline chunk between two images
+! that are both remote, while another pair of images copies in the opposite
+! direction within the same coarray at the same time.
+!
+! Image 1 copies the upper half of a on image 4 to the lower half on image 3,
+! image 2 the upper half on image 3 to the lower half on image 4.  This needs
+! at least four images, so that neither image of a copy is the one running it.
+! The copies are repeated, so that those of images 1 and 2 overlap.
+
+program sendget_opposite
+
+  implicit none
+
+  integer, parameter :: n = 200000
+  real(kind=8), save :: a(2 * n)[*]
+  integer, parameter :: steps = 20
+  integer :: i, me, step
+  logical :: test_passed = .true.
+
+  if (num_images() < 4) error stop "Test failed: at least 4 images are needed."
+  me = this_image()
+
+  a(1:n) = 0
+  a(n + 1:2 * n) = [(real(i, 8) + me * n, i = 1, n)]
+  sync all
+
+  do step = 1, steps
+    select case (me)
+    case (1)
+      a(1:n)[3] = a(n + 1:2 * n)[4]
+    case (2)
+      a(1:n)[4] = a(n + 1:2 * n)[3]
+    end select
+  end do
+  sync all
+
+  select case (me)
+  case (3)
+    test_passed = all(a(1:n) == [(real(i, 8) + 4 * n, i = 1, n)])
+  case (4)
+    test_passed = all(a(1:n) == [(real(i, 8) + 3 * n, i = 1, n)])
+  end select
+  if (.not. test_passed) error stop "Test failed: wrong values."
+
+  sync all
+  if (me == 1) print *, "Test passed."
+end program
@@ -0,0 +1,76 @@
+! Test strided sections of rank 2 and 3 coarrays, with negative strides and
+! kind conversion, and vector subscripts given out of order and with
+! repeated indices, in gets, sends and sendgets between two remote arrays.
+
+program strided_multidim
+
+  implicit none
+  integer, parameter :: n = 8, m = 6, l = 5
+  integer :: a(n, m)[*], c(n, m, l)[*], v(20)[*], w(20)[*]
+  real(kind=8) :: r(n, m)[*]
+  integer :: loc2(n, m), loc3(n, m, l), idx(6), vals(6), i, j, k, me
+  integer :: g2(3, 3), g3(4, 3, 3)
+  real(kind=4) :: rs(4, 3)
+
+  if (num_images() < 2) error stop "Test failed: at least 2 images are needed."
+  me = this_image()
+  do j = 1, m
+    do i = 1, n
+      a(i, j) = me * 1000 + 10 * i + j
+      r(i, j) = me * 1000 + 10 * i + j + 0.5d0
+      do k = 1, l
+        c(i, j, k) = me * 10000 + 100 * i + 10 * j + k
+      end do
+    end do
+  end do
+  v = [(me * 100 + i, i = 1, 20)]
+  w = 0
+  loc2 = a
+  loc3 = c
+  sync all
+
+  if (me == 1) then
+    g2 = a(2:n:3, 1:m:2)[2]
+    if (any(g2 /= reshape([((2000 + 10 * i + j, i = 2, n, 3), &
+                            j = 1, m, 2)], [3, 3]))) &
+      error stop "Test failed: strided 2D get."
+    g3 = c(n:1:-2, 2:m:2, 1:l:2)[2]
+    do k = 1, 3
+      do j = 1, 3
+        do i = 1, 4
+          if (g3(i, j, k) /= &
+              20000 + 100 * (n + 2 - 2 * i) + 10 * (2 * j) + 2 * k - 1) &
+            error stop "Test failed: strided 3D get."
+        end do
+      end do
+    end do
+    rs = r(1:n:2, 2:m:2)[2]
+    if (any(rs /= reshape([((real(2000 + 10 * i + j + 0.5d0, 4), &
+                             i = 1, n, 2), j = 2, m, 2)], [4, 3]))) &
+      error stop "Test failed: converting strided 2D get."
+    idx = [9, 3, 3, 17, 4, 1]
+    vals = v(idx)[2]
+    if (any(vals /= 200 + idx)) error stop "Test failed: vector subscript get."
+
+    a(1:n:2, 2:m:3)[2] = reshape([(-i, i = 1, 8)], [4, 2])
+    c(2:n:2, 1:m:5, 2:l:2)[2] = reshape([(-i, i = 1, 16)], [4, 2, 2])
+    w([7, 2, 15, 3])[2] = [1, 2, 3, 4]
+    a(2:n:2, 1:m:5)[2] = c(1:n:2, 3:m:2, 3)[2]
+    v([5, 1, 12])[2] = v([20, 18, 19])[2]
+  end if
+  sync all
+
+  if (me == 2) then
+    loc2(1:n:2, 2:m:3) = reshape([(-i, i = 1, 8)], [4, 2])
+    loc2(2:n:2, 1:m:5) = loc3(1:n:2, 3:m:2, 3)
+    if (any(a /= loc2)) error stop "Test failed: strided 2D send or sendget."
+    loc3(2:n:2, 1:m:5, 2:l:2) = reshape([(-i, i = 1, 16)], [4, 2, 2])
+    if (any(c /= loc3)) error stop "Test failed: strided 3D send."
+    if (any(w([7, 2, 15, 3]) /= [1, 2, 3, 4]) .or. count(w /= 0) /= 4) &
+      error stop "Test failed: vector subscript send."
+    if (any(v([5, 1, 12]) /= [220, 218, 219])) &
+      error stop "Test failed: vector subscript sendget."
+  end if
+  sync all
+  if (me == 1) print *, "Test passed."
+end program
@@ -0,0 +1,104 @@
+! Test the atomic subroutines with an operation on image 1 from all other
+! images: atomic_fetch_add, atomic_fetch_and, atomic_fetch_or and
+! atomic_fetch_xor have to return the values they replaced, which chain from
+! the initial to the final value in some order, and atomic_and, atomic_or and
+! atomic_xor have to apply their own operation.
+
+program atomic_ops
+
+  use iso_fortran_env, only : atomic_int_kind
+  implicit none
+
+  integer(atomic_int_kind) :: fadd[*], fand[*], for[*], fxor[*]
+  integer(atomic_int_kind) :: aand[*], aor[*], axor[*]
+  integer(atomic_int_kind) :: oadd[*], oand[*], oor[*], oxor[*]
+  integer, allocatable :: olds(:), news(:)
+  integer :: me, np, k, bits, bit
+
+  me = this_image()
+  np = num_images()
+  if (np < 2) error stop "Test failed: at least 2 images are needed."
+  if (np > 30) error stop "Test failed: at most 30 images are supported."
+
+  if (me == 1) then
+    call atomic_define(fadd, 100)
+    call atomic_define(fand, -1)
+    call atomic_define(for, 1)
+    call atomic_define(fxor, 1)
+    call atomic_define(aand, -1)
+    call atomic_define(aor, 1)
+    call atomic_define(axor, 1)
+  end if
+  sync all
+
+  if (me > 1) then
+    bit = ishft(1, me)
+    call atomic_fetch_add(fadd[1], me, oadd)
+    call atomic_fetch_and(fand[1], not(bit), oand)
+    call atomic_fetch_or(for[1], bit, oor)
+    call atomic_fetch_xor(fxor[1], bit, oxor)
+    call atomic_and(aand[1], not(bit))
+    call atomic_or(aor[1], bit)
+    call atomic_xor(axor[1], bit)
+  end if
+  sync all
+
+  if (me == 1) then
+    bits = 0
+    do k = 2, np
+      bits = ior(bits, ishft(1, k))
+    end do
+    if (fadd /= 100 + np * (np + 1) / 2 - 1) &
+      error stop "Test failed: atomic_fetch_add."
+    if (fand /= not(bits)) error stop "Test failed: atomic_fetch_and."
+    if (for /= ior(1, bits)) error stop "Test failed: atomic_fetch_or."
+    if (fxor /= ior(1, bits)) error stop "Test failed: atomic_fetch_xor."
+    if (aand /= not(bits)) error stop "Test failed: atomic_and."
+    if (aor /= ior(1, bits)) error stop "Test failed: atomic_or."
+    if (axor /= ior(1, bits)) error stop "Test failed: atomic_xor."
+
+    allocate(olds(2:np), news(2:np))
+    do k = 2, np
+      olds(k) = oadd[k]
+      news(k) = olds(k) + k
+    end do
+    if (.not. chained(olds, news, 100, int(fadd))) &
+      error stop "Test failed: old values of atomic_fetch_add."
+    do k = 2, np
+      olds(k) = oand[k]
+      news(k) = iand(olds(k), not(ishft(1, k)))
+    end do
+    if (.not. chained(olds, news, -1, int(fand))) &
+      error stop "Test failed: old values of atomic_fetch_and."
+    do k = 2, np
+      olds(k) = oor[k]
+      news(k) = ior(olds(k), ishft(1, k))
+    end do
+    if (.not. chained(olds, news, 1, int(for))) &
+      error stop "Test failed: old values of atomic_fetch_or."
+    do k = 2, np
+      olds(k) = oxor[k]
+      news(k) = ieor(olds(k), ishft(1, k))
+    end do
+    if (.not. chained(olds, news, 1, int(fxor))) &
+      error stop "Test failed: old values of atomic_fetch_xor."
+  end if
+
+  sync all
+  if (me == 1) print *, "Test passed."
+
+contains
+
+  ! Whether the operations replacing olds(k) by news(k) can have been applied
+  ! one after the other, starting from initial and ending with final.
+  logical function chained(olds, news, initial, final)
+    integer, intent(in) :: olds(:), news(:), initial, final
+    integer :: k
+
+    chained = count(olds == initial) == 1 .and. count(news == final) == 1
+    do k = 1, size(olds)
+      if (olds(k) /= initial) &
+        chained = chained .and. count(news == olds(k)) == 1
+    end do
+  end function
+end program
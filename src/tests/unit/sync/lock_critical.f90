@@ -0,0 +1,55 @@
+! LOCK, UNLOCK and CRITICAL test
+!
+! Every image increments counters on image 1 inside a critical section and
+! while holding lock variables on image 1 and on itself, so that lost updates
+! show up when the mutual exclusion fails.
+!
+program lock_critical
+  use iso_fortran_env, only : lock_type
+  implicit none
+
+  integer, parameter :: n = 200
+  type(lock_type) :: locks(2)[*]
+  integer :: counter(3)[*]
+  integer :: me, np, i, stat
+  logical :: acquired
+
+  me = this_image()
+  np = num_images()
+  counter = 0
+  sync all
+
+  do i = 1, n
+    critical
+      counter(1)[1] = counter(1)[1] + 1
+    end critical
+    lock(locks(1)[1])
+    counter(2)[1] = counter(2)[1] + 1
+    unlock(locks(1)[1])
+    lock(locks(2)[mod(me, np) + 1])
+    counter(3)[mod(me, np) + 1] = counter(3)[mod(me, np) + 1] + 1
+    unlock(locks(2)[mod(me, np) + 1])
+  end do
+
+  ! Locking a lock variable held by this image is an error.
+  lock(locks(1)[1])
+  stat = 0
+  lock(locks(1)[1], stat=stat)
+  if (stat == 0) error stop "Test failed: locked twice."
+  unlock(locks(1)[1])
+
+  ! The lock is only tried with acquired_lock.
+  acquired = .false.
+  do while (.not. acquired)
+    lock(locks(2)[me], acquired_lock=acquired)
+  end do
+  unlock(locks(2)[me])
+  sync all
+
+  if (me == 1) then
+    if (counter(1) /= n * np .or. counter(2) /= n * np) error stop "Test failed."
+  end if
+  if (counter(3) /= n) error stop "Test failed."
+  sync all
+  if (me == 1) print *, "Test passed."
+end program